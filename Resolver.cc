@@ -0,0 +1,266 @@
+#include "Resolver.h"
+#include "log_rate.h"
+#include "stats.h"
+
+#include <muduo/net/EventLoop.h>
+#include <boost/bind.hpp>
+#include <muduo/base/Logging.h>
+#include <algorithm>
+
+using namespace zy;
+
+namespace
+{
+// bound the cache, a sweep drops expired entries before a new one is added
+const size_t kMaxEntries = 10000;
+const double kSweepInterval = 60;
+}
+
+Resolver::Resolver(muduo::net::EventLoop *loop, TimingWheel *wheel)
+    : loop_(loop),
+      wheel_(wheel),
+      ares_(loop_),
+      timeout_(3), // set default dns resolve timeout to 3 seconds
+      min_ttl_(30),
+      max_ttl_(3600),
+      negative_ttl_(5),
+      last_family_(AF_INET6),
+      cache_(),
+      pending_(),
+      sweepTimer_(),
+      hits_(0),
+      misses_(0),
+      coalesced_(0),
+      queries_(0),
+      query_seconds_(0)
+{
+  sweepTimer_ = loop_->runEvery(kSweepInterval, boost::bind(&Resolver::onSweep, this));
+}
+
+Resolver::~Resolver()
+{
+  loop_->cancel(sweepTimer_);
+}
+
+void Resolver::resolve(const muduo::string &host, uint16_t port, const boost::weak_ptr<muduo::net::TcpConnection>& serverCon)
+{
+  resolve(host, port,
+          boost::bind(&Resolver::onConnectionResolve, this, serverCon, host, _1),
+          boost::bind(&Resolver::onConnectionError, this, serverCon, host));
+}
+
+void Resolver::resolve(const muduo::string &host,
+                       uint16_t port,
+                       const AddressCallback &addressCb,
+                       const FailCallback &failCb)
+{
+  RequestPtr request(new Request(host, port, addressCb, failCb));
+  loop_->runInLoop(boost::bind(&Resolver::resolve_in_loop, this, request));
+}
+
+void Resolver::onAnswer(const muduo::string &host,
+                        muduo::Timestamp start,
+                        AresResolver::Status status,
+                        const AddressList &addresses,
+                        int ttl)
+{
+  muduo::Timestamp now = muduo::Timestamp::now();
+  ++queries_;
+  query_seconds_ += muduo::timeDifference(now, start);
+  stats::observe(stats::kDnsSeconds, muduo::timeDifference(now, start));
+
+  Entry& entry = cache_[host];
+  entry.addresses.clear();
+  for(const auto& addr : addresses)
+  {
+    if(is_valid(addr))
+      entry.addresses.push_back(addr);
+  }
+  bool cacheable = true;
+  if(!entry.addresses.empty())
+  {
+    entry.expire = muduo::addTime(now, std::min(std::max(ttl, min_ttl_), max_ttl_));
+  }
+  else if(status == AresResolver::kOk || status == AresResolver::kNotFound || status == AresResolver::kTimeout)
+  {
+    LOG_INFO_LIMITED(10) << "resolve " << host << " failed: " << AresResolver::status_name(status);
+    entry.expire = muduo::addTime(now, negative_ttl_);
+  }
+  else
+  {
+    // server failure or refused, do not remember it
+    LOG_ERROR_LIMITED(10) << "resolve " << host << " failed: " << AresResolver::status_name(status);
+    cacheable = false;
+  }
+  std::vector<RequestPtr> requests;
+  auto it = pending_.find(host);
+  if(it != pending_.end())
+  {
+    requests.swap(it->second);
+    pending_.erase(it);
+  }
+  // requests past their deadline were counted by onError already
+  if(status == AresResolver::kTimeout
+     && std::any_of(requests.begin(), requests.end(), [](const RequestPtr& request) { return !request->done; }))
+    stats::add(stats::kDnsTimeouts);
+  for(const auto& request : requests)
+  {
+    if(!request->done)
+      TimingWheel::cancel(request->timeout);
+    finish(request, entry);
+  }
+  if(!cacheable)
+    cache_.erase(host);
+  else if(cache_.size() > kMaxEntries)
+  {
+    onSweep();
+    if(cache_.size() > kMaxEntries)
+      cache_.erase(host);
+  }
+}
+
+void Resolver::finish(const RequestPtr &request, const Entry &entry)
+{
+  if(request->done)
+    return;
+  request->done = true;
+  if(entry.addresses.empty())
+  {
+    request->failCallback();
+    return;
+  }
+  AddressList addresses = sort(entry);
+  for(auto& addr : addresses)
+    addr = muduo::net::InetAddress(addr.toIp(), request->port, addr.family() == AF_INET6);
+  request->addressCallback(addresses);
+}
+
+Resolver::AddressList Resolver::sort(const Entry &entry) const
+{
+  sa_family_t first = entry.has_preferred ? entry.preferred.family() : last_family_;
+  AddressList firsts;
+  AddressList others;
+  for(const auto& addr : entry.addresses)
+  {
+    if(entry.has_preferred && addr.toIp() == entry.preferred.toIp())
+      firsts.insert(firsts.begin(), addr);
+    else if(addr.family() == first)
+      firsts.push_back(addr);
+    else
+      others.push_back(addr);
+  }
+  AddressList addresses;
+  addresses.reserve(entry.addresses.size());
+  for(size_t i = 0; i < firsts.size() || i < others.size(); ++i)
+  {
+    if(i < firsts.size())
+      addresses.push_back(firsts[i]);
+    if(i < others.size())
+      addresses.push_back(others[i]);
+  }
+  return addresses;
+}
+
+void Resolver::prefer(const muduo::string &host, const muduo::net::InetAddress &addr)
+{
+  last_family_ = addr.family();
+  auto it = cache_.find(host);
+  if(it != cache_.end())
+  {
+    it->second.preferred = addr;
+    it->second.has_preferred = true;
+  }
+}
+
+void Resolver::onSweep()
+{
+  muduo::Timestamp now = muduo::Timestamp::now();
+  for(auto it = cache_.begin(); it != cache_.end();)
+  {
+    if(it->second.expire < now)
+      it = cache_.erase(it);
+    else
+      ++it;
+  }
+  int64_t total = hits_ + misses_;
+  if(total > 0)
+  {
+    LOG_INFO << "dns cache entries " << cache_.size() << " hits " << hits_ << " misses " << misses_
+             << " coalesced " << coalesced_ << " hit rate " << hits_ * 100 / total << "%"
+             << " queries " << queries_ << " avg query ms "
+             << (queries_ > 0 ? static_cast<int64_t>(query_seconds_ * 1000 / queries_) : 0);
+  }
+}
+
+void Resolver::onError(const RequestPtr &request)
+{
+  if(request->done)
+    return;
+  request->done = true;
+  LOG_INFO_LIMITED(10) << "resolve timeout to " << request->host;
+  stats::add(stats::kDnsTimeouts);
+  request->failCallback();
+}
+
+void Resolver::onConnectionResolve(const boost::weak_ptr<muduo::net::TcpConnection> &serverCon,
+                                   const muduo::string &host,
+                                   const AddressList &addresses)
+{
+  muduo::net::TcpConnectionPtr con = serverCon.lock();
+  if(!con)
+  {
+    LOG_WARN_LIMITED(10) << "Resolver::onResolve lost client connection, the resolve host is " << host;
+  }
+  else if(resolveCallback_)
+  {
+    resolveCallback_(con, host, addresses);
+  }
+}
+
+void Resolver::onConnectionError(const boost::weak_ptr<muduo::net::TcpConnection> &serverCon, const muduo::string &host)
+{
+  auto conn = serverCon.lock();
+  if(!conn)
+  {
+    LOG_WARN_LIMITED(10) << "Resolver::onError lost client connection, the resolve host is " << host;
+  }
+  else if(errorCallback_)
+  {
+    errorCallback_(conn, host);
+  }
+}
+
+bool Resolver::is_valid(const muduo::net::InetAddress &address) {
+  if(address.family() == AF_INET6)
+  {
+    auto addr6 = reinterpret_cast<const struct sockaddr_in6*>(address.getSockAddr());
+    return !IN6_IS_ADDR_UNSPECIFIED(&addr6->sin6_addr);
+  }
+  return address.ipNetEndian() != INADDR_ANY;
+}
+
+void Resolver::resolve_in_loop(const RequestPtr &request)
+{
+  auto entry = cache_.find(request->host);
+  if(entry != cache_.end())
+  {
+    if(muduo::Timestamp::now() < entry->second.expire)
+    {
+      ++hits_;
+      finish(request, entry->second);
+      return;
+    }
+  }
+  ++misses_;
+  // 设置超时回调函数
+  request->timeout = wheel_->add(timeout_, boost::bind(&Resolver::onError, this, request));
+  auto& requests = pending_[request->host];
+  requests.push_back(request);
+  if(requests.size() > 1)
+  {
+    ++coalesced_;
+    return;
+  }
+  ares_.query(request->host,
+              boost::bind(&Resolver::onAnswer, this, request->host, muduo::Timestamp::now(), _1, _2, _3));
+}
\ No newline at end of file
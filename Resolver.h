@@ -0,0 +1,155 @@
+#pragma once
+
+#include "ares_resolver.h"
+#include "timing_wheel.h"
+
+#include <boost/noncopyable.hpp>
+#include <boost/weak_ptr.hpp>
+#include <muduo/net/TcpConnection.h>
+#include <muduo/net/TimerId.h>
+#include <unordered_map>
+#include <vector>
+
+namespace zy
+{
+// resolve every A and AAAA address of a host, ordered for happy eyeballs,
+// with a per loop cache of answers, kept for the ttl of the records clamped to
+// [min_ttl, max_ttl], failures are kept for negative_ttl, requests for a host which is
+// being queried wait for that query instead of sending another one
+class Resolver : boost::noncopyable
+{
+ public:
+  typedef boost::function<void(const muduo::net::TcpConnectionPtr&, const muduo::string&)> ErrorCallback;
+  typedef AresResolver::AddressList AddressList;
+  typedef boost::function<void(const muduo::net::TcpConnectionPtr&, const muduo::string&, const AddressList&)> ResolveCallback;
+  // per request callbacks, for users which are not bound to a connection
+  typedef boost::function<void(const AddressList&)> AddressCallback;
+  typedef boost::function<void()> FailCallback;
+
+  // request timeouts go to the wheel of the loop
+  Resolver(muduo::net::EventLoop* loop, TimingWheel* wheel);
+
+  void setResolveCallback(const ResolveCallback& resolveCb){ resolveCallback_ = resolveCb; }
+
+  void setErrorCallback(const ErrorCallback& errorCb) { errorCallback_ = errorCb; }
+
+  // resolve in loop, thread safe, if from weak_ptr, not from shared_ptr directly
+  void resolve(const muduo::string& host, uint16_t port, const boost::weak_ptr<muduo::net::TcpConnection>& serverCon);
+
+  // resolve in loop, thread safe, exactly one of the callbacks is called
+  void resolve(const muduo::string& host, uint16_t port, const AddressCallback& addressCb, const FailCallback& failCb);
+
+  void set_timeout(double timeout)
+  {
+    timeout_ = timeout;
+    ares_.set_timeout(timeout);
+  }
+
+  void set_ttl(int min_ttl, int max_ttl)
+  {
+    min_ttl_ = min_ttl;
+    max_ttl_ = max_ttl;
+  }
+
+  void set_negative_ttl(int ttl) { negative_ttl_ = ttl; }
+
+  void set_servers(const std::string& servers) { ares_.set_servers(servers); }
+
+  ~Resolver();
+
+  // the connection to addr of host was built first, try it first next time
+  void prefer(const muduo::string& host, const muduo::net::InetAddress& addr);
+
+  int64_t hits() const { return hits_; }
+
+  int64_t misses() const { return misses_; }
+
+  // misses which waited for a query already sent
+  int64_t coalesced() const { return coalesced_; }
+
+  int64_t queries() const { return queries_; }
+
+  // seconds spent in upstream queries
+  double query_seconds() const { return query_seconds_; }
+
+  size_t cache_size() const { return cache_.size(); }
+
+ private:
+  struct Request
+  {
+    Request(const muduo::string& host_, uint16_t port_, const AddressCallback& addressCb, const FailCallback& failCb)
+        : host(host_),
+          port(port_),
+          addressCallback(addressCb),
+          failCallback(failCb),
+          done(false),
+          timeout()
+    { }
+
+    muduo::string host;
+    uint16_t port;
+    AddressCallback addressCallback;
+    FailCallback failCallback;
+    bool done; // the timeout and the answer may both arrive, only handle the first one
+    WheelEntryPtr timeout;
+  };
+  typedef boost::shared_ptr<Request> RequestPtr;
+
+  struct Entry
+  {
+    Entry()
+        : addresses(),
+          expire(),
+          preferred(),
+          has_preferred(false)
+    { }
+
+    AddressList addresses; // empty if the host failed to resolve
+    muduo::Timestamp expire;
+    muduo::net::InetAddress preferred; // winner of the last connect, kept across refreshes
+    bool has_preferred;
+  };
+
+  void onAnswer(const muduo::string& host, muduo::Timestamp start,
+                AresResolver::Status status, const AddressList& addresses, int ttl);
+
+  void finish(const RequestPtr& request, const Entry& entry);
+
+  // the preferred address, then the addresses of both families interleaved,
+  // starting with the family of the preferred or of the last winner, see RFC 8305
+  AddressList sort(const Entry& entry) const;
+
+  // drop expired entries and log stats
+  void onSweep();
+
+  void onError(const RequestPtr& request);
+
+  void onConnectionResolve(const boost::weak_ptr<muduo::net::TcpConnection>& serverCon, const muduo::string& host,
+                           const AddressList& addresses);
+
+  void onConnectionError(const boost::weak_ptr<muduo::net::TcpConnection>& serverCon, const muduo::string& host);
+
+  static bool is_valid(const muduo::net::InetAddress& address);
+
+  void resolve_in_loop(const RequestPtr& request);
+
+  muduo::net::EventLoop* loop_;
+  TimingWheel* wheel_;
+  AresResolver ares_;
+  double timeout_;
+  int min_ttl_;
+  int max_ttl_;
+  int negative_ttl_;
+  sa_family_t last_family_; // family of the last winner of any host
+  std::unordered_map<muduo::string, Entry> cache_;
+  std::unordered_map<muduo::string, std::vector<RequestPtr>> pending_;
+  muduo::net::TimerId sweepTimer_;
+  int64_t hits_;
+  int64_t misses_;
+  int64_t coalesced_;
+  int64_t queries_;
+  double query_seconds_;
+  ErrorCallback errorCallback_;
+  ResolveCallback resolveCallback_;
+};
+}
\ No newline at end of file
@@ -0,0 +1,265 @@
+#include "ares_resolver.h"
+
+#include <muduo/net/Channel.h>
+#include <muduo/net/EventLoop.h>
+#include <muduo/base/Logging.h>
+#include <boost/bind.hpp>
+#include <ares.h>
+#include <algorithm>
+#include <memory>
+#include <string.h>
+
+using namespace zy;
+
+namespace
+{
+const int kMaxAddresses = 16;
+
+// keep a removed channel alive until the current event handling is over
+void release_channel(const boost::shared_ptr<muduo::net::Channel>&)
+{
+}
+}
+
+AresResolver::AresResolver(muduo::net::EventLoop *loop)
+    : loop_(loop),
+      ctx_(NULL),
+      timeout_(3), // same default as zy::Resolver
+      servers_(),
+      timerActive_(false),
+      destroying_(false),
+      channels_()
+{
+
+}
+
+AresResolver::~AresResolver()
+{
+  destroying_ = true;
+  // pending queries are called back with ARES_EDESTRUCTION, which is ignored
+  if(ctx_)
+    ares_destroy(ctx_);
+  for(auto& channel : channels_)
+  {
+    channel.second->disableAll();
+    channel.second->remove();
+  }
+}
+
+void AresResolver::init()
+{
+  static int init_status = ares_library_init(ARES_LIB_INIT_ALL);
+  if(init_status != ARES_SUCCESS)
+  {
+    LOG_FATAL << "ares_library_init failed: " << ares_strerror(init_status);
+  }
+  struct ares_options options;
+  ::memset(&options, 0, sizeof options);
+  options.flags = ARES_FLAG_NOCHECKRESP;
+  options.timeout = static_cast<int>(timeout_ * 1000);
+  options.tries = 1;
+  options.sock_state_cb = &AresResolver::onSockStateCallback;
+  options.sock_state_cb_data = this;
+  // dns only, do not look at /etc/hosts
+  options.lookups = const_cast<char*>("b");
+  int status = ares_init_options(&ctx_, &options,
+                                 ARES_OPT_FLAGS | ARES_OPT_TIMEOUTMS | ARES_OPT_TRIES
+                                 | ARES_OPT_SOCK_STATE_CB | ARES_OPT_LOOKUPS);
+  if(status != ARES_SUCCESS)
+  {
+    LOG_FATAL << "ares_init_options failed: " << ares_strerror(status);
+  }
+  if(!servers_.empty())
+  {
+    status = ares_set_servers_ports_csv(ctx_, servers_.c_str());
+    if(status != ARES_SUCCESS)
+    {
+      LOG_FATAL << "invalid dns servers " << servers_ << ": " << ares_strerror(status);
+    }
+  }
+  ares_set_socket_callback(ctx_, &AresResolver::onSockCreateCallback, this);
+}
+
+void AresResolver::query(const muduo::string &host, const QueryCallback &cb)
+{
+  loop_->assertInLoopThread();
+  if(!ctx_)
+    init();
+  // both answers share the query, the second one calls back
+  Query* query = new Query(this, cb);
+  ares_query(ctx_, host.c_str(), ns_c_in, ns_t_aaaa, &AresResolver::onAaaaResult, query);
+  ares_query(ctx_, host.c_str(), ns_c_in, ns_t_a, &AresResolver::onAResult, query);
+  schedule_timer();
+}
+
+const char* AresResolver::status_name(Status status)
+{
+  switch(status)
+  {
+    case kOk:
+      return "ok";
+    case kNotFound:
+      return "not found";
+    case kTimeout:
+      return "timeout";
+    default:
+      return "error";
+  }
+}
+
+void AresResolver::onRead(int sockfd, muduo::Timestamp)
+{
+  ares_process_fd(ctx_, sockfd, ARES_SOCKET_BAD);
+}
+
+void AresResolver::onWrite(int sockfd)
+{
+  ares_process_fd(ctx_, ARES_SOCKET_BAD, sockfd);
+}
+
+// ares keeps its own retransmit timers, ask it how long to wait and let it handle them
+void AresResolver::schedule_timer()
+{
+  if(timerActive_)
+    return;
+  struct timeval tv;
+  struct timeval* tvp = ares_timeout(ctx_, NULL, &tv);
+  if(!tvp)
+    return;
+  double delay = std::max(static_cast<double>(tvp->tv_sec) + tvp->tv_usec / 1000000.0, 0.001);
+  timerActive_ = true;
+  loop_->runAfter(delay, boost::bind(&AresResolver::onTimer, this));
+}
+
+void AresResolver::onTimer()
+{
+  timerActive_ = false;
+  if(destroying_)
+    return;
+  ares_process_fd(ctx_, ARES_SOCKET_BAD, ARES_SOCKET_BAD);
+  schedule_timer();
+}
+
+void AresResolver::onSockCreate(int sockfd)
+{
+  ChannelPtr channel(new muduo::net::Channel(loop_, sockfd));
+  channel->setReadCallback(boost::bind(&AresResolver::onRead, this, sockfd, _1));
+  channel->setWriteCallback(boost::bind(&AresResolver::onWrite, this, sockfd));
+  channel->enableReading();
+  channels_[sockfd] = channel;
+}
+
+void AresResolver::onSockStateChange(int sockfd, bool read, bool write)
+{
+  auto it = channels_.find(sockfd);
+  if(it == channels_.end())
+    return;
+  if(read)
+  {
+    // tcp connect in progress
+    if(write)
+      it->second->enableWriting();
+    else
+      it->second->disableWriting();
+    return;
+  }
+  // ares is closing the socket
+  it->second->disableAll();
+  it->second->remove();
+  if(!destroying_)
+    loop_->queueInLoop(boost::bind(&release_channel, it->second));
+  channels_.erase(it);
+}
+
+int AresResolver::parse(Query *query, int type, int status, const unsigned char *abuf, int alen)
+{
+  if(status != ARES_SUCCESS)
+    return status;
+  int count = 0;
+  int ttl = 0;
+  if(type == ns_t_a)
+  {
+    struct ares_addrttl addrttls[kMaxAddresses];
+    count = kMaxAddresses;
+    status = ares_parse_a_reply(abuf, alen, NULL, addrttls, &count);
+    for(int i = 0; status == ARES_SUCCESS && i < count; ++i)
+    {
+      struct sockaddr_in addr;
+      ::memset(&addr, 0, sizeof addr);
+      addr.sin_family = AF_INET;
+      addr.sin_addr = addrttls[i].ipaddr;
+      query->ipv4.push_back(muduo::net::InetAddress(addr));
+      ttl = i == 0 ? addrttls[i].ttl : std::min(ttl, addrttls[i].ttl);
+    }
+  }
+  else
+  {
+    struct ares_addr6ttl addrttls[kMaxAddresses];
+    count = kMaxAddresses;
+    status = ares_parse_aaaa_reply(abuf, alen, NULL, addrttls, &count);
+    for(int i = 0; status == ARES_SUCCESS && i < count; ++i)
+    {
+      struct sockaddr_in6 addr;
+      ::memset(&addr, 0, sizeof addr);
+      addr.sin6_family = AF_INET6;
+      ::memcpy(&addr.sin6_addr, &addrttls[i].ip6addr, sizeof addr.sin6_addr);
+      query->ipv6.push_back(muduo::net::InetAddress(addr));
+      ttl = i == 0 ? addrttls[i].ttl : std::min(ttl, addrttls[i].ttl);
+    }
+  }
+  if(status == ARES_SUCCESS && count > 0)
+    query->ttl = query->ttl < 0 ? ttl : std::min(query->ttl, ttl);
+  return status;
+}
+
+void AresResolver::onQueryResult(Query *query, int type, int status, const unsigned char *abuf, int alen)
+{
+  if(status != ARES_EDESTRUCTION && !query->owner->destroying_)
+  {
+    status = parse(query, type, status, abuf, alen);
+    if(status == ARES_ETIMEOUT)
+      query->timeout = true;
+    else if(status != ARES_SUCCESS && status != ARES_ENOTFOUND && status != ARES_ENODATA)
+      query->error = true;
+    if(status != ARES_SUCCESS)
+      LOG_DEBUG << "ares query of type " << type << " failed: " << ares_strerror(status);
+  }
+  else
+  {
+    query->owner = NULL;
+  }
+  if(--query->remaining > 0)
+    return;
+
+  std::unique_ptr<Query> guard(query);
+  if(!query->owner)
+    return;
+  AddressList addresses;
+  addresses.swap(query->ipv6);
+  addresses.insert(addresses.end(), query->ipv4.begin(), query->ipv4.end());
+  Status result = kOk;
+  if(addresses.empty())
+    result = query->error ? kError : (query->timeout ? kTimeout : kNotFound);
+  query->callback(result, addresses, std::max(query->ttl, 0));
+}
+
+void AresResolver::onAResult(void *arg, int status, int, unsigned char *abuf, int alen)
+{
+  onQueryResult(static_cast<Query*>(arg), ns_t_a, status, abuf, alen);
+}
+
+void AresResolver::onAaaaResult(void *arg, int status, int, unsigned char *abuf, int alen)
+{
+  onQueryResult(static_cast<Query*>(arg), ns_t_aaaa, status, abuf, alen);
+}
+
+int AresResolver::onSockCreateCallback(int sockfd, int, void *arg)
+{
+  static_cast<AresResolver*>(arg)->onSockCreate(sockfd);
+  return 0;
+}
+
+void AresResolver::onSockStateCallback(void *arg, int sockfd, int read, int write)
+{
+  static_cast<AresResolver*>(arg)->onSockStateChange(sockfd, read != 0, write != 0);
+}
\ No newline at end of file
@@ -0,0 +1,116 @@
+#pragma once
+
+#include <muduo/net/InetAddress.h>
+#include <muduo/base/Timestamp.h>
+#include <boost/function.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+#include <map>
+#include <string>
+#include <vector>
+
+struct ares_channeldata;
+
+namespace muduo
+{
+namespace net
+{
+class Channel;
+class EventLoop;
+}
+}
+
+namespace zy
+{
+// dns queries of c-ares driven by the event loop, unlike cdns::Resolver it
+// reports every address of the answer together with the ttl of the records
+class AresResolver : boost::noncopyable
+{
+ public:
+  enum Status
+  {
+    kOk,
+    kNotFound, // NXDOMAIN or no record of the type
+    kTimeout,
+    kError
+  };
+  typedef std::vector<muduo::net::InetAddress> AddressList;
+  // addresses come with port 0, AAAA records first, ttl is the smallest ttl of the records in seconds
+  typedef boost::function<void(Status, const AddressList&, int)> QueryCallback;
+
+  explicit AresResolver(muduo::net::EventLoop* loop);
+
+  ~AresResolver();
+
+  // must be called before the first query
+  void set_timeout(double timeout) { timeout_ = timeout; }
+
+  // "host:port,host:port" instead of resolv.conf, must be called before the first query
+  void set_servers(const std::string& servers) { servers_ = servers; }
+
+  // in loop thread, query the A and AAAA records of host, cb is called once both are answered
+  void query(const muduo::string& host, const QueryCallback& cb);
+
+  static const char* status_name(Status status);
+
+ private:
+  struct Query
+  {
+    Query(AresResolver* owner_, const QueryCallback& cb)
+        : owner(owner_),
+          callback(cb),
+          remaining(2),
+          ipv4(),
+          ipv6(),
+          ttl(-1),
+          timeout(false),
+          error(false)
+    { }
+
+    AresResolver* owner;
+    QueryCallback callback;
+    int remaining; // answers still to come
+    AddressList ipv4;
+    AddressList ipv6;
+    int ttl;
+    bool timeout;
+    bool error;
+  };
+  typedef boost::shared_ptr<muduo::net::Channel> ChannelPtr;
+
+  void init();
+
+  void onRead(int sockfd, muduo::Timestamp receiveTime);
+
+  void onWrite(int sockfd);
+
+  void onTimer();
+
+  void schedule_timer();
+
+  void onSockCreate(int sockfd);
+
+  void onSockStateChange(int sockfd, bool read, bool write);
+
+  // parse one answer into query, return the ares status
+  static int parse(Query* query, int type, int status, const unsigned char* abuf, int alen);
+
+  static void onQueryResult(Query* query, int type, int status, const unsigned char* abuf, int alen);
+
+  static void onAResult(void* arg, int status, int timeouts, unsigned char* abuf, int alen);
+
+  static void onAaaaResult(void* arg, int status, int timeouts, unsigned char* abuf, int alen);
+
+  static int onSockCreateCallback(int sockfd, int type, void* arg);
+
+  static void onSockStateCallback(void* arg, int sockfd, int read, int write);
+
+  muduo::net::EventLoop* loop_;
+  ares_channeldata* ctx_;
+  double timeout_;
+  std::string servers_;
+  bool timerActive_;
+  bool destroying_;
+  std::map<int, ChannelPtr> channels_;
+};
+}
\ No newline at end of file
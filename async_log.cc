@@ -0,0 +1,140 @@
+#include "async_log.h"
+#include "stats.h"
+
+#include <muduo/base/LogFile.h>
+#include <boost/bind.hpp>
+
+using namespace zy;
+
+namespace
+{
+// buffers kept for reuse
+const size_t kMaxSpare = 2;
+}
+
+AsyncLog::AsyncLog(const std::string &basename, off_t roll_size, double flush_interval, size_t max_buffers)
+  : basename_(basename),
+    roll_size_(roll_size),
+    flush_interval_(flush_interval),
+    max_buffers_(max_buffers),
+    running_(false),
+    thread_(boost::bind(&AsyncLog::threadFunc, this), "async_log"),
+    mutex_(),
+    cond_(mutex_),
+    written_(mutex_),
+    current_(),
+    full_(),
+    spare_(),
+    rotated_(0),
+    written_count_(0)
+{
+  current_.reserve(kBufferSize);
+}
+
+AsyncLog::~AsyncLog()
+{
+  if(running_)
+    stop();
+}
+
+void AsyncLog::start()
+{
+  running_ = true;
+  thread_.start();
+}
+
+void AsyncLog::stop()
+{
+  {
+    muduo::MutexLockGuard lock(mutex_);
+    running_ = false;
+    cond_.notify();
+  }
+  thread_.join();
+}
+
+void AsyncLog::append(const char *line, int len)
+{
+  muduo::MutexLockGuard lock(mutex_);
+  if(current_.size() + static_cast<size_t>(len) > kBufferSize && !current_.empty())
+  {
+    if(full_.size() >= max_buffers_)
+    {
+      // the disk can't keep up, the loop must not wait for it
+      stats::add(stats::kLogDropped);
+      return;
+    }
+    rotate();
+    cond_.notify();
+  }
+  current_.append(line, static_cast<size_t>(len));
+}
+
+void AsyncLog::flush()
+{
+  muduo::MutexLockGuard lock(mutex_);
+  if(!current_.empty())
+    rotate();
+  int64_t target = rotated_;
+  cond_.notify();
+  while(running_ && written_count_ < target)
+  {
+    if(written_.waitForSeconds(1))
+      break;
+  }
+}
+
+void AsyncLog::rotate()
+{
+  full_.push_back(std::string());
+  full_.back().swap(current_);
+  ++rotated_;
+  if(!spare_.empty())
+  {
+    current_.swap(spare_.back());
+    spare_.pop_back();
+  }
+  else
+  {
+    current_.reserve(kBufferSize);
+  }
+}
+
+void AsyncLog::threadFunc()
+{
+  muduo::LogFile output(basename_, roll_size_, false);
+  BufferList to_write;
+  bool running = true;
+  while(running)
+  {
+    int64_t rotated;
+    {
+      muduo::MutexLockGuard lock(mutex_);
+      if(full_.empty() && running_)
+        cond_.waitForSeconds(flush_interval_);
+      // a quiet log reaches the disk after flush_interval too
+      if(!current_.empty())
+        rotate();
+      to_write.swap(full_);
+      rotated = rotated_;
+      running = running_;
+    }
+    for(const auto& buffer : to_write)
+      output.append(buffer.data(), static_cast<int>(buffer.size()));
+    output.flush();
+    {
+      muduo::MutexLockGuard lock(mutex_);
+      for(auto& buffer : to_write)
+      {
+        if(spare_.size() >= kMaxSpare)
+          break;
+        buffer.clear();
+        spare_.push_back(std::string());
+        spare_.back().swap(buffer);
+      }
+      written_count_ = rotated;
+      written_.notifyAll();
+    }
+    to_write.clear();
+  }
+}
\ No newline at end of file
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <muduo/base/Condition.h>
+#include <muduo/base/Mutex.h>
+#include <muduo/base/Thread.h>
+#include <boost/noncopyable.hpp>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace zy
+{
+// output of muduo::Logger, the way of muduo::AsyncLogging: lines go to a buffer under a
+// short lock, a background thread writes full buffers to a LogFile, so no loop waits for
+// the disk, when max_buffers are waiting already lines are dropped and counted instead,
+// see stats::kLogDropped
+class AsyncLog : boost::noncopyable
+{
+ public:
+  static const size_t kBufferSize = 1024 * 1024;
+
+  AsyncLog(const std::string& basename, off_t roll_size, double flush_interval = 3, size_t max_buffers = 16);
+
+  ~AsyncLog();
+
+  void start();
+
+  // write what is left and join the thread
+  void stop();
+
+  // any thread, never waits for io
+  void append(const char* line, int len);
+
+  // wait a while for everything appended so far to be written, for LOG_FATAL
+  void flush();
+
+ private:
+  typedef std::vector<std::string> BufferList;
+
+  void threadFunc();
+
+  // hand the current buffer to the thread, with mutex_ held
+  void rotate();
+
+  std::string basename_;
+  off_t roll_size_;
+  double flush_interval_;
+  size_t max_buffers_;
+  bool running_;
+  muduo::Thread thread_;
+  muduo::MutexLock mutex_;
+  muduo::Condition cond_; // wakes the thread
+  muduo::Condition written_; // wakes flush
+  std::string current_;
+  BufferList full_;
+  BufferList spare_; // written already, cleared with their capacity
+  int64_t rotated_; // buffers handed to the thread
+  int64_t written_count_;
+};
+}
\ No newline at end of file
@@ -0,0 +1,79 @@
+#include "accept_client.h"
+#include "frame.h"
+#include "messages.h"
+
+#include <muduo/net/EventLoop.h>
+#include <muduo/base/Logging.h>
+#include <boost/bind.hpp>
+
+using namespace zy;
+
+AcceptClient::AcceptClient(muduo::net::EventLoop *loop, const muduo::net::InetAddress &server_addr)
+  : loop_(loop),
+    client_(loop, server_addr, "accept_client"),
+    finished_(false),
+    ok_(false),
+    start_(),
+    seconds_(0),
+    finishCallback_()
+{
+  client_.setConnectionCallback(boost::bind(&AcceptClient::onConnection, this, _1));
+  client_.setMessageCallback(boost::bind(&AcceptClient::onMessage, this, _1, _2, _3));
+}
+
+void AcceptClient::start()
+{
+  start_ = muduo::Timestamp::now();
+  client_.connect();
+}
+
+void AcceptClient::onConnection(const muduo::net::TcpConnectionPtr &con)
+{
+  if(con->connected())
+  {
+    con->setTcpNoDelay(true);
+    msg::ClientMsg& message = messages::client_msg();
+    message.set_type(msg::ClientMsg_Type_REQUEST);
+    auto request_ptr = message.mutable_request();
+    request_ptr->set_password("accept_bench");
+    request_ptr->set_cmd(0x01);
+    request_ptr->set_addr("");
+    request_ptr->set_port(0);
+    muduo::net::Buffer& buf = messages::output();
+    frame::append_message(&buf, message);
+    con->send(&buf);
+  }
+  else
+  {
+    finish(false);
+  }
+}
+
+void AcceptClient::onMessage(const muduo::net::TcpConnectionPtr &con, muduo::net::Buffer *buf, muduo::Timestamp receiveTime)
+{
+  frame::Header header;
+  frame::Status status = frame::peek(buf, &header);
+  if(status == frame::kIncomplete)
+    return;
+  msg::ServerMsg& serverMsg = messages::server_msg();
+  bool refused = status == frame::kComplete && header.type == frame::kMessage
+      && serverMsg.ParseFromArray(buf->peek() + frame::kHeaderLength, header.length)
+      && serverMsg.type() == msg::ServerMsg_Type_RESPONSE && serverMsg.response().rep() == 0x05;
+  buf->retrieveAll();
+  if(!refused)
+    LOG_ERROR << "unexpected answer of socks_server";
+  seconds_ = muduo::timeDifference(receiveTime, start_);
+  finish(refused);
+}
+
+void AcceptClient::finish(bool ok)
+{
+  if(finished_)
+    return;
+  finished_ = true;
+  ok_ = ok;
+  client_.disconnect();
+  // the TcpClient must not be destroyed inside its own callback
+  if(finishCallback_)
+    loop_->queueInLoop(boost::bind(finishCallback_, shared_from_this()));
+}
\ No newline at end of file
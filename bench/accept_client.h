@@ -0,0 +1,49 @@
+#pragma once
+
+#include <muduo/net/TcpClient.h>
+#include <boost/enable_shared_from_this.hpp>
+#include <boost/function.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+
+namespace zy
+{
+// one connection straight to socks_server, sends a REQUEST with a wrong password and
+// waits for the refusal, so a run measures how fast the server accepts and answers
+class AcceptClient : boost::noncopyable,
+                     public boost::enable_shared_from_this<AcceptClient>
+{
+ public:
+  typedef boost::shared_ptr<AcceptClient> AcceptClientPtr;
+  // called once, in loop, the client may be destroyed after it returns
+  typedef boost::function<void(const AcceptClientPtr&)> FinishCallback;
+
+  AcceptClient(muduo::net::EventLoop* loop, const muduo::net::InetAddress& server_addr);
+
+  void setFinishCallback(const FinishCallback& cb) { finishCallback_ = cb; }
+
+  void start();
+
+  bool ok() const { return ok_; }
+
+  // from connect until the refusal, in seconds
+  double seconds() const { return seconds_; }
+
+ private:
+  void onConnection(const muduo::net::TcpConnectionPtr& con);
+
+  void onMessage(const muduo::net::TcpConnectionPtr& con, muduo::net::Buffer* buf, muduo::Timestamp receiveTime);
+
+  void finish(bool ok);
+
+  muduo::net::EventLoop* loop_;
+  muduo::net::TcpClient client_;
+  bool finished_;
+  bool ok_;
+  muduo::Timestamp start_;
+  double seconds_;
+  FinishCallback finishCallback_;
+};
+
+typedef AcceptClient::AcceptClientPtr AcceptClientPtr;
+}
\ No newline at end of file
@@ -0,0 +1,117 @@
+#include "codec.h"
+#include "compressor.h"
+#include "frame.h"
+
+#include <muduo/net/Buffer.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <new>
+#include <string>
+
+using namespace zy;
+
+// the data path of socks_server::onMessage must not allocate once it is warm: frame::decode
+// peeks frames in the input buffer, compressed payloads go to the scratch string of the loop,
+// and are sent from there, exits 1 if any operator new is counted
+namespace
+{
+int64_t g_allocs = 0;
+
+const int kWarmRounds = 3;
+const int kRounds = 100;
+
+std::string make_text(size_t size)
+{
+  const char kText[] = "GET /index.html HTTP/1.1\r\nHost: alloc.zy_socks\r\nAccept: */*\r\n\r\n";
+  std::string text;
+  for(size_t i = 0; i < size; ++i)
+    text.push_back(kText[i % (sizeof(kText) - 1)]);
+  return text;
+}
+
+// what a socks client sends through local_server with this codec, frames of 64B to 64KB
+std::string make_wire(codec::Type type)
+{
+  Compressor compressor(type);
+  muduo::net::Buffer buf;
+  for(size_t size = 64; size <= 64 * 1024; size *= 4)
+  {
+    std::string text = make_text(size);
+    compressor.append(&buf, frame::kData, text.data(), text.size());
+  }
+  return buf.retrieveAllAsString();
+}
+
+// a tunnel in transport, out stands for the output buffer of the target
+class Target : public frame::Handler
+{
+ public:
+  Target(codec::Type codec, muduo::net::Buffer* out)
+      : codec_(codec),
+        out_(out)
+  { }
+
+  bool accepts(int codec) override { return codec == codec_; }
+
+  bool onFrame(const frame::Header& header, const muduo::StringPiece& payload) override
+  {
+    if(header.type != frame::kData)
+      return false;
+    out_->append(payload.data(), payload.size());
+    return true;
+  }
+
+ private:
+  codec::Type codec_;
+  muduo::net::Buffer* out_;
+};
+
+// one read of the socks_server connection
+bool decode(const std::string& wire, muduo::net::Buffer* in, std::string* scratch, Target* target, muduo::net::Buffer* out)
+{
+  in->append(wire.data(), wire.size());
+  bool ok = frame::decode(in, scratch, target);
+  out->retrieveAll();
+  return ok && in->readableBytes() == 0;
+}
+}
+
+int main()
+{
+  const codec::Type types[] = { codec::kNone, codec::kSnappy, codec::kLz4, codec::kZstd };
+  int failed = 0;
+  for(codec::Type type : types)
+  {
+    std::string wire = make_wire(type);
+    muduo::net::Buffer in;
+    muduo::net::Buffer out;
+    std::string scratch;
+    Target target(type, &out);
+    bool ok = true;
+    for(int i = 0; i < kWarmRounds; ++i)
+      ok = decode(wire, &in, &scratch, &target, &out) && ok;
+    int64_t allocs = g_allocs;
+    for(int i = 0; i < kRounds; ++i)
+      ok = decode(wire, &in, &scratch, &target, &out) && ok;
+    allocs = g_allocs - allocs;
+    printf("codec %d: %s, %ld allocations in %d warm rounds\n", static_cast<int>(type), ok ? "ok" : "corrupted",
+           static_cast<long>(allocs), kRounds);
+    if(!ok || allocs > 0)
+      ++failed;
+  }
+  return failed > 0 ? 1 : 0;
+}
+
+void* operator new(size_t size)
+{
+  ++g_allocs;
+  void* p = ::malloc(size);
+  if(!p)
+    throw std::bad_alloc();
+  return p;
+}
+
+void operator delete(void* p) noexcept
+{
+  ::free(p);
+}
\ No newline at end of file
@@ -0,0 +1,633 @@
+#include "accept_client.h"
+#include "dns_stub.h"
+#include "socks_client.h"
+#include "udp_client.h"
+#include "udp_socket.h"
+
+#include <muduo/net/EventLoop.h>
+#include <muduo/net/TcpServer.h>
+#include <muduo/base/Logging.h>
+#include <boost/bind.hpp>
+#include <algorithm>
+#include <fstream>
+#include <getopt.h>
+#include <libgen.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <set>
+#include <string>
+#include <vector>
+
+using namespace zy;
+
+// start socks_server and local_server as subprocesses on loopback, with a local
+// target and a stub dns server, then drive socks clients through both of them
+namespace
+{
+struct Options
+{
+  std::string socks_server;
+  std::string local_server;
+  int connections = 1000; // in total
+  int concurrency = 50;
+  size_t size = 64 * 1024; // bytes sent by the target on every connection
+  double compressible = 0.5; // share of payload that compresses well
+  std::string codec = "snappy";
+  int threads = 0; // io threads of both servers and of the target
+  bool raw_relay = false;
+  int mux_connections = 0;
+  int pool_size = 0;
+  int dns_ttl = 60; // ttl of stub answers, 0 makes every connection a dns query
+  bool unique_hosts = false; // a new host name for every connection, so the dns cache never hits
+  int base_port = 18700; // local_server, socks_server, target and dns stub take four ports from here
+  double timeout = 120; // give up the whole run after this
+  int udp = 0; // datagrams per udp association, udp mode if not 0
+  size_t udp_size = 64;
+  int udp_window = 64; // datagrams in flight per association
+  bool accept = false; // connections straight to socks_server, refused at once
+  int workers = 0; // socks_server processes sharing its port
+  bool reuseport_cpu = false;
+};
+
+void usage(const char* name)
+{
+  fprintf(stderr,
+          "Usage: %s [options]\n"
+          "  --socks_server PATH    default ../server/zy_socks next to bench\n"
+          "  --local_server PATH    default ../client/local_server next to bench\n"
+          "  -n, --connections N    total connections, default 1000\n"
+          "  -c, --concurrency N    connections in flight, default 50\n"
+          "  -s, --size BYTES       payload of every connection, default 65536\n"
+          "  -z, --compressible R   share of compressible payload 0..1, default 0.5\n"
+          "  --codec NAME           none, snappy, lz4, zstd or zstd-N, default snappy\n"
+          "  --threads N            io threads of both servers, default 0\n"
+          "  --raw_relay            relay without frames, codec must be none\n"
+          "  --mux N                multiplexed connections per io thread of local_server\n"
+          "  --pool N               pre-connected tunnel connections per io thread\n"
+          "  --dns_ttl SECONDS      ttl of stub dns answers, default 60\n"
+          "  --unique_hosts         a new host name for every connection\n"
+          "  --port N               first of four loopback ports, default 18700\n"
+          "  --timeout SECONDS      abort after this, default 120\n"
+          "  --udp N                udp associate instead of connect, N datagrams echoed\n"
+          "                         through each of concurrency associations\n"
+          "  --udp_size BYTES       payload of every datagram, default 64\n"
+          "  --udp_window N         datagrams in flight per association, default 64\n"
+          "  --accept               connect straight to socks_server and get refused,\n"
+          "                         for the accept rate\n"
+          "  --workers N            socks_server processes sharing its port, default 0\n"
+          "  --reuseport_cpu        steer connections of workers by cpu\n",
+          name);
+  exit(-1);
+}
+
+void parse_options(int argc, char* argv[], Options* options)
+{
+  static const struct option long_options[] =
+  {
+    { "socks_server", required_argument, NULL, 1 },
+    { "local_server", required_argument, NULL, 2 },
+    { "connections", required_argument, NULL, 'n' },
+    { "concurrency", required_argument, NULL, 'c' },
+    { "size", required_argument, NULL, 's' },
+    { "compressible", required_argument, NULL, 'z' },
+    { "codec", required_argument, NULL, 3 },
+    { "threads", required_argument, NULL, 4 },
+    { "raw_relay", no_argument, NULL, 5 },
+    { "mux", required_argument, NULL, 6 },
+    { "pool", required_argument, NULL, 7 },
+    { "dns_ttl", required_argument, NULL, 8 },
+    { "unique_hosts", no_argument, NULL, 9 },
+    { "port", required_argument, NULL, 10 },
+    { "timeout", required_argument, NULL, 11 },
+    { "udp", required_argument, NULL, 12 },
+    { "udp_size", required_argument, NULL, 13 },
+    { "udp_window", required_argument, NULL, 14 },
+    { "accept", no_argument, NULL, 15 },
+    { "workers", required_argument, NULL, 16 },
+    { "reuseport_cpu", no_argument, NULL, 17 },
+    { NULL, 0, NULL, 0 }
+  };
+  std::string dir = ::dirname(strdupa(argv[0]));
+  options->socks_server = dir + "/../server/zy_socks";
+  options->local_server = dir + "/../client/local_server";
+  int opt;
+  while((opt = ::getopt_long(argc, argv, "n:c:s:z:", long_options, NULL)) != -1)
+  {
+    switch(opt)
+    {
+      case 1: options->socks_server = optarg; break;
+      case 2: options->local_server = optarg; break;
+      case 'n': options->connections = atoi(optarg); break;
+      case 'c': options->concurrency = atoi(optarg); break;
+      case 's': options->size = static_cast<size_t>(atol(optarg)); break;
+      case 'z': options->compressible = atof(optarg); break;
+      case 3: options->codec = optarg; break;
+      case 4: options->threads = atoi(optarg); break;
+      case 5: options->raw_relay = true; break;
+      case 6: options->mux_connections = atoi(optarg); break;
+      case 7: options->pool_size = atoi(optarg); break;
+      case 8: options->dns_ttl = atoi(optarg); break;
+      case 9: options->unique_hosts = true; break;
+      case 10: options->base_port = atoi(optarg); break;
+      case 11: options->timeout = atof(optarg); break;
+      case 12: options->udp = atoi(optarg); break;
+      case 13: options->udp_size = static_cast<size_t>(atol(optarg)); break;
+      case 14: options->udp_window = atoi(optarg); break;
+      case 15: options->accept = true; break;
+      case 16: options->workers = atoi(optarg); break;
+      case 17: options->reuseport_cpu = true; break;
+      default: usage(argv[0]);
+    }
+  }
+  if(options->connections <= 0 || options->concurrency <= 0 || options->size == 0
+     || options->compressible < 0 || options->compressible > 1
+     || options->udp < 0 || options->workers < 0 || options->udp_window <= 0 || options->udp_size > UdpSocket::kMaxDatagram - 32)
+    usage(argv[0]);
+}
+
+// text blocks compress well, random blocks do not compress at all
+std::string make_payload(size_t size, double compressible)
+{
+  const size_t kBlock = 1024;
+  const char kText[] = "GET /index.html HTTP/1.1\r\nHost: bench.zy_socks\r\nAccept: */*\r\n\r\n";
+  std::string payload;
+  payload.reserve(size);
+  for(size_t block = 0; payload.size() < size; ++block)
+  {
+    // spread the compressible blocks evenly
+    bool text = static_cast<size_t>((block + 1) * compressible) > static_cast<size_t>(block * compressible);
+    for(size_t i = 0; i < kBlock && payload.size() < size; ++i)
+      payload.push_back(text ? kText[i % (sizeof(kText) - 1)] : static_cast<char>(::random()));
+  }
+  return payload;
+}
+
+void write_file(const std::string& path, const std::string& content)
+{
+  FILE* fp = ::fopen(path.c_str(), "w");
+  if(!fp || ::fwrite(content.data(), 1, content.size(), fp) != content.size())
+  {
+    LOG_SYSFATAL << "write " << path;
+  }
+  ::fclose(fp);
+}
+
+std::string server_config(const Options& options)
+{
+  char buf[1024];
+  snprintf(buf, sizeof buf,
+           "{\n"
+           "  \"server_port\" : %d,\n"
+           "  \"password\" : \"bench\",\n"
+           "  \"timeout\" : 5,\n"
+           "  \"server_ipv6\" : false,\n"
+           "  \"dns_timeout\" : 3,\n"
+           "  \"dns_min_ttl\" : 0,\n"
+           "  \"dns_servers\" : \"127.0.0.1:%d\",\n"
+           "  \"threads\" : %d,\n"
+           "  \"workers\" : %d,\n"
+           "  \"reuseport_cpu\" : %s\n"
+           "}",
+           options.base_port + 1, options.base_port + 3, options.threads, options.workers,
+           options.reuseport_cpu ? "true" : "false");
+  return buf;
+}
+
+std::string client_config(const Options& options)
+{
+  char buf[1024];
+  snprintf(buf, sizeof buf,
+           "{\n"
+           "  \"server_port\" : %d,\n"
+           "  \"password\" : \"bench\",\n"
+           "  \"timeout\" : 5,\n"
+           "  \"server\" : \"127.0.0.1\",\n"
+           "  \"server_ipv6\" : false,\n"
+           "  \"local_address\" : \"127.0.0.1\",\n"
+           "  \"local_port\" : %d,\n"
+           "  \"threads\" : %d,\n"
+           "  \"mux_connections\" : %d,\n"
+           "  \"pool_min\" : %d,\n"
+           "  \"pool_max\" : %d,\n"
+           "  \"codec\" : \"%s\",\n"
+           "  \"raw_relay\" : %s\n"
+           "}",
+           options.base_port + 1, options.base_port, options.threads, options.mux_connections,
+           options.pool_size, options.pool_size, options.codec.c_str(), options.raw_relay ? "true" : "false");
+  return buf;
+}
+
+pid_t spawn(const std::string& path, const std::string& config)
+{
+  pid_t pid = ::fork();
+  if(pid == 0)
+  {
+    ::execl(path.c_str(), path.c_str(), config.c_str(), "-f", static_cast<char*>(NULL));
+    fprintf(stderr, "exec %s failed: %s\n", path.c_str(), strerror(errno));
+    _exit(127);
+  }
+  if(pid < 0)
+  {
+    LOG_SYSFATAL << "fork";
+  }
+  return pid;
+}
+
+void stop(pid_t pid)
+{
+  ::kill(pid, SIGTERM);
+  ::waitpid(pid, NULL, 0);
+}
+
+// the target sends the payload on every connection and closes
+void onTargetConnection(const std::string* payload, const muduo::net::TcpConnectionPtr& con)
+{
+  if(con->connected())
+  {
+    con->setTcpNoDelay(true);
+    con->send(*payload);
+    con->shutdown();
+  }
+}
+
+// the udp target echoes every datagram back to its sender
+void onEcho(UdpSocket* udp, const UdpSocket::Datagram* datagrams, int count)
+{
+  for(int i = 0; i < count; ++i)
+    udp->send(datagrams[i].peer, datagrams[i].data.data(), datagrams[i].data.size());
+  udp->flush();
+}
+
+// user and sys cpu of a process so far, from /proc/<pid>/stat
+double process_cpu_seconds(pid_t pid)
+{
+  char path[64];
+  snprintf(path, sizeof path, "/proc/%d/stat", pid);
+  std::ifstream file(path);
+  std::string stat((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+  // the command name may hold spaces, fields are counted after its closing paren
+  size_t paren = stat.rfind(')');
+  if(paren == std::string::npos)
+    return 0;
+  unsigned long utime = 0;
+  unsigned long stime = 0;
+  if(sscanf(stat.c_str() + paren + 1, " %*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu", &utime, &stime) != 2)
+    return 0;
+  return static_cast<double>(utime + stime) / static_cast<double>(::sysconf(_SC_CLK_TCK));
+}
+
+// cpu of a server and of its workers, they are children of it
+double cpu_seconds(pid_t pid)
+{
+  double seconds = process_cpu_seconds(pid);
+  char path[64];
+  snprintf(path, sizeof path, "/proc/%d/task/%d/children", pid, pid);
+  std::ifstream children(path);
+  pid_t child;
+  while(children >> child)
+    seconds += process_cpu_seconds(child);
+  return seconds;
+}
+
+double percentile(const std::vector<double>& sorted, double p)
+{
+  if(sorted.empty())
+    return 0;
+  size_t index = static_cast<size_t>(p * static_cast<double>(sorted.size() - 1) + 0.5);
+  return sorted[std::min(index, sorted.size() - 1)];
+}
+
+class Bench : boost::noncopyable
+{
+ public:
+  Bench(muduo::net::EventLoop* loop, const Options& options)
+      : loop_(loop),
+        options_(options),
+        proxy_addr_("127.0.0.1", static_cast<uint16_t>(options.base_port)),
+        started_(0),
+        finished_(0),
+        failed_(0),
+        bytes_(0),
+        first_byte_seconds_(),
+        clients_(),
+        start_(),
+        servers_(),
+        cpu_start_()
+  { }
+
+  // cpu of these is reported per GB relayed
+  void set_servers(pid_t socks_server, pid_t local_server)
+  {
+    servers_[0] = socks_server;
+    servers_[1] = local_server;
+  }
+
+  void start()
+  {
+    start_ = muduo::Timestamp::now();
+    for(int i = 0; i < 2; ++i)
+      cpu_start_[i] = cpu_seconds(servers_[i]);
+    while(started_ < options_.connections && static_cast<int>(clients_.size()) < options_.concurrency)
+      start_client();
+  }
+
+  void report() const
+  {
+    double seconds = muduo::timeDifference(muduo::Timestamp::now(), start_);
+    std::vector<double> sorted(first_byte_seconds_);
+    std::sort(sorted.begin(), sorted.end());
+    printf("connections      %d ok, %d failed in %.3f s\n", finished_ - failed_, failed_, seconds);
+    printf("connections/sec  %.1f\n", (finished_ - failed_) / seconds);
+    printf("first byte ms    p50 %.3f p90 %.3f p99 %.3f max %.3f\n",
+           percentile(sorted, 0.5) * 1000, percentile(sorted, 0.9) * 1000,
+           percentile(sorted, 0.99) * 1000, percentile(sorted, 1) * 1000);
+    printf("throughput MB/s  %.1f\n", static_cast<double>(bytes_) / seconds / (1024 * 1024));
+    // compare raw_relay runs with copy runs here, splice saves cpu more than it adds throughput
+    double gb = static_cast<double>(bytes_) / (1024 * 1024 * 1024);
+    double socks_cpu = cpu_seconds(servers_[0]) - cpu_start_[0];
+    double local_cpu = cpu_seconds(servers_[1]) - cpu_start_[1];
+    if(gb > 0)
+      printf("cpu s/GB         socks_server %.3f local_server %.3f total %.3f\n",
+             socks_cpu / gb, local_cpu / gb, (socks_cpu + local_cpu) / gb);
+  }
+
+  bool done() const { return finished_ == options_.connections; }
+
+ private:
+  void start_client()
+  {
+    char host[64];
+    if(options_.unique_hosts)
+      snprintf(host, sizeof host, "h%d.bench.zy_socks", started_);
+    else
+      snprintf(host, sizeof host, "bench.zy_socks");
+    ++started_;
+    SocksClientPtr client(new SocksClient(loop_, proxy_addr_, host,
+                                          static_cast<uint16_t>(options_.base_port + 2), options_.size));
+    client->setFinishCallback(boost::bind(&Bench::onFinish, this, _1));
+    clients_.insert(client);
+    client->start();
+  }
+
+  void onFinish(const SocksClientPtr& client)
+  {
+    ++finished_;
+    bytes_ += client->received();
+    if(client->ok())
+      first_byte_seconds_.push_back(client->first_byte_seconds());
+    else
+      ++failed_;
+    clients_.erase(client);
+    if(started_ < options_.connections)
+      start_client();
+    else if(done())
+      loop_->quit();
+  }
+
+  muduo::net::EventLoop* loop_;
+  const Options& options_;
+  muduo::net::InetAddress proxy_addr_;
+  int started_;
+  int finished_;
+  int failed_;
+  int64_t bytes_;
+  std::vector<double> first_byte_seconds_;
+  std::set<SocksClientPtr> clients_;
+  muduo::Timestamp start_;
+  pid_t servers_[2]; // socks_server and local_server
+  double cpu_start_[2]; // cpu seconds of servers_ when the clients start
+};
+}
+
+// concurrency udp associations, each echoes its datagrams through the target
+class UdpBench : boost::noncopyable
+{
+ public:
+  UdpBench(muduo::net::EventLoop* loop, const Options& options)
+      : loop_(loop),
+        options_(options),
+        finished_(0),
+        failed_(0),
+        sent_(0),
+        received_(0),
+        clients_(),
+        start_()
+  { }
+
+  void start()
+  {
+    start_ = muduo::Timestamp::now();
+    muduo::net::InetAddress proxy_addr("127.0.0.1", static_cast<uint16_t>(options_.base_port));
+    muduo::net::InetAddress target("127.0.0.1", static_cast<uint16_t>(options_.base_port + 2));
+    for(int i = 0; i < options_.concurrency; ++i)
+    {
+      UdpClientPtr client(new UdpClient(loop_, proxy_addr, target, options_.udp, options_.udp_size, options_.udp_window));
+      client->setFinishCallback(boost::bind(&UdpBench::onFinish, this, _1));
+      clients_.insert(client);
+      client->start();
+    }
+  }
+
+  void report() const
+  {
+    double seconds = muduo::timeDifference(muduo::Timestamp::now(), start_);
+    printf("associations     %d ok, %d failed in %.3f s\n", finished_ - failed_, failed_, seconds);
+    printf("datagrams        %ld sent, %ld echoed, %.2f%% lost\n", sent_, received_,
+           sent_ > 0 ? static_cast<double>(sent_ - received_) * 100 / static_cast<double>(sent_) : 0);
+    // every echo crosses the proxy twice
+    printf("packets/sec      %.1f echoes, %.1f through the proxy\n",
+           static_cast<double>(received_) / seconds, static_cast<double>(received_) * 2 / seconds);
+    printf("throughput MB/s  %.1f\n",
+           static_cast<double>(received_) * static_cast<double>(options_.udp_size) / seconds / (1024 * 1024));
+  }
+
+  bool done() const { return finished_ == options_.concurrency; }
+
+ private:
+  void onFinish(const UdpClientPtr& client)
+  {
+    ++finished_;
+    sent_ += client->sent();
+    received_ += client->received();
+    if(!client->ok())
+      ++failed_;
+    clients_.erase(client);
+    if(done())
+      loop_->quit();
+  }
+
+  muduo::net::EventLoop* loop_;
+  const Options& options_;
+  int finished_;
+  int failed_;
+  int64_t sent_;
+  int64_t received_;
+  std::set<UdpClientPtr> clients_;
+  muduo::Timestamp start_;
+};
+
+// accept rate of socks_server, every connection is refused right after its request
+class AcceptBench : boost::noncopyable
+{
+ public:
+  AcceptBench(muduo::net::EventLoop* loop, const Options& options)
+      : loop_(loop),
+        options_(options),
+        server_addr_("127.0.0.1", static_cast<uint16_t>(options.base_port + 1)),
+        started_(0),
+        finished_(0),
+        failed_(0),
+        seconds_(),
+        clients_(),
+        start_()
+  { }
+
+  void start()
+  {
+    start_ = muduo::Timestamp::now();
+    while(started_ < options_.connections && static_cast<int>(clients_.size()) < options_.concurrency)
+      start_client();
+  }
+
+  void report() const
+  {
+    double seconds = muduo::timeDifference(muduo::Timestamp::now(), start_);
+    std::vector<double> sorted(seconds_);
+    std::sort(sorted.begin(), sorted.end());
+    printf("connections      %d ok, %d failed in %.3f s\n", finished_ - failed_, failed_, seconds);
+    printf("accepts/sec      %.1f\n", (finished_ - failed_) / seconds);
+    printf("refused ms       p50 %.3f p90 %.3f p99 %.3f max %.3f\n",
+           percentile(sorted, 0.5) * 1000, percentile(sorted, 0.9) * 1000,
+           percentile(sorted, 0.99) * 1000, percentile(sorted, 1) * 1000);
+  }
+
+  bool done() const { return finished_ == options_.connections; }
+
+ private:
+  void start_client()
+  {
+    ++started_;
+    AcceptClientPtr client(new AcceptClient(loop_, server_addr_));
+    client->setFinishCallback(boost::bind(&AcceptBench::onFinish, this, _1));
+    clients_.insert(client);
+    client->start();
+  }
+
+  void onFinish(const AcceptClientPtr& client)
+  {
+    ++finished_;
+    if(client->ok())
+      seconds_.push_back(client->seconds());
+    else
+      ++failed_;
+    clients_.erase(client);
+    if(started_ < options_.connections)
+      start_client();
+    else if(done())
+      loop_->quit();
+  }
+
+  muduo::net::EventLoop* loop_;
+  const Options& options_;
+  muduo::net::InetAddress server_addr_;
+  int started_;
+  int finished_;
+  int failed_;
+  std::vector<double> seconds_;
+  std::set<AcceptClientPtr> clients_;
+  muduo::Timestamp start_;
+};
+
+int main(int argc, char* argv[])
+{
+  Options options;
+  parse_options(argc, argv, &options);
+  muduo::Logger::setLogLevel(muduo::Logger::WARN);
+  ::signal(SIGPIPE, SIG_IGN);
+
+  std::string payload = make_payload(options.size, options.compressible);
+  char prefix[64];
+  snprintf(prefix, sizeof prefix, "/tmp/zy_bench_%d", ::getpid());
+  std::string server_path = std::string(prefix) + "_server.json";
+  std::string client_path = std::string(prefix) + "_client.json";
+  write_file(server_path, server_config(options));
+  write_file(client_path, client_config(options));
+
+  muduo::net::EventLoop loop;
+  DnsStub dns(&loop, static_cast<uint16_t>(options.base_port + 3), options.dns_ttl);
+  dns.start();
+  muduo::net::TcpServer target(&loop, muduo::net::InetAddress("127.0.0.1", static_cast<uint16_t>(options.base_port + 2)),
+                               "bench_target");
+  target.setConnectionCallback(boost::bind(&onTargetConnection, &payload, _1));
+  target.setThreadNum(options.threads);
+  target.start();
+  UdpSocket udp_target(&loop, AF_INET);
+  if(!udp_target.bind(muduo::net::InetAddress("127.0.0.1", static_cast<uint16_t>(options.base_port + 2))))
+    return 1;
+  udp_target.setMessageCallback(boost::bind(&onEcho, &udp_target, _1, _2));
+  udp_target.start();
+
+  pid_t socks_server = spawn(options.socks_server, server_path);
+  pid_t local_server = spawn(options.local_server, client_path);
+
+  Bench bench(&loop, options);
+  bench.set_servers(socks_server, local_server);
+  UdpBench udp_bench(&loop, options);
+  AcceptBench accept_bench(&loop, options);
+  // give both servers time to listen
+  if(options.accept)
+    loop.runAfter(0.5, boost::bind(&AcceptBench::start, &accept_bench));
+  else if(options.udp > 0)
+    loop.runAfter(0.5, boost::bind(&UdpBench::start, &udp_bench));
+  else
+    loop.runAfter(0.5, boost::bind(&Bench::start, &bench));
+  loop.runAfter(options.timeout, boost::bind(&muduo::net::EventLoop::quit, &loop));
+  loop.loop();
+
+  if(options.accept)
+  {
+    printf("accept, threads %d, workers %d, reuseport_cpu %d, concurrency %d\n",
+           options.threads, options.workers, options.reuseport_cpu, options.concurrency);
+    accept_bench.report();
+    if(!accept_bench.done())
+      printf("timeout after %.0f s\n", options.timeout);
+    stop(local_server);
+    stop(socks_server);
+    ::unlink(server_path.c_str());
+    ::unlink(client_path.c_str());
+    return accept_bench.done() ? 0 : 1;
+  }
+
+  if(options.udp > 0)
+  {
+    printf("udp, codec %s, threads %d, %d associations, %d datagrams of %zu bytes each, window %d\n",
+           options.codec.c_str(), options.threads, options.concurrency, options.udp, options.udp_size,
+           options.udp_window);
+    udp_bench.report();
+    if(!udp_bench.done())
+      printf("timeout after %.0f s\n", options.timeout);
+    stop(local_server);
+    stop(socks_server);
+    ::unlink(server_path.c_str());
+    ::unlink(client_path.c_str());
+    return udp_bench.done() ? 0 : 1;
+  }
+
+  printf("codec %s, raw_relay %d, threads %d, mux %d, pool %d, payload %zu bytes %.0f%% compressible, "
+         "concurrency %d, %ld dns queries\n",
+         options.codec.c_str(), options.raw_relay, options.threads, options.mux_connections, options.pool_size,
+         options.size, options.compressible * 100, options.concurrency, dns.queries());
+  bench.report();
+  if(!bench.done())
+    printf("timeout after %.0f s\n", options.timeout);
+
+  stop(local_server);
+  stop(socks_server);
+  ::unlink(server_path.c_str());
+  ::unlink(client_path.c_str());
+  return bench.done() ? 0 : 1;
+}
\ No newline at end of file
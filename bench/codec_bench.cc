@@ -0,0 +1,303 @@
+#include "codec.h"
+#include "compressor.h"
+#include "frame.h"
+#include "messages.h"
+
+#include <benchmark/benchmark.h>
+#include <boost/any.hpp>
+#include <muduo/base/Types.h>
+#include <stdlib.h>
+#include <new>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+using namespace zy;
+
+// every stage of the framing path on its own, over payloads of 64B to 64KB,
+// random data never compresses, text data compresses well,
+// ns per frame is the time of an iteration, allocs/frame counts operator new
+namespace
+{
+int64_t g_allocs = 0;
+
+enum Data
+{
+  kRandomData = 0,
+  kTextData = 1
+};
+
+std::string make_data(size_t size, int data)
+{
+  const char kText[] = "GET /index.html HTTP/1.1\r\nHost: bench.zy_socks\r\nAccept: */*\r\n\r\n";
+  std::string payload;
+  payload.reserve(size);
+  for(size_t i = 0; i < size; ++i)
+    payload.push_back(data == kTextData ? kText[i % (sizeof(kText) - 1)] : static_cast<char>(::random()));
+  return payload;
+}
+
+// arguments are payload size and kind of data
+void sizes(benchmark::internal::Benchmark* b)
+{
+  for(int data = kRandomData; data <= kTextData; ++data)
+    for(int64_t size = 64; size <= 64 * 1024; size *= 4)
+      b->Args({ size, data });
+}
+
+// call after the loop, allocs was read before it
+void report(benchmark::State& state, int64_t allocs, size_t bytes)
+{
+  state.counters["allocs/frame"] = benchmark::Counter(static_cast<double>(g_allocs - allocs) / state.iterations());
+  state.SetBytesProcessed(state.iterations() * static_cast<int64_t>(bytes));
+  state.SetItemsProcessed(state.iterations());
+}
+
+void BM_FrameAppend(benchmark::State& state)
+{
+  std::string data = make_data(state.range(0), state.range(1));
+  muduo::net::Buffer buf;
+  int64_t allocs = g_allocs;
+  for(auto _ : state)
+  {
+    frame::append(&buf, frame::kData, data.data(), data.size());
+    buf.retrieveAll();
+  }
+  report(state, allocs, data.size());
+}
+BENCHMARK(BM_FrameAppend)->Apply(sizes);
+
+// what the server does with a read of the target: frame the input buffer in place
+void BM_FramePrependHeader(benchmark::State& state)
+{
+  std::string data = make_data(state.range(0), state.range(1));
+  muduo::net::Buffer buf;
+  int64_t allocs = g_allocs;
+  for(auto _ : state)
+  {
+    buf.append(data.data(), data.size());
+    frame::prepend_header(&buf, frame::kData);
+    benchmark::DoNotOptimize(buf.peek());
+    buf.retrieveAll();
+  }
+  report(state, allocs, data.size());
+}
+BENCHMARK(BM_FramePrependHeader)->Apply(sizes);
+
+void BM_FrameDecode(benchmark::State& state)
+{
+  std::string data = make_data(state.range(0), state.range(1));
+  muduo::net::Buffer buf;
+  frame::append(&buf, frame::kData, data.data(), data.size());
+  std::string scratch;
+  int64_t allocs = g_allocs;
+  for(auto _ : state)
+  {
+    frame::Header header;
+    muduo::StringPiece payload;
+    bool ok = frame::peek(&buf, &header) == frame::kComplete && frame::payload(&buf, header, &scratch, &payload);
+    benchmark::DoNotOptimize(ok);
+    benchmark::DoNotOptimize(payload.data());
+  }
+  report(state, allocs, data.size());
+}
+BENCHMARK(BM_FrameDecode)->Apply(sizes);
+
+void compress(benchmark::State& state, codec::Type type)
+{
+  std::string data = make_data(state.range(0), state.range(1));
+  std::vector<char> dst(codec::max_compressed_length(type, data.size()));
+  size_t compressed = 0;
+  int64_t allocs = g_allocs;
+  for(auto _ : state)
+  {
+    compressed = codec::compress(type, 0, data.data(), data.size(), dst.data());
+    benchmark::DoNotOptimize(compressed);
+  }
+  report(state, allocs, data.size());
+  state.counters["ratio"] = benchmark::Counter(static_cast<double>(compressed) / data.size());
+}
+
+void uncompress(benchmark::State& state, codec::Type type)
+{
+  std::string data = make_data(state.range(0), state.range(1));
+  std::vector<char> compressed(codec::max_compressed_length(type, data.size()));
+  compressed.resize(codec::compress(type, 0, data.data(), data.size(), compressed.data()));
+  std::string scratch;
+  int64_t allocs = g_allocs;
+  for(auto _ : state)
+  {
+    bool ok = codec::uncompress(type, compressed.data(), compressed.size(), &scratch);
+    benchmark::DoNotOptimize(ok);
+  }
+  report(state, allocs, data.size());
+}
+
+void BM_SnappyCompress(benchmark::State& state) { compress(state, codec::kSnappy); }
+BENCHMARK(BM_SnappyCompress)->Apply(sizes);
+
+void BM_SnappyUncompress(benchmark::State& state) { uncompress(state, codec::kSnappy); }
+BENCHMARK(BM_SnappyUncompress)->Apply(sizes);
+
+void BM_Lz4Compress(benchmark::State& state) { compress(state, codec::kLz4); }
+BENCHMARK(BM_Lz4Compress)->Apply(sizes);
+
+void BM_Lz4Uncompress(benchmark::State& state) { uncompress(state, codec::kLz4); }
+BENCHMARK(BM_Lz4Uncompress)->Apply(sizes);
+
+void BM_ZstdCompress(benchmark::State& state) { compress(state, codec::kZstd); }
+BENCHMARK(BM_ZstdCompress)->Apply(sizes);
+
+void BM_ZstdUncompress(benchmark::State& state) { uncompress(state, codec::kZstd); }
+BENCHMARK(BM_ZstdUncompress)->Apply(sizes);
+
+// the whole encode of a tunnel, including turning compression off for random data
+void BM_CompressorAppend(benchmark::State& state)
+{
+  std::string data = make_data(state.range(0), state.range(1));
+  Compressor compressor(codec::kSnappy);
+  muduo::net::Buffer buf;
+  int64_t allocs = g_allocs;
+  for(auto _ : state)
+  {
+    compressor.append(&buf, frame::kData, data.data(), data.size());
+    buf.retrieveAll();
+  }
+  report(state, allocs, data.size());
+  state.counters["ratio"] = benchmark::Counter(static_cast<double>(compressor.wire_bytes()) / compressor.raw_bytes());
+}
+BENCHMARK(BM_CompressorAppend)->Apply(sizes);
+
+void fill_request(msg::ClientMsg* message)
+{
+  message->set_type(msg::ClientMsg_Type_REQUEST);
+  auto request = message->mutable_request();
+  request->set_password("helloworld");
+  request->set_cmd(0x01);
+  request->set_addr("www.example.com");
+  request->set_port(443);
+  request->set_codec(codec::kSnappy);
+}
+
+// the handshake message as it was built before messages.h
+void BM_RequestBuildFresh(benchmark::State& state)
+{
+  int64_t allocs = g_allocs;
+  for(auto _ : state)
+  {
+    msg::ClientMsg message;
+    fill_request(&message);
+    muduo::net::Buffer buf;
+    frame::append_message(&buf, message);
+    benchmark::DoNotOptimize(buf.peek());
+  }
+  report(state, allocs, 0);
+}
+BENCHMARK(BM_RequestBuildFresh);
+
+void BM_RequestBuildReused(benchmark::State& state)
+{
+  int64_t allocs = g_allocs;
+  for(auto _ : state)
+  {
+    msg::ClientMsg& message = messages::client_msg();
+    fill_request(&message);
+    muduo::net::Buffer& buf = messages::output();
+    frame::append_message(&buf, message);
+    benchmark::DoNotOptimize(buf.peek());
+  }
+  report(state, allocs, 0);
+}
+BENCHMARK(BM_RequestBuildReused);
+
+void BM_RequestSerializeAsString(benchmark::State& state)
+{
+  msg::ClientMsg message;
+  fill_request(&message);
+  int64_t allocs = g_allocs;
+  for(auto _ : state)
+  {
+    std::string out = message.SerializeAsString();
+    benchmark::DoNotOptimize(out.data());
+  }
+  report(state, allocs, 0);
+}
+BENCHMARK(BM_RequestSerializeAsString);
+
+void BM_RequestParse(benchmark::State& state)
+{
+  msg::ClientMsg message;
+  fill_request(&message);
+  std::string wire = message.SerializeAsString();
+  int64_t allocs = g_allocs;
+  for(auto _ : state)
+  {
+    msg::ClientMsg& parsed = messages::client_msg();
+    bool ok = parsed.ParseFromArray(wire.data(), static_cast<int>(wire.size()));
+    benchmark::DoNotOptimize(ok);
+  }
+  report(state, allocs, wire.size());
+}
+BENCHMARK(BM_RequestParse);
+
+// dispatch of a read event to the state of its connection, by name as before
+// SessionPool, and through the context as now, argument is connections per loop
+struct Session
+{
+  int64_t read_bytes = 0;
+};
+
+void BM_DispatchByName(benchmark::State& state)
+{
+  std::unordered_map<muduo::string, Session> sessions;
+  std::vector<muduo::string> names;
+  for(int64_t i = 0; i < state.range(0); ++i)
+  {
+    names.push_back("proxy_server-127.0.0.1:8793#" + muduo::string(std::to_string(i).c_str()));
+    sessions[names.back()];
+  }
+  size_t next = 0;
+  int64_t allocs = g_allocs;
+  for(auto _ : state)
+  {
+    ++sessions[names[next]].read_bytes;
+    next = next + 1 == names.size() ? 0 : next + 1;
+  }
+  report(state, allocs, 0);
+}
+BENCHMARK(BM_DispatchByName)->Arg(100)->Arg(10000);
+
+void BM_DispatchByContext(benchmark::State& state)
+{
+  std::vector<Session> sessions(state.range(0));
+  std::vector<boost::any> contexts;
+  for(auto& session : sessions)
+    contexts.push_back(&session);
+  size_t next = 0;
+  int64_t allocs = g_allocs;
+  for(auto _ : state)
+  {
+    Session* const* session = boost::any_cast<Session*>(&contexts[next]);
+    ++(*session)->read_bytes;
+    next = next + 1 == contexts.size() ? 0 : next + 1;
+  }
+  report(state, allocs, 0);
+}
+BENCHMARK(BM_DispatchByContext)->Arg(100)->Arg(10000);
+}
+
+void* operator new(size_t size)
+{
+  ++g_allocs;
+  void* p = ::malloc(size);
+  if(!p)
+    throw std::bad_alloc();
+  return p;
+}
+
+void operator delete(void* p) noexcept
+{
+  ::free(p);
+}
+
+BENCHMARK_MAIN();
\ No newline at end of file
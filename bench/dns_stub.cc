@@ -0,0 +1,127 @@
+#include "dns_stub.h"
+
+#include <muduo/net/Channel.h>
+#include <muduo/net/EventLoop.h>
+#include <muduo/net/Endian.h>
+#include <muduo/base/Logging.h>
+#include <boost/bind.hpp>
+#include <arpa/inet.h>
+#include <errno.h>
+#include <string.h>
+#include <string>
+#include <sys/socket.h>
+#include <unistd.h>
+
+using namespace zy;
+
+namespace
+{
+const size_t kHeaderLength = 12;
+const uint16_t kTypeA = 1;
+
+// length of the question section at the front of data, 0 if malformed
+size_t question_length(const char* data, size_t len)
+{
+  size_t pos = 0;
+  while(pos < len && data[pos] != 0)
+  {
+    // compression pointers never show up in questions of c-ares
+    if(static_cast<uint8_t>(data[pos]) > 63)
+      return 0;
+    pos += static_cast<uint8_t>(data[pos]) + 1;
+  }
+  // root label, qtype and qclass
+  pos += 1 + 4;
+  return pos <= len ? pos : 0;
+}
+
+void append16(std::string* out, uint16_t value)
+{
+  uint16_t be16 = muduo::net::sockets::hostToNetwork16(value);
+  out->append(reinterpret_cast<const char*>(&be16), sizeof(be16));
+}
+
+void append32(std::string* out, uint32_t value)
+{
+  uint32_t be32 = muduo::net::sockets::hostToNetwork32(value);
+  out->append(reinterpret_cast<const char*>(&be32), sizeof(be32));
+}
+}
+
+DnsStub::DnsStub(muduo::net::EventLoop *loop, uint16_t port, int ttl)
+  : loop_(loop),
+    port_(port),
+    ttl_(ttl),
+    fd_(-1),
+    channel_(),
+    queries_(0)
+{
+
+}
+
+DnsStub::~DnsStub()
+{
+  if(channel_)
+  {
+    channel_->disableAll();
+    channel_->remove();
+  }
+  if(fd_ >= 0)
+    ::close(fd_);
+}
+
+void DnsStub::start()
+{
+  fd_ = ::socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  struct sockaddr_in addr;
+  ::memset(&addr, 0, sizeof addr);
+  addr.sin_family = AF_INET;
+  addr.sin_port = muduo::net::sockets::hostToNetwork16(port_);
+  addr.sin_addr.s_addr = muduo::net::sockets::hostToNetwork32(INADDR_LOOPBACK);
+  if(fd_ < 0 || ::bind(fd_, reinterpret_cast<struct sockaddr*>(&addr), sizeof addr) < 0)
+  {
+    LOG_SYSFATAL << "bind dns stub to port " << port_;
+  }
+  channel_.reset(new muduo::net::Channel(loop_, fd_));
+  channel_->setReadCallback(boost::bind(&DnsStub::onRead, this));
+  channel_->enableReading();
+}
+
+void DnsStub::onRead()
+{
+  char query[512];
+  struct sockaddr_in peer;
+  socklen_t peer_len = sizeof peer;
+  ssize_t n;
+  while((n = ::recvfrom(fd_, query, sizeof query, 0, reinterpret_cast<struct sockaddr*>(&peer), &peer_len)) > 0)
+  {
+    size_t qlen = static_cast<size_t>(n) > kHeaderLength ? question_length(query + kHeaderLength, n - kHeaderLength) : 0;
+    if(qlen == 0)
+      continue;
+    ++queries_;
+    uint16_t qtype;
+    ::memcpy(&qtype, query + kHeaderLength + qlen - 4, sizeof(qtype));
+    bool answer = muduo::net::sockets::networkToHost16(qtype) == kTypeA;
+
+    std::string reply(query, 2); // id
+    append16(&reply, 0x8180); // response, recursion desired and available, no error
+    append16(&reply, 1);
+    append16(&reply, answer ? 1 : 0);
+    append16(&reply, 0);
+    append16(&reply, 0);
+    reply.append(query + kHeaderLength, qlen);
+    if(answer)
+    {
+      append16(&reply, 0xc00c); // name of the question
+      append16(&reply, kTypeA);
+      append16(&reply, 1); // IN
+      append32(&reply, static_cast<uint32_t>(ttl_));
+      append16(&reply, 4);
+      append32(&reply, INADDR_LOOPBACK);
+    }
+    ::sendto(fd_, reply.data(), reply.size(), 0, reinterpret_cast<struct sockaddr*>(&peer), peer_len);
+    peer_len = sizeof peer;
+  }
+  if(n < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
+    LOG_SYSERR << "dns stub recvfrom";
+}
\ No newline at end of file
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <boost/noncopyable.hpp>
+#include <memory>
+#include <stdint.h>
+
+namespace muduo
+{
+namespace net
+{
+class Channel;
+class EventLoop;
+}
+}
+
+namespace zy
+{
+// answer every A query with 127.0.0.1 and every other query with no record,
+// so socks_server resolves any host of the bench to the local target
+class DnsStub : boost::noncopyable
+{
+ public:
+  DnsStub(muduo::net::EventLoop* loop, uint16_t port, int ttl);
+
+  ~DnsStub();
+
+  // die if the port can't be bound
+  void start();
+
+  int64_t queries() const { return queries_; }
+
+ private:
+  void onRead();
+
+  muduo::net::EventLoop* loop_;
+  uint16_t port_;
+  int ttl_;
+  int fd_;
+  std::unique_ptr<muduo::net::Channel> channel_;
+  int64_t queries_;
+};
+}
\ No newline at end of file
@@ -0,0 +1,122 @@
+#include "route_table.h"
+
+#include <benchmark/benchmark.h>
+#include <arpa/inet.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+
+using namespace zy;
+
+// lookup cost of RouteTable against the number of rules, argument is rules in the table,
+// domain queries are subdomains of random rules or misses under the same tlds, address
+// queries are random, a query set much larger than the cache keeps the numbers honest
+namespace
+{
+const char* const kTlds[] = { "com", "net", "org", "cn", "io", "co.uk" };
+
+const size_t kQueries = 1 << 16;
+
+std::string make_domain(int64_t i)
+{
+  char name[64];
+  ::snprintf(name, sizeof name, "site%ld-%ld.%s", static_cast<long>(i), ::random() % 1000,
+             kTlds[i % (sizeof(kTlds) / sizeof(kTlds[0]))]);
+  return name;
+}
+
+void domain_rules(benchmark::internal::Benchmark* b)
+{
+  for(int64_t rules = 1000; rules <= 1000 * 1000; rules *= 10)
+    b->Arg(rules);
+}
+
+void BM_MatchDomain(benchmark::State& state, bool hit)
+{
+  ::srandom(1);
+  RouteTable table;
+  std::vector<std::string> domains;
+  for(int64_t i = 0; i < state.range(0); ++i)
+  {
+    domains.push_back(make_domain(i));
+    table.add_domain(domains.back(), RouteTable::kDirect);
+  }
+  table.compile();
+  std::vector<std::string> queries;
+  for(size_t i = 0; i < kQueries; ++i)
+  {
+    const std::string& domain = domains[::random() % domains.size()];
+    queries.push_back(hit ? "www.cdn." + domain : "www.cdn.miss-" + domain);
+  }
+  size_t next = 0;
+  int64_t direct = 0;
+  for(auto _ : state)
+  {
+    direct += table.match_domain(queries[next]);
+    next = (next + 1) & (kQueries - 1);
+  }
+  benchmark::DoNotOptimize(direct);
+  state.SetItemsProcessed(state.iterations());
+}
+
+void BM_MatchDomainHit(benchmark::State& state) { BM_MatchDomain(state, true); }
+BENCHMARK(BM_MatchDomainHit)->Apply(domain_rules);
+
+void BM_MatchDomainMiss(benchmark::State& state) { BM_MatchDomain(state, false); }
+BENCHMARK(BM_MatchDomainMiss)->Apply(domain_rules);
+
+void BM_MatchAddress(benchmark::State& state)
+{
+  ::srandom(1);
+  RouteTable table;
+  char cidr[32];
+  for(int64_t i = 0; i < state.range(0); ++i)
+  {
+    uint32_t addr = static_cast<uint32_t>(::random());
+    ::snprintf(cidr, sizeof cidr, "%u.%u.%u.%u/%ld", addr >> 24, (addr >> 16) & 0xff, (addr >> 8) & 0xff,
+               addr & 0xff, 8 + ::random() % 25);
+    table.add_cidr(cidr, i % 2 ? RouteTable::kDirect : RouteTable::kProxy);
+  }
+  table.compile();
+  std::vector<muduo::net::InetAddress> queries;
+  for(size_t i = 0; i < kQueries; ++i)
+  {
+    struct sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = static_cast<uint32_t>(::random());
+    queries.push_back(muduo::net::InetAddress(addr));
+  }
+  size_t next = 0;
+  int64_t direct = 0;
+  for(auto _ : state)
+  {
+    direct += table.match_address(queries[next]);
+    next = (next + 1) & (kQueries - 1);
+  }
+  benchmark::DoNotOptimize(direct);
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_MatchAddress)->Apply(domain_rules);
+
+// compile time of a whole rule file, what a reload costs the base loop
+void BM_Compile(benchmark::State& state)
+{
+  ::srandom(1);
+  std::vector<std::string> domains;
+  for(int64_t i = 0; i < state.range(0); ++i)
+    domains.push_back(make_domain(i));
+  for(auto _ : state)
+  {
+    RouteTable table;
+    for(const auto& domain : domains)
+      table.add_domain(domain, RouteTable::kDirect);
+    table.compile();
+    benchmark::DoNotOptimize(table.domain_rules());
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_Compile)->Arg(1000)->Arg(100 * 1000)->Unit(benchmark::kMillisecond);
+}
+
+BENCHMARK_MAIN();
\ No newline at end of file
@@ -0,0 +1,107 @@
+#include "socks_client.h"
+
+#include <muduo/net/EventLoop.h>
+#include <muduo/net/Endian.h>
+#include <muduo/base/Logging.h>
+#include <boost/bind.hpp>
+
+using namespace zy;
+
+namespace
+{
+// version, rep, rsv, atyp, ipv4 address and port
+const size_t kReplyLength = 10;
+}
+
+SocksClient::SocksClient(muduo::net::EventLoop *loop,
+                         const muduo::net::InetAddress &proxy_addr,
+                         const std::string &host,
+                         uint16_t port,
+                         size_t expected)
+  : loop_(loop),
+    client_(loop, proxy_addr, "bench_client"),
+    host_(host),
+    port_(port),
+    expected_(expected),
+    state_(kConnecting),
+    received_(0),
+    request_sent_(),
+    first_byte_seconds_(0),
+    finishCallback_()
+{
+  client_.setConnectionCallback(boost::bind(&SocksClient::onConnection, this, _1));
+  client_.setMessageCallback(boost::bind(&SocksClient::onMessage, this, _1, _2, _3));
+}
+
+void SocksClient::start()
+{
+  client_.connect();
+}
+
+void SocksClient::onConnection(const muduo::net::TcpConnectionPtr &con)
+{
+  if(con->connected())
+  {
+    con->setTcpNoDelay(true);
+    const char greeting[] = { 0x05, 0x01, 0x00 };
+    con->send(greeting, sizeof greeting);
+    state_ = kGreeting;
+  }
+  else
+  {
+    finish(kFailed);
+  }
+}
+
+void SocksClient::onMessage(const muduo::net::TcpConnectionPtr &con, muduo::net::Buffer *buf, muduo::Timestamp receiveTime)
+{
+  if(state_ == kGreeting && buf->readableBytes() >= 2)
+  {
+    if(buf->peek()[1] != 0x00)
+    {
+      LOG_ERROR << "socks method rejected";
+      finish(kFailed);
+      return;
+    }
+    buf->retrieve(2);
+    std::string request("\x05\x01\x00\x03", 4);
+    request.push_back(static_cast<char>(host_.size()));
+    request += host_;
+    uint16_t be16 = muduo::net::sockets::hostToNetwork16(port_);
+    request.append(reinterpret_cast<const char*>(&be16), sizeof be16);
+    request_sent_ = muduo::Timestamp::now();
+    con->send(request);
+    state_ = kRequest;
+  }
+  if(state_ == kRequest && buf->readableBytes() >= kReplyLength)
+  {
+    if(buf->peek()[1] != 0x00)
+    {
+      LOG_ERROR << "socks request to " << host_ << " failed with " << static_cast<int>(buf->peek()[1]);
+      finish(kFailed);
+      return;
+    }
+    buf->retrieve(kReplyLength);
+    state_ = kData;
+  }
+  if(state_ == kData && buf->readableBytes() > 0)
+  {
+    if(received_ == 0)
+      first_byte_seconds_ = muduo::timeDifference(receiveTime, request_sent_);
+    received_ += buf->readableBytes();
+    buf->retrieveAll();
+    if(received_ >= expected_)
+      finish(kDone);
+  }
+}
+
+void SocksClient::finish(State state)
+{
+  if(state_ == kDone || state_ == kFailed)
+    return;
+  state_ = state;
+  client_.disconnect();
+  // the TcpClient must not be destroyed inside its own callback
+  if(finishCallback_)
+    loop_->queueInLoop(boost::bind(finishCallback_, shared_from_this()));
+}
\ No newline at end of file
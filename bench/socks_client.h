@@ -0,0 +1,69 @@
+#pragma once
+
+#include <muduo/net/TcpClient.h>
+#include <boost/enable_shared_from_this.hpp>
+#include <boost/function.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+#include <string>
+
+namespace zy
+{
+// one bench connection, CONNECT to host through local_server, then read
+// expected bytes sent by the target and close
+class SocksClient : boost::noncopyable,
+                    public boost::enable_shared_from_this<SocksClient>
+{
+ public:
+  typedef boost::shared_ptr<SocksClient> SocksClientPtr;
+  // called once, in loop, the client may be destroyed after it returns
+  typedef boost::function<void(const SocksClientPtr&)> FinishCallback;
+
+  SocksClient(muduo::net::EventLoop* loop,
+              const muduo::net::InetAddress& proxy_addr,
+              const std::string& host,
+              uint16_t port,
+              size_t expected);
+
+  void setFinishCallback(const FinishCallback& cb) { finishCallback_ = cb; }
+
+  void start();
+
+  bool ok() const { return state_ == kDone; }
+
+  size_t received() const { return received_; }
+
+  // from socks request sent to the first byte of the target, in seconds
+  double first_byte_seconds() const { return first_byte_seconds_; }
+
+ private:
+  enum State
+  {
+    kConnecting,
+    kGreeting,
+    kRequest,
+    kData,
+    kDone,
+    kFailed
+  };
+
+  void onConnection(const muduo::net::TcpConnectionPtr& con);
+
+  void onMessage(const muduo::net::TcpConnectionPtr& con, muduo::net::Buffer* buf, muduo::Timestamp receiveTime);
+
+  void finish(State state);
+
+  muduo::net::EventLoop* loop_;
+  muduo::net::TcpClient client_;
+  std::string host_;
+  uint16_t port_;
+  size_t expected_;
+  State state_;
+  size_t received_;
+  muduo::Timestamp request_sent_;
+  double first_byte_seconds_;
+  FinishCallback finishCallback_;
+};
+
+typedef SocksClient::SocksClientPtr SocksClientPtr;
+}
\ No newline at end of file
@@ -0,0 +1,165 @@
+#include "udp_client.h"
+#include "socks_address.h"
+
+#include <muduo/net/EventLoop.h>
+#include <muduo/base/Logging.h>
+#include <boost/bind.hpp>
+#include <algorithm>
+#include <string.h>
+
+using namespace zy;
+
+namespace
+{
+// version, rep, rsv, atyp, ipv4 address and port
+const size_t kReplyLength = 10;
+// a datagram without echo for this long is lost
+const double kTick = 0.2;
+}
+
+UdpClient::UdpClient(muduo::net::EventLoop *loop,
+                     const muduo::net::InetAddress &proxy_addr,
+                     const muduo::net::InetAddress &target,
+                     int count,
+                     size_t size,
+                     int window)
+  : loop_(loop),
+    client_(loop, proxy_addr, "bench_udp_client"),
+    target_(target),
+    count_(count),
+    window_(window),
+    datagram_(3, '\0'),
+    udp_(loop, AF_INET),
+    relay_(),
+    state_(kConnecting),
+    sent_(0),
+    received_(0),
+    in_flight_(0),
+    received_at_tick_(0),
+    tick_(),
+    finishCallback_()
+{
+  char addr[socks::kMaxIpAddressLength];
+  datagram_.append(addr, socks::encode(target_, addr));
+  datagram_.append(size, 'u');
+  client_.setConnectionCallback(boost::bind(&UdpClient::onConnection, this, _1));
+  client_.setMessageCallback(boost::bind(&UdpClient::onMessage, this, _1, _2, _3));
+  udp_.setMessageCallback(boost::bind(&UdpClient::onEcho, this, _1, _2));
+}
+
+UdpClient::~UdpClient()
+{
+  loop_->cancel(tick_);
+}
+
+void UdpClient::start()
+{
+  if(!udp_.bind(muduo::net::InetAddress("127.0.0.1", 0)))
+  {
+    finish(kFailed);
+    return;
+  }
+  udp_.start();
+  client_.connect();
+}
+
+void UdpClient::onConnection(const muduo::net::TcpConnectionPtr &con)
+{
+  if(con->connected())
+  {
+    const char greeting[] = { 0x05, 0x01, 0x00 };
+    con->send(greeting, sizeof greeting);
+    state_ = kGreeting;
+  }
+  else
+  {
+    finish(state_ == kData && sent_ == count_ ? kDone : kFailed);
+  }
+}
+
+void UdpClient::onMessage(const muduo::net::TcpConnectionPtr &con, muduo::net::Buffer *buf, muduo::Timestamp)
+{
+  if(state_ == kGreeting && buf->readableBytes() >= 2)
+  {
+    if(buf->peek()[1] != 0x00)
+    {
+      LOG_ERROR << "socks method rejected";
+      finish(kFailed);
+      return;
+    }
+    buf->retrieve(2);
+    // udp associate, from any address
+    const char request[] = { 0x05, 0x03, 0x00, 0x01, 0, 0, 0, 0, 0, 0 };
+    con->send(request, sizeof request);
+    state_ = kRequest;
+  }
+  if(state_ == kRequest && buf->readableBytes() >= kReplyLength)
+  {
+    if(buf->peek()[1] != 0x00)
+    {
+      LOG_ERROR << "udp associate failed with " << static_cast<int>(buf->peek()[1]);
+      finish(kFailed);
+      return;
+    }
+    struct sockaddr_in addr;
+    ::memset(&addr, 0, sizeof addr);
+    addr.sin_family = AF_INET;
+    ::memcpy(&addr.sin_addr, buf->peek() + 4, 4);
+    ::memcpy(&addr.sin_port, buf->peek() + 8, 2);
+    relay_ = muduo::net::InetAddress(addr);
+    buf->retrieve(kReplyLength);
+    state_ = kData;
+    tick_ = loop_->runEvery(kTick, boost::bind(&UdpClient::onTick, this));
+    send_more();
+  }
+  buf->retrieveAll();
+}
+
+void UdpClient::onEcho(const UdpSocket::Datagram *datagrams, int count)
+{
+  received_ += count;
+  in_flight_ = std::max(in_flight_ - count, 0);
+  if(received_ >= count_)
+    finish(kDone);
+  else
+    send_more();
+}
+
+void UdpClient::send_more()
+{
+  while(state_ == kData && sent_ < count_ && in_flight_ < window_)
+  {
+    udp_.send(relay_, datagram_.data(), datagram_.size());
+    ++sent_;
+    ++in_flight_;
+  }
+  udp_.flush();
+}
+
+void UdpClient::onTick()
+{
+  if(received_ == received_at_tick_)
+  {
+    // nothing came back for a whole tick, what is in flight is lost
+    in_flight_ = 0;
+    if(sent_ == count_)
+    {
+      finish(kDone);
+      return;
+    }
+    send_more();
+  }
+  received_at_tick_ = received_;
+}
+
+void UdpClient::finish(State state)
+{
+  if(state_ == kDone || state_ == kFailed)
+    return;
+  state_ = state;
+  loop_->cancel(tick_);
+  client_.disconnect();
+  // the TcpClient must not be destroyed inside its own callback
+  if(finishCallback_)
+    loop_->queueInLoop(boost::bind(finishCallback_, shared_from_this()));
+}
\ No newline at end of file
@@ -0,0 +1,87 @@
+#pragma once
+
+#include "udp_socket.h"
+
+#include <muduo/net/TcpClient.h>
+#include <muduo/net/TimerId.h>
+#include <boost/enable_shared_from_this.hpp>
+#include <boost/function.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+#include <string>
+
+namespace zy
+{
+// one bench udp association through local_server, sends count datagrams to an echo
+// target with window of them in flight, and counts the echoes
+class UdpClient : boost::noncopyable,
+                  public boost::enable_shared_from_this<UdpClient>
+{
+ public:
+  typedef boost::shared_ptr<UdpClient> UdpClientPtr;
+  // called once, in loop, the client may be destroyed after it returns
+  typedef boost::function<void(const UdpClientPtr&)> FinishCallback;
+
+  UdpClient(muduo::net::EventLoop* loop,
+            const muduo::net::InetAddress& proxy_addr,
+            const muduo::net::InetAddress& target,
+            int count,
+            size_t size,
+            int window);
+
+  ~UdpClient();
+
+  void setFinishCallback(const FinishCallback& cb) { finishCallback_ = cb; }
+
+  void start();
+
+  bool ok() const { return state_ == kDone; }
+
+  int sent() const { return sent_; }
+
+  int received() const { return received_; }
+
+ private:
+  enum State
+  {
+    kConnecting,
+    kGreeting,
+    kRequest,
+    kData,
+    kDone,
+    kFailed
+  };
+
+  void onConnection(const muduo::net::TcpConnectionPtr& con);
+
+  void onMessage(const muduo::net::TcpConnectionPtr& con, muduo::net::Buffer* buf, muduo::Timestamp receiveTime);
+
+  void onEcho(const UdpSocket::Datagram* datagrams, int count);
+
+  // keep window datagrams in flight
+  void send_more();
+
+  // datagrams which did not come back by now are lost
+  void onTick();
+
+  void finish(State state);
+
+  muduo::net::EventLoop* loop_;
+  muduo::net::TcpClient client_;
+  muduo::net::InetAddress target_;
+  int count_;
+  int window_;
+  std::string datagram_; // socks5 udp header to the target, then the payload
+  UdpSocket udp_;
+  muduo::net::InetAddress relay_; // udp socket of local_server
+  State state_;
+  int sent_;
+  int received_;
+  int in_flight_;
+  int received_at_tick_;
+  muduo::net::TimerId tick_;
+  FinishCallback finishCallback_;
+};
+
+typedef UdpClient::UdpClientPtr UdpClientPtr;
+}
\ No newline at end of file
@@ -1,27 +1,30 @@
 #include "local_server.h"
+#include "async_log.h"
 #include "config_json.h"
+#include "codec.h"
+#include "stats_server.h"
 
 #include <muduo/net/EventLoop.h>
-#include <muduo/base/LogFile.h>
 #include <muduo/base/Logging.h>
 
 using namespace zy;
 
-std::unique_ptr<muduo::LogFile> g_logFile;
+std::unique_ptr<AsyncLog> g_asyncLog;
 
 void outputFunc(const char* msg, int len)
 {
-  g_logFile->append(msg, len);
+  g_asyncLog->append(msg, len);
 }
 
 void flushFunc()
 {
-  g_logFile->flush();
+  g_asyncLog->flush();
 }
 
 void init_log()
 {
-  g_logFile.reset(new muduo::LogFile("/tmp/local_server", 500 * 1024, false, 3, 100));
+  g_asyncLog.reset(new AsyncLog("/tmp/local_server", 500 * 1024));
+  g_asyncLog->start();
   muduo::Logger::setOutput(outputFunc);
   muduo::Logger::setLogLevel(muduo::Logger::INFO);
   muduo::Logger::setFlush(flushFunc);
@@ -29,9 +32,11 @@ void init_log()
 
 int main(int argc, char* argv[])
 {
-  if(argc != 2)
+  // -f keeps the process in foreground, for bench
+  bool foreground = argc == 3 && ::strcmp(argv[2], "-f") == 0;
+  if(argc != 2 && !foreground)
   {
-    fprintf(stderr, "Usage: %s config_path", ::basename(argv[0]));
+    fprintf(stderr, "Usage: %s config_path [-f]", ::basename(argv[0]));
     exit(-1);
   }
 
@@ -48,8 +53,22 @@ int main(int argc, char* argv[])
 
   double timeout = config.timeout();
   std::string passwd = config.password();
+  int threads = config.threads();
+  int mux_connections = config.mux_connections();
+  int pool_min = config.pool_min();
+  int pool_max = config.pool_max();
+  double pool_idle_timeout = config.pool_idle_timeout();
+  int stats_port = config.stats_port();
+  std::string stats_address = config.stats_address();
+  codec::Type codec_type;
+  int codec_level;
+  if(!codec::parse(config.codec(), &codec_type, &codec_level))
+  {
+    fprintf(stderr, "unknown codec %s\n", config.codec().c_str());
+    exit(-1);
+  }
 
-  if(daemon(0, 0) == -1)
+  if(!foreground && daemon(0, 0) == -1)
   {
     fprintf(stderr, "create daemon process error!");
     exit(-1);
@@ -62,8 +81,26 @@ int main(int argc, char* argv[])
 
   local_server server(&loop, local_addr, server_addr, passwd);
   server.set_timeout(timeout);
+  server.set_thread_num(threads);
+  server.set_idle_timeout(config.idle_timeout());
+  server.set_buffer_budget(static_cast<size_t>(config.buffer_budget_mb()) * 1024 * 1024);
+  server.set_mux_connections(mux_connections);
+  server.set_pool_size(pool_min, pool_max);
+  server.set_pool_idle_timeout(pool_idle_timeout);
+  server.set_codec(codec_type, codec_level);
+  server.set_raw_relay(config.raw_relay());
+  server.set_optimistic(config.optimistic());
+  server.set_fast_open(config.fast_open());
+  server.set_route_file(config.route_file(), config.route_reload_interval());
 
   server.start();
 
+  std::unique_ptr<StatsServer> stats_server;
+  if(stats_port > 0)
+  {
+    stats_server.reset(new StatsServer(&loop, muduo::net::InetAddress(stats_address.c_str(), static_cast<uint16_t>(stats_port)), "local_server_"));
+    stats_server->start();
+  }
+
   loop.loop();
 }
\ No newline at end of file
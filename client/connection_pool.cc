@@ -0,0 +1,149 @@
+#include "connection_pool.h"
+#include "log_rate.h"
+
+#include <muduo/net/EventLoop.h>
+#include <boost/bind.hpp>
+#include <muduo/base/Logging.h>
+
+using namespace zy;
+
+ConnectionPool::ConnectionPool(muduo::net::EventLoop *loop,
+                               const muduo::net::InetAddress &remote_addr,
+                               int min_size,
+                               int max_size)
+  : loop_(loop),
+    remote_addr_(remote_addr),
+    min_size_(min_size),
+    max_size_(max_size),
+    target_size_(min_size),
+    idle_timeout_(30), // server side or nat may drop silent connections
+    connect_timeout_(6),
+    idle_(),
+    connecting_(),
+    hits_(0),
+    misses_(0),
+    ticks_(0)
+{
+
+}
+
+void ConnectionPool::start()
+{
+  if(max_size_ <= 0)
+    return;
+  loop_->runEvery(1.0, boost::bind(&ConnectionPool::onTick, this));
+  refill();
+}
+
+HappyEyeballsPtr ConnectionPool::take()
+{
+  while(!idle_.empty())
+  {
+    // the newest one is the least likely to be dropped by peer
+    auto client = idle_.back().client;
+    idle_.pop_back();
+    auto con = client->connection();
+    if(con && con->connected())
+    {
+      ++hits_;
+      refill();
+      return client;
+    }
+  }
+  ++misses_;
+  if(target_size_ < max_size_)
+    ++target_size_;
+  refill();
+  return new_client();
+}
+
+void ConnectionPool::onConnection(const TcpConnectionPtr &con)
+{
+  if(con->connected())
+  {
+    for(auto it = connecting_.begin(); it != connecting_.end(); ++it)
+    {
+      if(it->client->connection() == con)
+      {
+        con->setTcpNoDelay(true);
+        idle_.push_back(Entry{it->client, muduo::Timestamp::now()});
+        connecting_.erase(it);
+        return;
+      }
+    }
+    con->shutdown();
+  }
+  else
+  {
+    for(auto it = idle_.begin(); it != idle_.end(); ++it)
+    {
+      if(it->client->connection() == con)
+      {
+        LOG_DEBUG << "idle connection " << con->name() << " closed by server";
+        loop_->queueInLoop(boost::bind(&ConnectionPool::destroy_client, it->client));
+        idle_.erase(it);
+        break;
+      }
+    }
+  }
+}
+
+void ConnectionPool::onMessage(const TcpConnectionPtr &con, muduo::net::Buffer *buf, muduo::Timestamp receiveTime)
+{
+  LOG_ERROR << "unexpected data on idle connection " << con->name();
+  buf->retrieveAll();
+}
+
+void ConnectionPool::onConnectFailed(HappyEyeballs *client)
+{
+  for(auto it = connecting_.begin(); it != connecting_.end(); ++it)
+  {
+    if(it->client.get() == client)
+    {
+      LOG_WARN_LIMITED(10) << "pool connect to " << remote_addr_.toIpPort() << " failed";
+      loop_->queueInLoop(boost::bind(&ConnectionPool::destroy_client, it->client));
+      connecting_.erase(it);
+      return;
+    }
+  }
+}
+
+void ConnectionPool::onTick()
+{
+  auto now = muduo::Timestamp::now();
+  while(!idle_.empty() && muduo::timeDifference(now, idle_.front().since) > idle_timeout_)
+  {
+    idle_.pop_front();
+    if(target_size_ > min_size_)
+      --target_size_;
+  }
+  while(!connecting_.empty() && muduo::timeDifference(now, connecting_.front().since) > connect_timeout_)
+  {
+    LOG_WARN_LIMITED(10) << "pool connect to " << remote_addr_.toIpPort() << " timeout";
+    connecting_.front().client->stop();
+    connecting_.pop_front();
+  }
+  refill();
+  if(++ticks_ % 60 == 0)
+  {
+    LOG_INFO << "connection pool hits " << hits_ << " misses " << misses_ << " idle " << idle_.size();
+  }
+}
+
+void ConnectionPool::refill()
+{
+  while(static_cast<int>(idle_.size() + connecting_.size()) < target_size_)
+  {
+    auto client = new_client();
+    client->setConnectionCallback(boost::bind(&ConnectionPool::onConnection, this, _1));
+    client->setMessageCallback(boost::bind(&ConnectionPool::onMessage, this, _1, _2, _3));
+    client->setFailCallback(boost::bind(&ConnectionPool::onConnectFailed, this, client.get()));
+    connecting_.push_back(Entry{client, muduo::Timestamp::now()});
+    client->connect();
+  }
+}
+
+HappyEyeballsPtr ConnectionPool::new_client()
+{
+  return HappyEyeballsPtr(new HappyEyeballs(loop_, HappyEyeballs::AddressList(1, remote_addr_), "tunnel_client"));
+}
\ No newline at end of file
@@ -0,0 +1,73 @@
+#pragma once
+
+#include "happy_eyeballs.h"
+
+#include <boost/noncopyable.hpp>
+#include <deque>
+#include <muduo/net/TcpConnection.h>
+
+namespace zy
+{
+// keep established connections to socks_server, so a socks session does not
+// wait for the tcp handshake, the pool lives in one loop and is not thread safe
+class ConnectionPool : boost::noncopyable
+{
+ public:
+  typedef muduo::net::TcpConnectionPtr TcpConnectionPtr;
+
+  ConnectionPool(muduo::net::EventLoop* loop, const muduo::net::InetAddress& remote_addr,
+                 int min_size, int max_size);
+
+  // start to warm up, must be called in loop
+  void start();
+
+  // an established client if there is an idle one, else a new client which is not connected yet
+  HappyEyeballsPtr take();
+
+  void set_idle_timeout(double timeout) { idle_timeout_ = timeout; }
+
+  void set_connect_timeout(double timeout) { connect_timeout_ = timeout; }
+
+  int64_t hits() const { return hits_; }
+
+  int64_t misses() const { return misses_; }
+
+  size_t idle() const { return idle_.size(); }
+
+ private:
+  struct Entry
+  {
+    HappyEyeballsPtr client;
+    muduo::Timestamp since; // connected or start to connect
+  };
+
+  void onConnection(const TcpConnectionPtr& con);
+
+  void onMessage(const TcpConnectionPtr& con, muduo::net::Buffer* buf, muduo::Timestamp receiveTime);
+
+  void onConnectFailed(HappyEyeballs* client);
+
+  // age out idle connections and connect again
+  void onTick();
+
+  void refill();
+
+  HappyEyeballsPtr new_client();
+
+  // HappyEyeballs must not be destroyed inside its own callbacks
+  static void destroy_client(const HappyEyeballsPtr&) { }
+
+  muduo::net::EventLoop* loop_;
+  muduo::net::InetAddress remote_addr_;
+  int min_size_;
+  int max_size_;
+  int target_size_; // grows on miss, shrinks on age out, in [min_size_, max_size_]
+  double idle_timeout_;
+  double connect_timeout_;
+  std::deque<Entry> idle_;
+  std::deque<Entry> connecting_;
+  int64_t hits_;
+  int64_t misses_;
+  int64_t ticks_;
+};
+}
\ No newline at end of file
@@ -0,0 +1,125 @@
+#include "direct_tunnel.h"
+#include "log_rate.h"
+#include "packet.h"
+#include "stats.h"
+
+#include <boost/bind.hpp>
+#include <muduo/base/Logging.h>
+
+using namespace zy;
+
+DirectTunnel::DirectTunnel(muduo::net::EventLoop *loop,
+                           const HappyEyeballs::AddressList &addresses,
+                           const std::string &domain_name,
+                           const DirectTunnel::TcpConnectionPtr &con)
+  : Relay(domain_name, con),
+    client_(new HappyEyeballs(loop, addresses, "direct_client")),
+    teardown_(false),
+    onTransportCallback_(),
+    start_(),
+    first_byte_(false)
+{
+
+}
+
+void DirectTunnel::setup()
+{
+  start_ = muduo::Timestamp::now();
+  client_->setConnectionCallback(boost::bind(&DirectTunnel::onConnection, this, _1));
+  client_->setMessageCallback(boost::bind(&DirectTunnel::onMessage, this, _1, _2, _3));
+  client_->setFailCallback(boost::bind(&Relay::onConnectFailedWeak, wkRelay(shared_from_this())));
+  setup_relay();
+  stats::add(stats::kDirectConnects);
+}
+
+void DirectTunnel::connect()
+{
+  client_->connect();
+}
+
+void DirectTunnel::onConnection(const DirectTunnel::TcpConnectionPtr &con)
+{
+  LOG_DEBUG << con->peerAddress().toIpPort() << (con->connected() ? " up " : " down ");
+  if(con->connected())
+  {
+    LOG_INFO_LIMITED(10) << "direct connection to " << name_ << " " << con->peerAddress().toIpPort();
+    stats::observe(stats::kConnectSeconds, muduo::timeDifference(muduo::Timestamp::now(), start_));
+    con->setTcpNoDelay(true);
+    set_client(con);
+    // the bound address is the local end of the connection to the target
+    const muduo::net::InetAddress& local = con->localAddress();
+    if(local.family() == AF_INET)
+    {
+      send_success(serverCon_, local.ipNetEndian(), std::string(), local.portNetEndian());
+    }
+    else
+    {
+      const struct sockaddr_in6* sin6 = reinterpret_cast<const struct sockaddr_in6*>(local.getSockAddr());
+      send_success(serverCon_, 0, std::string(reinterpret_cast<const char*>(&sin6->sin6_addr), 16),
+                   local.portNetEndian());
+    }
+    start_transport();
+    if(onTransportCallback_)
+      onTransportCallback_();
+  }
+  else
+  {
+    teardown();
+  }
+}
+
+void DirectTunnel::onMessage(const DirectTunnel::TcpConnectionPtr &con, muduo::net::Buffer *buf, muduo::Timestamp)
+{
+  LOG_DEBUG << name_ << " transport " << buf->readableBytes() << " bytes directly";
+  stats::add(stats::kBytesOut, buf->readableBytes());
+  touch();
+  if(!first_byte_)
+  {
+    first_byte_ = true;
+    stats::observe(stats::kFirstByteSeconds, muduo::timeDifference(muduo::Timestamp::now(), start_));
+  }
+  serverCon_->send(buf);
+}
+
+void DirectTunnel::send_response_and_teardown(uint8_t rep)
+{
+  struct response data;
+  data.rep = rep;
+  if(serverCon_ && serverCon_->connected())
+  {
+    serverCon_->send(&data, sizeof(data));
+  }
+  teardown();
+}
+
+void DirectTunnel::teardown()
+{
+  if(!teardown_)
+  {
+    teardown_ = true;
+    client_->setConnectionCallback(muduo::net::defaultConnectionCallback);
+    client_->setMessageCallback(muduo::net::defaultMessageCallback);
+    client_->setFailCallback(HappyEyeballs::FailCallback());
+    if(serverCon_)
+    {
+      serverCon_->shutdown();
+    }
+    stop_relay();
+  }
+}
+
+void DirectTunnel::onTimeout()
+{
+  LOG_WARN_LIMITED(10) << "direct connection to " << name_ << " timeout";
+  stats::add(stats::kConnectTimeouts);
+  client_->stop();
+  send_response_and_teardown(0x04);
+}
+
+void DirectTunnel::onConnectFailed()
+{
+  TimingWheel::cancel(timeout_entry_);
+  timeout_entry_.reset();
+  LOG_WARN_LIMITED(10) << "direct connection to " << name_ << " failed";
+  send_response_and_teardown(0x05);
+}
\ No newline at end of file
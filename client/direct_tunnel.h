@@ -0,0 +1,47 @@
+#pragma once
+
+#include "happy_eyeballs.h"
+#include "relay.h"
+
+namespace zy
+{
+// connection of a socks client straight to its target, for the destinations a RouteTable
+// sends around socks_server, bytes are relayed as they are, without frames or codec
+class DirectTunnel : public Relay
+{
+ public:
+  typedef boost::function<void()> onTransportCallback;
+
+  // race connects to addresses, see HappyEyeballs
+  DirectTunnel(muduo::net::EventLoop* loop, const HappyEyeballs::AddressList& addresses,
+               const std::string& domain_name, const TcpConnectionPtr& con);
+
+  void setWinnerCallback(const HappyEyeballs::WinnerCallback& cb) { client_->setWinnerCallback(cb); }
+
+  void onConnection(const TcpConnectionPtr& con);
+
+  void onMessage(const TcpConnectionPtr& con, muduo::net::Buffer* buf, muduo::Timestamp receiveTime);
+
+  void set_onTransportCallback(const onTransportCallback& cb) { onTransportCallback_ = cb; }
+
+  void setup();
+
+  void connect();
+
+  void teardown();
+
+ private:
+  void onTimeout() override;
+
+  void onConnectFailed() override;
+
+  void send_response_and_teardown(uint8_t rep);
+
+  HappyEyeballsPtr client_;
+  bool teardown_;
+  onTransportCallback onTransportCallback_;
+  muduo::Timestamp start_; // setup, for connect and first byte latency
+  bool first_byte_;
+};
+typedef std::shared_ptr<DirectTunnel> DirectTunnelPtr;
+}
\ No newline at end of file
@@ -1,10 +1,15 @@
 #include "local_server.h"
 
+#include "log_rate.h"
 #include "packet.h"
+#include "frame.h"
+#include "messages.h"
+#include "socks_address.h"
 #include <muduo/net/EventLoop.h>
 #include <muduo/base/Logging.h>
 #include <boost/bind.hpp>
-#include <snappy.h>
+#include <algorithm>
+#include <sys/stat.h>
 
 using namespace zy;
 
@@ -16,25 +21,160 @@ local_server::local_server(muduo::net::EventLoop *loop,
     server_(loop_, local_addr, "local_server"),
     remote_addr_(remote_addr),
     passwd_(passwd),
-    tunnels_(),
-    timeout_(6) // default timeout set to 6 seconds
+    mutex_(),
+    loop_states_(),
+    timeout_(6), // default timeout set to 6 seconds
+    idle_timeout_(0),
+    mux_connections_(0),
+    pool_min_(0),
+    pool_max_(0),
+    pool_idle_timeout_(30),
+    codec_(codec::kSnappy),
+    codec_level_(0),
+    raw_relay_(false),
+    optimistic_(false),
+    fast_open_(false),
+    threads_(0),
+    buffer_budget_(1024 * 1024 * 1024),
+    route_file_(),
+    route_reload_interval_(5),
+    route_mtime_(0),
+    routes_()
 {
   server_.setConnectionCallback(boost::bind(&local_server::onConnection, this, _1));
   server_.setMessageCallback(boost::bind(&local_server::onMessage, this, _1, _2, _3));
+  server_.setThreadInitCallback(boost::bind(&local_server::onThreadInit, this, _1));
+}
+
+void local_server::onThreadInit(muduo::net::EventLoop *loop)
+{
+  std::unique_ptr<LoopState> state(new LoopState(loop, buffer_budget_ / std::max(threads_, 1)));
+  state->resolver.setResolveCallback(boost::bind(&local_server::onResolve, this, _1, _2, _3));
+  state->resolver.setErrorCallback(boost::bind(&local_server::onResolveError, this, _1, _2));
+  state->routes = routes_;
+  for(int i = 0; i < mux_connections_; ++i)
+  {
+    MuxClientPtr mux(new MuxClient(loop, remote_addr_, passwd_));
+    mux->set_codec(codec_, codec_level_);
+    mux->set_wheel(&state->wheel);
+    mux->connect();
+    state->muxes.push_back(mux);
+  }
+  state->pool.reset(new ConnectionPool(loop, remote_addr_, pool_min_, pool_max_));
+  state->pool->set_idle_timeout(pool_idle_timeout_);
+  state->pool->set_connect_timeout(timeout_);
+  state->pool->start();
+  muduo::MutexLockGuard lock(mutex_);
+  loop_states_[loop] = std::move(state);
+}
+
+void local_server::start()
+{
+  // the first table is in place before the io loops copy it
+  if(!route_file_.empty())
+  {
+    load_routes();
+    if(route_reload_interval_ > 0)
+      loop_->runEvery(route_reload_interval_, boost::bind(&local_server::load_routes, this));
+  }
+  server_.start();
+}
+
+void local_server::load_routes()
+{
+  struct stat st;
+  if(::stat(route_file_.c_str(), &st) != 0)
+  {
+    LOG_ERROR << "can't stat route file " << route_file_;
+    return;
+  }
+  int64_t mtime = static_cast<int64_t>(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+  if(mtime == route_mtime_)
+    return;
+  route_mtime_ = mtime;
+  // compiled here in the base loop, the io loops only swap a pointer
+  std::shared_ptr<RouteTable> routes(new RouteTable);
+  std::string error;
+  if(!routes->load(route_file_, &error))
+  {
+    // keep the rules in use until the file is fixed
+    LOG_ERROR << "load route file error " << error;
+    return;
+  }
+  LOG_INFO << "loaded " << routes->domain_rules() << " domain and " << routes->cidr_rules()
+           << " cidr rules from " << route_file_;
+  if(routes_)
+    stats::add(stats::kRouteReloads);
+  routes_ = routes;
+  for(auto& item : loop_states_)
+    item.first->runInLoop(boost::bind(&local_server::set_routes, item.second.get(), routes_));
+}
+
+// loop_states_ is never modified after start(), so lookups need no lock
+local_server::LoopState& local_server::loop_state(muduo::net::EventLoop *loop)
+{
+  auto it = loop_states_.find(loop);
+  if(it == loop_states_.end())
+  {
+    LOG_FATAL << "can't find state of event loop " << loop;
+  }
+  return *it->second;
+}
+
+MuxClientPtr local_server::pick_mux(LoopState &state)
+{
+  MuxClientPtr mux;
+  for(auto& item : state.muxes)
+  {
+    if(!mux || item->stream_count() < mux->stream_count())
+      mux = item;
+  }
+  return mux;
+}
+
+stats::Metric local_server::state_metric(conState state)
+{
+  switch(state)
+  {
+    case kStart:
+      return stats::kConnectionsStart;
+    case kVerified:
+      return stats::kConnectionsVerified;
+    case kGotcmd:
+      return stats::kConnectionsGotcmd;
+    case kTransport:
+      return stats::kConnectionsTransport;
+  }
+  return stats::kConnectionsStart;
+}
+
+local_server::TunnelState* local_server::tunnel_state(const muduo::net::TcpConnectionPtr &con)
+{
+  TunnelState* const* tunnel = boost::any_cast<TunnelState*>(&con->getContext());
+  return tunnel ? *tunnel : nullptr;
 }
 
 void local_server::onConnection(const muduo::net::TcpConnectionPtr &con)
 {
-  LOG_INFO << "connection from " << con->peerAddress().toIpPort() << " is " << (con->connected() ? " up " : " down ");
-  auto name = con->name();
+  LOG_INFO_LIMITED(10) << "connection from " << con->peerAddress().toIpPort() << " is " << (con->connected() ? " up " : " down ");
+  auto& tunnels = loop_state(con->getLoop()).tunnels;
   if(con->connected())
   {
-    tunnels_[name] = TunnelState(kStart);
+    con->setContext(tunnels.acquire());
+    stats::add(state_metric(kStart));
     con->setTcpNoDelay(true);
   }
   else
   {
-    erase_from_tunnel(name);
+    TunnelState* tunnel = tunnel_state(con);
+    if(!tunnel)
+      return;
+    LOG_DEBUG << con->name() << " read " << tunnel->read_bytes << " bytes in " << tunnel->read_events << " events";
+    if(tunnel->mux)
+      tunnel->mux->close(tunnel->stream_id);
+    stats::add(state_metric(tunnel->state), -1);
+    con->setContext(boost::any());
+    tunnels.release(tunnel);
   }
 }
 
@@ -42,12 +182,15 @@ void local_server::onMessage(const muduo::net::TcpConnectionPtr &con,
                              muduo::net::Buffer *buf,
                              muduo::Timestamp receiveTime)
 {
-  auto con_name = con->name();
-  if(!tunnels_.count(con_name))
+  TunnelState* tunnel_ptr = tunnel_state(con);
+  if(!tunnel_ptr)
   {
-    LOG_FATAL << "can't find specified connection in tunnels_";
+    LOG_FATAL << "connection without state " << con->name();
   }
-  auto& tunnel = tunnels_[con_name];
+  auto& tunnel = *tunnel_ptr;
+  ++tunnel.read_events;
+  tunnel.read_bytes += buf->readableBytes();
+  stats::add(stats::kBytesIn, buf->readableBytes());
   if(tunnel.state == kStart && buf->readableBytes() > 2)
   {
     char ver = buf->peek()[0];
@@ -63,7 +206,7 @@ void local_server::onMessage(const muduo::net::TcpConnectionPtr &con,
     uint8_t nmethods = buf->peek()[1];
     if(buf->readableBytes() < static_cast<size_t>(2 + nmethods))
     {
-      LOG_TRACE << con_name << " methods not get all";
+      LOG_TRACE << con->name() << " methods not get all";
       return;
     }
     else
@@ -73,7 +216,7 @@ void local_server::onMessage(const muduo::net::TcpConnectionPtr &con,
       char no_verify = 0x00;
       if(methods.find(no_verify) == muduo::string::npos)
       {
-        LOG_INFO << con_name << " can't support no security verify!";
+        LOG_INFO << con->name() << " can't support no security verify!";
         buf->retrieveAll();
         struct verify verifyPacket;
         verifyPacket.method = 0xff;
@@ -85,7 +228,7 @@ void local_server::onMessage(const muduo::net::TcpConnectionPtr &con,
       {
         struct verify verifyPacket;
         con->send(&verifyPacket, sizeof(verifyPacket));
-        tunnel.state = kVerified;
+        set_con_state(tunnel_ptr, kVerified);
         return;
       }
     }
@@ -93,7 +236,7 @@ void local_server::onMessage(const muduo::net::TcpConnectionPtr &con,
   else if(tunnel.state == kVerified && buf->readableBytes() > 6)
   {
     char cmd = buf->peek()[1];
-    if(cmd != 0x01)
+    if(cmd != 0x01 && cmd != 0x03)
     {
       buf->retrieveAll();
       struct response unsupportedCommand;
@@ -102,8 +245,8 @@ void local_server::onMessage(const muduo::net::TcpConnectionPtr &con,
       con->shutdown();
       return;
     }
-    char atyp =  buf->peek()[3];
-    if(atyp != 0x03)
+    int addr_len = socks::address_length(buf->peek() + 3, buf->readableBytes() - 3);
+    if(addr_len < 0)
     {
       buf->retrieveAll();
       struct response unsupportedAtyp;
@@ -112,47 +255,120 @@ void local_server::onMessage(const muduo::net::TcpConnectionPtr &con,
       con->shutdown();
       return;
     }
-    uint8_t domain_len = buf->peek()[4];
-    if(buf->readableBytes() < static_cast<size_t>(7 + domain_len))
+    if(addr_len == 0)
     {
-      LOG_INFO << con_name << " domain name not complete";
+      LOG_INFO << con->name() << " address not complete";
       return;
     }
-    else
+    auto loop = con->getLoop();
+    auto& loop_state = this->loop_state(loop);
+    if(cmd == 0x03)
+    {
+      // udp associate, the address is where the client will send from, mostly zero,
+      // its first datagram tells
+      buf->retrieve(3 + addr_len);
+      set_con_state(tunnel_ptr, kGotcmd);
+      // datagrams need a connection of their own, never a stream of a multiplexed one
+      tunnel.udp.reset(new UdpAssociation(loop, loop_state.pool->take(), passwd_, con));
+      tunnel.udp->set_timeout(timeout_);
+      tunnel.udp->set_wheel(&loop_state.wheel);
+      tunnel.udp->set_onTransportCallback(boost::bind(&local_server::set_con_state, tunnel_ptr, kTransport));
+      if(!tunnel.udp->setup())
+      {
+        struct response failure;
+        failure.rep = 0x01;
+        con->send(&failure, sizeof(failure));
+        con->shutdown();
+      }
+      return;
+    }
+    muduo::net::InetAddress addr;
+    std::string domain;
+    uint16_t port;
+    if(!socks::parse(buf->peek() + 3, addr_len, &addr, &domain, &port))
+    {
+      // an empty domain name, nothing to route or resolve
+      buf->retrieveAll();
+      struct response failure;
+      failure.rep = 0x01;
+      con->send(&failure, sizeof(failure));
+      con->shutdown();
+      return;
+    }
+    // raw bytes of an ip literal, socks_server connects to it without dns,
+    // its text stands in for the domain name in logs
+    std::string ip;
+    if(buf->peek()[3] != socks::kDomain)
+    {
+      ip.assign(buf->peek() + 4, addr_len - 3);
+      domain = addr.toIp();
+    }
+    buf->retrieve(3 + addr_len);
+    set_con_state(tunnel_ptr, kGotcmd);
+    if(loop_state.routes && (ip.empty() ? loop_state.routes->match_domain(domain)
+                                        : loop_state.routes->match_address(addr)) == RouteTable::kDirect)
     {
-      buf->retrieve(5);
-      std::string domain(buf->peek(), buf->peek() + domain_len);
-      buf->retrieve(domain_len);
-      uint16_t port;
-      memcpy(&port, buf->peek(), sizeof(port));
-      port = muduo::net::sockets::networkToHost16(port);
-      buf->retrieveInt16();
-      tunnel.state = kGotcmd;
+      // the reply waits for the target, there is no round trip to socks_server to save
       con->stopRead();
-      tunnel.tunnel.reset(new Tunnel(loop_, remote_addr_, domain, port, passwd_, con));
-      tunnel.tunnel->set_timeout(timeout_);
-      tunnel.tunnel->set_onTransportCallback(boost::bind(&local_server::set_con_state, this, con_name, kTransport));
-      tunnel.tunnel->setup();
-      tunnel.tunnel->connect();
+      if(!ip.empty())
+        connect_direct(con, tunnel_ptr, domain, Resolver::AddressList(1, addr));
+      else
+        loop_state.resolver.resolve(domain, port, boost::weak_ptr<muduo::net::TcpConnection>(con));
+      return;
+    }
+    if(!loop_state.muxes.empty())
+    {
+      con->stopRead();
+      tunnel.mux = pick_mux(loop_state);
+      tunnel.stream_id = tunnel.mux->open(con, domain, ip, port, timeout_,
+          boost::bind(&local_server::set_con_state, tunnel_ptr, kTransport));
       return;
     }
+    // the client may send its first payload right away, it goes with the request
+    if(optimistic_)
+      send_success(con, 0, std::string(), 0);
+    else
+      con->stopRead();
+    // the tunnel client runs in the same loop as the accepted connection
+    tunnel.tunnel.reset(new Tunnel(loop, loop_state.pool->take(), domain, port, passwd_, con));
+    tunnel.tunnel->set_ip(ip);
+    tunnel.tunnel->set_timeout(timeout_);
+    tunnel.tunnel->set_codec(codec_, codec_level_);
+    tunnel.tunnel->set_raw(raw_relay_ && codec_ == codec::kNone);
+    tunnel.tunnel->set_budget(&loop_state.budget);
+    tunnel.tunnel->set_wheel(&loop_state.wheel);
+    tunnel.tunnel->set_idle_timeout(idle_timeout_);
+    tunnel.tunnel->set_optimistic(optimistic_);
+    tunnel.tunnel->set_fast_open(fast_open_);
+    tunnel.tunnel->set_onTransportCallback(boost::bind(&local_server::onTransport, tunnel_ptr,
+                                                       boost::weak_ptr<muduo::net::TcpConnection>(con)));
+    tunnel.tunnel->setup();
+    tunnel.tunnel->connect();
+    return;
   }
-  else if(tunnel.state == kTransport && !con->getContext().empty())
+  else if(tunnel.udp)
   {
-    auto clientCon = boost::any_cast<const muduo::net::TcpConnectionPtr&>(con->getContext());
-    msg::ClientMsg msg_data;
-    msg_data.set_type(msg::ClientMsg_Type_DATA);
-    msg_data.set_data(buf->peek(), buf->readableBytes());
+    // nothing but the end of the association comes on the socks connection
     buf->retrieveAll();
-    muduo::net::Buffer buffer;
-    {
-      std::string compressed_str;
-      auto data = msg_data.SerializeAsString();
-      snappy::Compress(data.data(), data.size(), &compressed_str);
-      buffer.appendInt32(static_cast<int32_t>(compressed_str.size()));
-      buffer.append(compressed_str.data(), compressed_str.size());
-    }
-    clientCon->send(&buffer);
+  }
+  else if(tunnel.state == kTransport && tunnel.mux)
+  {
+    tunnel.mux->send(tunnel.stream_id, buf);
+  }
+  else if(tunnel.state == kTransport && tunnel.tunnel && tunnel.tunnel->clientCon())
+  {
+    forward(tunnel, buf);
+  }
+  else if(tunnel.state == kTransport && tunnel.direct && tunnel.direct->clientCon())
+  {
+    forward(tunnel, buf);
+  }
+  else if(tunnel.state == kGotcmd && tunnel.tunnel)
+  {
+    // optimistic, the request takes what it can, the rest waits in the input buffer for the tunnel
+    tunnel.tunnel->onEarlyData();
+    if(buf->readableBytes() >= Tunnel::kMaxEarlyData)
+      con->stopRead();
   }
   else
   {
@@ -161,18 +377,73 @@ void local_server::onMessage(const muduo::net::TcpConnectionPtr &con,
   }
 }
 
-void local_server::set_con_state(const muduo::string &con_name, local_server::conState state)
+
+void local_server::onTransport(TunnelState* tunnel, const boost::weak_ptr<muduo::net::TcpConnection>& con)
+{
+  set_con_state(tunnel, kTransport);
+  auto con_ptr = con.lock();
+  bool connected = tunnel->tunnel ? static_cast<bool>(tunnel->tunnel->clientCon())
+                                  : tunnel->direct && tunnel->direct->clientCon();
+  if(con_ptr && con_ptr->inputBuffer()->readableBytes() > 0 && connected)
+    forward(*tunnel, con_ptr->inputBuffer());
+}
+
+void local_server::forward(TunnelState& tunnel, muduo::net::Buffer* buf)
 {
-  std::unordered_map<muduo::string, TunnelState>::iterator it = tunnels_.find(con_name);
-  if(it != tunnels_.end())
+  if(tunnel.direct)
   {
-    (it->second).state = state;
+    tunnel.direct->touch();
+    tunnel.direct->clientCon()->send(buf);
+    return;
   }
+  auto& clientCon = tunnel.tunnel->clientCon();
+  tunnel.tunnel->touch();
+  if(tunnel.tunnel->raw())
+  {
+    clientCon->send(buf);
+    return;
+  }
+  // compress straight from the input buffer, if it pays off
+  muduo::net::Buffer& buffer = messages::output();
+  tunnel.tunnel->compressor().append(&buffer, frame::kData, buf->peek(), buf->readableBytes());
+  buf->retrieveAll();
+  clientCon->send(&buffer);
+}
+
+void local_server::onResolve(const muduo::net::TcpConnectionPtr &con,
+                             const muduo::string &host,
+                             const Resolver::AddressList &addresses)
+{
+  TunnelState* tunnel = tunnel_state(con);
+  if(!tunnel || tunnel->state != kGotcmd)
+    return;
+  connect_direct(con, tunnel, host, addresses);
+}
+
+void local_server::onResolveError(const muduo::net::TcpConnectionPtr &con, const muduo::string &host)
+{
+  LOG_INFO_LIMITED(10) << "onResolveError due to resolve " << host;
+  struct response unreachable;
+  unreachable.rep = 0x04;
+  con->send(&unreachable, sizeof(unreachable));
+  con->shutdown();
 }
 
-void local_server::erase_from_tunnel(const muduo::string &con_name)
+void local_server::connect_direct(const muduo::net::TcpConnectionPtr &con,
+                                  TunnelState *tunnel,
+                                  const std::string &host,
+                                  const Resolver::AddressList &addresses)
 {
-  auto it = tunnels_.find(con_name);
-  if(it != tunnels_.end())
-    tunnels_.erase(it);
+  auto loop = con->getLoop();
+  auto& loop_state = this->loop_state(loop);
+  tunnel->direct.reset(new DirectTunnel(loop, addresses, host, con));
+  tunnel->direct->setWinnerCallback(boost::bind(&Resolver::prefer, &loop_state.resolver, host, _1));
+  tunnel->direct->set_timeout(timeout_);
+  tunnel->direct->set_budget(&loop_state.budget);
+  tunnel->direct->set_wheel(&loop_state.wheel);
+  tunnel->direct->set_idle_timeout(idle_timeout_);
+  tunnel->direct->set_onTransportCallback(boost::bind(&local_server::onTransport, tunnel,
+                                                      boost::weak_ptr<muduo::net::TcpConnection>(con)));
+  tunnel->direct->setup();
+  tunnel->direct->connect();
 }
\ No newline at end of file
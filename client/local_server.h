@@ -1,10 +1,21 @@
 #pragma once
 
+#include "connection_pool.h"
+#include "direct_tunnel.h"
+#include "mux_client.h"
+#include "Resolver.h"
+#include "route_table.h"
+#include "session_pool.h"
+#include "stats.h"
 #include "tunnel.h"
+#include "udp_association.h"
 
 #include <boost/noncopyable.hpp>
+#include <muduo/base/Mutex.h>
 #include <muduo/net/TcpServer.h>
+#include <memory>
 #include <unordered_map>
+#include <vector>
 
 namespace zy
 {
@@ -26,34 +37,182 @@ class local_server : boost::noncopyable
 
   void onMessage(const muduo::net::TcpConnectionPtr& con, muduo::net::Buffer* buf, muduo::Timestamp receiveTime);
 
-  void set_con_state(const muduo::string& con_name, conState state);
 
-  void start() { server_.start(); }
+  void start();
 
   void  set_timeout(double timeout) { timeout_ = timeout; }
 
- private:
+  // close transport tunnels without traffic for this many seconds, 0 means never
+  void set_idle_timeout(double timeout) { idle_timeout_ = timeout; }
+
+  // must be called before start
+  void set_thread_num(int threads)
+  {
+    threads_ = threads;
+    server_.setThreadNum(threads);
+  }
+
+  // bytes in output buffers of all tunnels, split over the io loops, must be called before start
+  void set_buffer_budget(size_t bytes) { buffer_budget_ = bytes; }
+
+  // multiplexed connections to server per loop, 0 means one connection per socks session
+  // must be called before start
+  void set_mux_connections(int count) { mux_connections_ = count; }
+
+  // pre-connected tunnel connections per loop, 0 max_size means disabled
+  // must be called before start
+  void set_pool_size(int min_size, int max_size)
+  {
+    pool_min_ = min_size;
+    pool_max_ = max_size;
+  }
+
+  void set_pool_idle_timeout(double timeout) { pool_idle_timeout_ = timeout; }
+
+  // relay tunnel data without frames, ignored unless the codec is none
+  void set_raw_relay(bool raw) { raw_relay_ = raw; }
+
+  // reply success to a connect at once and send the first payload with the request,
+  // ignored for streams of multiplexed connections
+  void set_optimistic(bool optimistic) { optimistic_ = optimistic; }
 
-  void erase_from_tunnel(const muduo::string& con_name);
+  // send the request in the syn with tcp fast open when no pooled connection is idle
+  void set_fast_open(bool fast_open) { fast_open_ = fast_open; }
 
+  // rules of connects that go straight to the target instead of through socks_server,
+  // see RouteTable, the file is loaded again when its mtime changes, checked every
+  // reload_interval seconds, an empty path sends everything through socks_server
+  // must be called before start
+  void set_route_file(const std::string& path, double reload_interval)
+  {
+    route_file_ = path;
+    route_reload_interval_ = reload_interval;
+  }
+
+  // codec of tunnel data in both directions, must be called before start
+  void set_codec(codec::Type type, int level)
+  {
+    codec_ = type;
+    codec_level_ = level;
+  }
+
+ private:
+
+  // everything of an accepted socks connection, taken from the SessionPool of its loop
+  // and kept in the context of the connection
   struct TunnelState
   {
-    TunnelState() = default;
+    TunnelState() { reset(); }
 
-    TunnelState(conState state_)
-        : state(state_),
-          tunnel()
-    { }
+    void reset()
+    {
+      state = kStart;
+      tunnel.reset();
+      direct.reset();
+      mux.reset();
+      udp.reset();
+      stream_id = 0;
+      read_events = 0;
+      read_bytes = 0;
+    }
 
     conState state;
     TunnelPtr tunnel;
+    DirectTunnelPtr direct; // routed around socks_server, instead of tunnel
+    // stream of a multiplexed connection, used instead of tunnel if set
+    MuxClientPtr mux;
+    uint32_t stream_id;
+    UdpAssociationPtr udp; // udp associate, instead of tunnel
+    int64_t read_events;
+    int64_t read_bytes;
   };
 
+  struct LoopState : boost::noncopyable
+  {
+    LoopState(muduo::net::EventLoop* loop, size_t budget_bytes)
+        : wheel(loop),
+          resolver(loop, &wheel),
+          tunnels(),
+          muxes(),
+          pool(),
+          budget(loop, budget_bytes),
+          routes()
+    { }
+
+    TimingWheel wheel; // before everything that puts timeouts on it
+    Resolver resolver; // of direct targets
+    SessionPool<TunnelState> tunnels;
+    std::vector<MuxClientPtr> muxes;
+    std::unique_ptr<ConnectionPool> pool;
+    BufferBudget budget;
+    std::shared_ptr<const RouteTable> routes; // null without a route file
+  };
+
+  void onThreadInit(muduo::net::EventLoop* loop);
+
+  // state of the connections accepted by the given loop
+  LoopState& loop_state(muduo::net::EventLoop* loop);
+
+  // null once the connection is down
+  static TunnelState* tunnel_state(const muduo::net::TcpConnectionPtr& con);
+
+  // every state change goes here, to keep the gauges of stats right
+  static void set_con_state(TunnelState* tunnel, conState state)
+  {
+    stats::move(state_metric(tunnel->state), state_metric(state));
+    tunnel->state = state;
+  }
+
+  static stats::Metric state_metric(conState state);
+
+  // tunnel is up, relay what an optimistic socks client sent while it was connecting
+  static void onTransport(TunnelState* tunnel, const boost::weak_ptr<muduo::net::TcpConnection>& con);
+
+  // relay data of the socks client through its tunnel
+  static void forward(TunnelState& tunnel, muduo::net::Buffer* buf);
+
+  void onResolve(const muduo::net::TcpConnectionPtr& con, const muduo::string& host, const Resolver::AddressList& addresses);
+
+  void onResolveError(const muduo::net::TcpConnectionPtr& con, const muduo::string& host);
+
+  // connect to the target of a direct route
+  void connect_direct(const muduo::net::TcpConnectionPtr& con, TunnelState* tunnel,
+                      const std::string& host, const Resolver::AddressList& addresses);
+
+  // load the route file if its mtime changed and hand the new table to every loop,
+  // runs in the base loop
+  void load_routes();
+
+  static void set_routes(LoopState* state, const std::shared_ptr<const RouteTable>& routes)
+  {
+    state->routes = routes;
+  }
+
+  // the multiplexed connection with the fewest streams
+  MuxClientPtr pick_mux(LoopState& state);
+
   muduo::net::EventLoop* loop_;
   muduo::net::TcpServer server_;
   muduo::net::InetAddress remote_addr_;
   std::string passwd_;
-  std::unordered_map<muduo::string, TunnelState> tunnels_;
+  muduo::MutexLock mutex_; // guard loop_states_ while io threads are starting
+  std::unordered_map<muduo::net::EventLoop*, std::unique_ptr<LoopState>> loop_states_;
   double timeout_;
+  double idle_timeout_;
+  int mux_connections_;
+  int pool_min_;
+  int pool_max_;
+  double pool_idle_timeout_;
+  codec::Type codec_;
+  int codec_level_;
+  bool raw_relay_;
+  bool optimistic_;
+  bool fast_open_;
+  int threads_;
+  size_t buffer_budget_;
+  std::string route_file_;
+  double route_reload_interval_;
+  int64_t route_mtime_; // nanoseconds, of the loaded route file
+  std::shared_ptr<const RouteTable> routes_; // latest loaded, copied by loops that start later
 };
 }
\ No newline at end of file
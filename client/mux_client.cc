@@ -0,0 +1,360 @@
+#include "mux_client.h"
+#include "log_rate.h"
+#include "packet.h"
+#include "frame.h"
+#include "messages.h"
+#include "stats.h"
+
+#include <muduo/net/EventLoop.h>
+#include <boost/bind.hpp>
+#include <muduo/base/Logging.h>
+#include <server.pb.h>
+#include <algorithm>
+
+using namespace zy;
+
+MuxClient::MuxClient(muduo::net::EventLoop *loop,
+                     const muduo::net::InetAddress &remote_addr,
+                     const std::string &passwd)
+  : loop_(loop),
+    client_(loop_, remote_addr, "mux_client"),
+    clientCon_(),
+    passwd_(passwd),
+    pending_(),
+    next_id_(1),
+    streams_(),
+    codec_(codec::kSnappy),
+    codec_level_(0),
+    wheel_(nullptr)
+{
+  client_.setConnectionCallback(boost::bind(&MuxClient::onConnection, this, _1));
+  client_.setMessageCallback(boost::bind(&MuxClient::onMessage, this, _1, _2, _3));
+  // reconnect when the server goes away
+  client_.enableRetry();
+}
+
+uint32_t MuxClient::open(const TcpConnectionPtr &con,
+                         const std::string &domain_name,
+                         const std::string &ip,
+                         uint16_t port,
+                         double timeout,
+                         const onTransportCallback &cb)
+{
+  uint32_t id = next_id_++;
+  auto& stream = streams_[id];
+  stream.serverCon = con;
+  stream.onTransport = cb;
+  stream.domain_name = domain_name;
+  stream.port = port;
+  stream.compressor.set_codec(codec_, codec_level_);
+  stream.start = muduo::Timestamp::now();
+  stream.timeout = wheel_->add(timeout, boost::bind(&MuxClient::onTimeoutWeak, wkMuxClient(shared_from_this()), id));
+
+  msg::ClientMsg& message = messages::client_msg();
+  message.set_type(msg::ClientMsg_Type_OPEN);
+  message.set_stream_id(id);
+  auto request_ptr = message.mutable_request();
+  request_ptr->set_password(passwd_);
+  request_ptr->set_cmd(0x01);
+  request_ptr->set_addr(domain_name);
+  if(!ip.empty())
+    request_ptr->set_ip(ip);
+  request_ptr->set_port(port);
+  request_ptr->set_codec(codec_);
+  request_ptr->set_codec_level(codec_level_);
+  send_message(message);
+  return id;
+}
+
+void MuxClient::onConnection(const TcpConnectionPtr &con)
+{
+  LOG_INFO_LIMITED(10) << "multiplexed connection to " << con->peerAddress().toIpPort() << (con->connected() ? " up" : " down");
+  if(con->connected())
+  {
+    con->setTcpNoDelay(true);
+    clientCon_ = con;
+    if(pending_.readableBytes() > 0)
+      con->send(&pending_);
+  }
+  else
+  {
+    clientCon_.reset();
+    pending_.retrieveAll();
+    // every stream dies with the connection
+    for(auto& item : streams_)
+    {
+      auto& stream = item.second;
+      if(!stream.opened)
+      {
+        TimingWheel::cancel(stream.timeout);
+        struct response data;
+        data.rep = 0x01;
+        stream.serverCon->send(&data, sizeof(data));
+      }
+      stream.serverCon->shutdown();
+    }
+    streams_.clear();
+  }
+}
+
+void MuxClient::onMessage(const TcpConnectionPtr &con, muduo::net::Buffer *buf, muduo::Timestamp receiveTime)
+{
+  frame::Header header;
+  std::string uncompressed_str;
+  frame::Status status;
+  while((status = frame::peek(buf, &header)) == frame::kComplete)
+  {
+    muduo::StringPiece payload;
+    if(!frame::payload(buf, header, &uncompressed_str, &payload))
+    {
+      LOG_ERROR << "uncompress frame error!";
+      buf->retrieveAll();
+      con->shutdown();
+      return;
+    }
+    if(header.type == frame::kStreamData)
+    {
+      onData(frame::stream_id(buf), payload.data(), payload.size());
+      buf->retrieve(frame::kHeaderLength + header.length);
+      continue;
+    }
+    msg::ServerMsg& serverMsg = messages::server_msg();
+    if(header.type != frame::kMessage || !serverMsg.ParseFromArray(payload.data(), payload.size()))
+    {
+      LOG_ERROR << "parse from array error!";
+      buf->retrieveAll();
+      con->shutdown();
+      return;
+    }
+    buf->retrieve(frame::kHeaderLength + header.length);
+    uint32_t id = serverMsg.stream_id();
+    switch(serverMsg.type())
+    {
+      case msg::ServerMsg_Type_RESPONSE:
+        onResponse(id, serverMsg);
+        break;
+      case msg::ServerMsg_Type_CLOSE:
+        close_stream(id, false);
+        break;
+      case msg::ServerMsg_Type_WINDOW:
+        onWindow(id, serverMsg.window());
+        break;
+      default:
+        LOG_ERROR << "unexpected message type " << serverMsg.type() << " on multiplexed connection";
+    }
+  }
+  if(status == frame::kOversized)
+  {
+    LOG_ERROR << "frame too large " << header.length << " on multiplexed connection";
+    buf->retrieveAll();
+    con->shutdown();
+  }
+}
+
+void MuxClient::onResponse(uint32_t id, const msg::ServerMsg &message)
+{
+  auto it = streams_.find(id);
+  if(it == streams_.end())
+  {
+    // socks connection is gone already, release the stream on server
+    if(message.response().rep() == 0x00)
+    {
+      msg::ClientMsg& closeMsg = messages::client_msg();
+      closeMsg.set_type(msg::ClientMsg_Type_CLOSE);
+      closeMsg.set_stream_id(id);
+      send_message(closeMsg);
+    }
+    return;
+  }
+  auto& stream = it->second;
+  if(stream.opened)
+  {
+    LOG_ERROR << "duplicated response of stream " << id;
+    return;
+  }
+  auto response = message.response();
+  if(response.rep() != 0x00)
+  {
+    LOG_ERROR_LIMITED(10) << "cannot built stream of " << stream.domain_name << " : " << stream.port;
+    send_response_and_close(id, static_cast<uint8_t>(response.rep()));
+    return;
+  }
+  TimingWheel::cancel(stream.timeout);
+  stats::observe(stats::kConnectSeconds, muduo::timeDifference(muduo::Timestamp::now(), stream.start));
+  stream.opened = true;
+  send_success(stream.serverCon, response.addr(), response.addr6(), static_cast<uint16_t>(response.port()));
+  stream.serverCon->startRead();
+  if(stream.onTransport)
+    stream.onTransport();
+  LOG_INFO_LIMITED(10) << "built stream " << id << " to " << stream.domain_name << " : " << stream.port << " successful!";
+}
+
+void MuxClient::send(uint32_t id, muduo::net::Buffer *buf)
+{
+  auto it = streams_.find(id);
+  if(it == streams_.end() || !it->second.opened)
+  {
+    buf->retrieveAll();
+    return;
+  }
+  flush_input(id, it->second);
+}
+
+void MuxClient::flush_input(uint32_t id, Stream &stream)
+{
+  auto buf = stream.serverCon->inputBuffer();
+  while(buf->readableBytes() > 0 && stream.send_window > 0)
+  {
+    size_t length = std::min(buf->readableBytes(), static_cast<size_t>(stream.send_window));
+    muduo::net::Buffer& frame_buf = messages::output();
+    stream.compressor.append_stream(&frame_buf, id, buf->peek(), length);
+    buf->retrieve(length);
+    stream.send_window -= static_cast<int32_t>(length);
+    send_frame(&frame_buf);
+  }
+  if(buf->readableBytes() > 0 && !stream.paused)
+  {
+    stream.paused = true;
+    stream.serverCon->stopRead();
+  }
+  else if(buf->readableBytes() == 0 && stream.paused)
+  {
+    stream.paused = false;
+    stream.serverCon->startRead();
+  }
+}
+
+void MuxClient::onData(uint32_t id, const char *data, size_t len)
+{
+  auto it = streams_.find(id);
+  if(it == streams_.end() || !it->second.opened)
+    return;
+  auto& stream = it->second;
+  // bytes not granted back yet include those still in the output buffer, a server that
+  // ignores the window would have them pile up there
+  if(len > static_cast<size_t>(kStreamWindow - stream.recv_pending))
+  {
+    LOG_ERROR_LIMITED(10) << "stream to " << stream.domain_name << " overruns its window";
+    close_stream(id, true);
+    return;
+  }
+  stats::add(stats::kBytesOut, len);
+  if(!stream.first_byte)
+  {
+    stream.first_byte = true;
+    stats::observe(stats::kFirstByteSeconds, muduo::timeDifference(muduo::Timestamp::now(), stream.start));
+  }
+  stream.serverCon->send(data, static_cast<int>(len));
+  stream.recv_pending += static_cast<int32_t>(len);
+  if(stream.serverCon->outputBuffer()->readableBytes() == 0)
+  {
+    if(stream.recv_pending >= kStreamWindow / 4)
+      grant_window(id, stream);
+  }
+  else
+  {
+    // socks client is slow, grant window after it drains
+    stream.serverCon->setWriteCompleteCallback(boost::bind(&MuxClient::onStreamWriteCompleteWeak,
+        wkMuxClient(shared_from_this()), id, _1));
+  }
+}
+
+void MuxClient::onStreamWriteComplete(uint32_t id, const TcpConnectionPtr &con)
+{
+  con->setWriteCompleteCallback(muduo::net::WriteCompleteCallback());
+  auto it = streams_.find(id);
+  if(it != streams_.end() && it->second.recv_pending > 0)
+    grant_window(id, it->second);
+}
+
+void MuxClient::onWindow(uint32_t id, uint32_t window)
+{
+  auto it = streams_.find(id);
+  if(it == streams_.end())
+    return;
+  auto& stream = it->second;
+  stream.send_window += static_cast<int32_t>(window);
+  if(stream.opened)
+    flush_input(id, stream);
+}
+
+void MuxClient::grant_window(uint32_t id, Stream &stream)
+{
+  msg::ClientMsg& message = messages::client_msg();
+  message.set_type(msg::ClientMsg_Type_WINDOW);
+  message.set_stream_id(id);
+  message.set_window(static_cast<uint32_t>(stream.recv_pending));
+  stream.recv_pending = 0;
+  send_message(message);
+}
+
+void MuxClient::onTimeout(uint32_t id)
+{
+  auto it = streams_.find(id);
+  if(it == streams_.end() || it->second.opened)
+    return;
+  LOG_ERROR_LIMITED(10) << "stream to " << it->second.domain_name << " timeout";
+  stats::add(stats::kConnectTimeouts);
+  send_response_and_close(id, 0x04);
+}
+
+void MuxClient::send_response_and_close(uint32_t id, uint8_t rep)
+{
+  auto it = streams_.find(id);
+  if(it == streams_.end())
+    return;
+  auto& serverCon = it->second.serverCon;
+  struct response data;
+  data.rep = rep;
+  if(serverCon->connected())
+    serverCon->send(&data, sizeof(data));
+  close_stream(id, true);
+}
+
+void MuxClient::close_stream(uint32_t id, bool notify)
+{
+  auto it = streams_.find(id);
+  if(it == streams_.end())
+    return;
+  if(notify)
+  {
+    msg::ClientMsg& message = messages::client_msg();
+    message.set_type(msg::ClientMsg_Type_CLOSE);
+    message.set_stream_id(id);
+    send_message(message);
+  }
+  TimingWheel::cancel(it->second.timeout);
+  if(it->second.compressor.raw_bytes() > 0)
+    LOG_INFO_LIMITED(10) << "stream to " << it->second.domain_name << " compression " << it->second.compressor.stats();
+  it->second.serverCon->shutdown();
+  streams_.erase(it);
+}
+
+void MuxClient::send_message(const msg::ClientMsg &message)
+{
+  muduo::net::Buffer& buf = messages::output();
+  frame::append_message(&buf, message);
+  send_frame(&buf);
+}
+
+void MuxClient::send_frame(muduo::net::Buffer *buf)
+{
+  if(clientCon_)
+    clientCon_->send(buf);
+  else
+    pending_.append(buf->peek(), buf->readableBytes());
+}
+
+void MuxClient::onStreamWriteCompleteWeak(const wkMuxClient &client, uint32_t id, const TcpConnectionPtr &con)
+{
+  auto client_ptr = client.lock();
+  if(client_ptr)
+    client_ptr->onStreamWriteComplete(id, con);
+}
+
+void MuxClient::onTimeoutWeak(const wkMuxClient &client, uint32_t id)
+{
+  auto client_ptr = client.lock();
+  if(client_ptr)
+    client_ptr->onTimeout(id);
+}
\ No newline at end of file
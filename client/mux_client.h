@@ -0,0 +1,135 @@
+#pragma once
+
+#include <boost/noncopyable.hpp>
+#include <memory>
+#include <muduo/net/TcpClient.h>
+#include <client.pb.h>
+#include "compressor.h"
+#include "timing_wheel.h"
+#include <unordered_map>
+
+namespace msg
+{
+class ServerMsg;
+}
+
+namespace zy
+{
+// long lived connection to socks_server that carries many socks sessions,
+// every session is a stream with its own flow control window
+class MuxClient : boost::noncopyable, public std::enable_shared_from_this<MuxClient>
+{
+ public:
+  typedef muduo::net::TcpConnectionPtr TcpConnectionPtr;
+  typedef std::weak_ptr<MuxClient> wkMuxClient;
+  typedef boost::function<void()> onTransportCallback;
+
+  // bytes a peer may send on one stream before it gets a window update, more closes the stream
+  static const int32_t kStreamWindow = 256 * 1024;
+
+  MuxClient(muduo::net::EventLoop* loop, const muduo::net::InetAddress& remote_addr, const std::string& passwd);
+
+  ~MuxClient() = default;
+
+  void connect() { client_.connect(); }
+
+  // open a stream for the accepted socks connection con, which should stop reading
+  // until the stream is built, return the stream id, ip holds the raw bytes of an ip literal
+  // and domain_name its text, or ip is empty
+  uint32_t open(const TcpConnectionPtr& con, const std::string& domain_name, const std::string& ip,
+                uint16_t port, double timeout, const onTransportCallback& cb);
+
+  // relay data from the socks connection of the stream
+  void send(uint32_t id, muduo::net::Buffer* buf);
+
+  // socks connection of the stream is down
+  void close(uint32_t id) { close_stream(id, true); }
+
+  size_t stream_count() const { return streams_.size(); }
+
+  // codec of stream data in both directions, applies to streams opened later
+  void set_codec(codec::Type type, int level)
+  {
+    codec_ = type;
+    codec_level_ = level;
+  }
+
+  // open timeouts of streams go to the wheel of the loop
+  void set_wheel(TimingWheel* wheel) { wheel_ = wheel; }
+
+ private:
+  struct Stream
+  {
+    Stream()
+        : serverCon(),
+          onTransport(),
+          timeout(),
+          domain_name(),
+          port(0),
+          opened(false),
+          send_window(kStreamWindow),
+          recv_pending(0),
+          paused(false),
+          compressor(),
+          start(),
+          first_byte(false)
+    { }
+
+    TcpConnectionPtr serverCon;
+    onTransportCallback onTransport;
+    WheelEntryPtr timeout;
+    std::string domain_name;
+    uint16_t port;
+    bool opened;
+    int32_t send_window; // bytes we may still send to socks_server
+    int32_t recv_pending; // bytes written to socks connection but not granted back yet
+    bool paused; // stop read from socks connection because the window is used up
+    Compressor compressor;
+    muduo::Timestamp start; // open, for connect and first byte latency
+    bool first_byte;
+  };
+
+  void onConnection(const TcpConnectionPtr& con);
+
+  void onMessage(const TcpConnectionPtr& con, muduo::net::Buffer* buf, muduo::Timestamp receiveTime);
+
+  void onResponse(uint32_t id, const msg::ServerMsg& message);
+
+  void onData(uint32_t id, const char* data, size_t len);
+
+  void onWindow(uint32_t id, uint32_t window);
+
+  void onStreamWriteComplete(uint32_t id, const TcpConnectionPtr& con);
+
+  void onTimeout(uint32_t id);
+
+  static void onStreamWriteCompleteWeak(const wkMuxClient& client, uint32_t id, const TcpConnectionPtr& con);
+
+  static void onTimeoutWeak(const wkMuxClient& client, uint32_t id);
+
+  // relay buffered socks data as long as the stream window allows
+  void flush_input(uint32_t id, Stream& stream);
+
+  void grant_window(uint32_t id, Stream& stream);
+
+  void send_response_and_close(uint32_t id, uint8_t rep);
+
+  void close_stream(uint32_t id, bool notify);
+
+  void send_message(const msg::ClientMsg& message);
+
+  void send_frame(muduo::net::Buffer* buf);
+
+  muduo::net::EventLoop* loop_;
+  muduo::net::TcpClient client_;
+  TcpConnectionPtr clientCon_;
+  std::string passwd_;
+  muduo::net::Buffer pending_; // frames sent before connected
+  uint32_t next_id_;
+  std::unordered_map<uint32_t, Stream> streams_;
+  codec::Type codec_;
+  int codec_level_;
+  TimingWheel* wheel_;
+};
+typedef std::shared_ptr<MuxClient> MuxClientPtr;
+}
\ No newline at end of file
@@ -1,5 +1,9 @@
 #pragma once
 
+#include <muduo/net/TcpConnection.h>
+#include <string.h>
+#include <string>
+
 namespace zy
 {
 struct verify
@@ -18,6 +22,38 @@ struct response
   uint16_t port = 0;
 }__attribute__((__packed__));
 
+// reply with an ipv6 bound address
+struct response6
+{
+  char ver = 0x05;
+  char rep = 0x00;
+  char rev = 0x00;
+  char atyp = 0x04;
+  char addr[16] = {};
+  uint16_t port = 0;
+}__attribute__((__packed__));
+
 static_assert(sizeof(verify) == 2, "verify packed error");
 static_assert(sizeof(response) == 10, "response packed error");
+static_assert(sizeof(response6) == 22, "response6 packed error");
+
+// reply of a built tunnel, the bound address is ipv6 if addr6 holds its 16 bytes, else addr,
+// both addr and port in network byte order
+inline void send_success(const muduo::net::TcpConnectionPtr& con, uint32_t addr, const std::string& addr6, uint16_t port)
+{
+  if(addr6.size() == sizeof(response6::addr))
+  {
+    struct response6 successPacket;
+    ::memcpy(successPacket.addr, addr6.data(), sizeof(successPacket.addr));
+    successPacket.port = port;
+    con->send(&successPacket, sizeof(successPacket));
+  }
+  else
+  {
+    struct response successPacket;
+    successPacket.addr = addr;
+    successPacket.port = port;
+    con->send(&successPacket, sizeof(successPacket));
+  }
+}
 }
\ No newline at end of file
@@ -0,0 +1,186 @@
+#include "relay.h"
+#include "log_rate.h"
+#include "stats.h"
+
+#include <boost/bind.hpp>
+#include <muduo/base/Logging.h>
+
+using namespace zy;
+
+Relay::Relay(const std::string &name, const Relay::TcpConnectionPtr &serverCon)
+  : name_(name),
+    serverCon_(serverCon),
+    clientCon_(),
+    wheel_(nullptr),
+    timeout_entry_(),
+    timeout_(6),
+    idle_(),
+    idle_timeout_(0),
+    transport_(false),
+    marks_(),
+    paused_(),
+    budget_(nullptr)
+{
+
+}
+
+Relay::~Relay()
+{
+  TimingWheel::cancel(timeout_entry_);
+  TimingWheel::cancel(idle_);
+  if(budget_)
+    budget_->remove(this);
+}
+
+void Relay::setup_relay()
+{
+  serverCon_->setHighWaterMarkCallback(boost::bind(&Relay::onHighWaterMarkWeak, wkRelay(shared_from_this()), kServer, _1, _2),
+                                       marks_[kServer].mark());
+  if(budget_)
+    budget_->add(this);
+  timeout_entry_ = wheel_->add(timeout_, boost::bind(&Relay::onTimeoutWeak, wkRelay(shared_from_this())));
+}
+
+void Relay::set_client(const Relay::TcpConnectionPtr &con)
+{
+  clientCon_ = con;
+  con->setHighWaterMarkCallback(boost::bind(&Relay::onHighWaterMarkWeak, wkRelay(shared_from_this()), kClient, _1, _2),
+                                marks_[kClient].mark());
+}
+
+void Relay::start_transport()
+{
+  TimingWheel::cancel(timeout_entry_);
+  timeout_entry_.reset();
+  if(idle_timeout_ > 0)
+    idle_ = wheel_->add(idle_timeout_, boost::bind(&Relay::onIdleWeak, wkRelay(shared_from_this())));
+  transport_ = true;
+  if(!paused_[kServer])
+    serverCon_->startRead();
+}
+
+void Relay::stop_relay()
+{
+  transport_ = false;
+  TimingWheel::cancel(idle_);
+  idle_.reset();
+  clientCon_.reset();
+}
+
+void Relay::onWriteCompleteWeak(const Relay::wkRelay &relay,
+                                Relay::ServerClient which,
+                                const Relay::TcpConnectionPtr &con)
+{
+  auto relay_ptr = relay.lock();
+  if(relay_ptr)
+    relay_ptr->onWriteComplete(which, con);
+}
+
+void Relay::onHighWaterMarkWeak(const Relay::wkRelay &relay,
+                                Relay::ServerClient which,
+                                const Relay::TcpConnectionPtr &con,
+                                size_t bytes_to_sent)
+{
+  auto relay_ptr = relay.lock();
+  if(relay_ptr)
+    relay_ptr->onHighWaterMark(which, con, bytes_to_sent);
+}
+
+void Relay::onTimeoutWeak(const Relay::wkRelay &relay)
+{
+  auto relay_ptr = relay.lock();
+  if(relay_ptr)
+    relay_ptr->onTimeout();
+}
+
+void Relay::onConnectFailedWeak(const Relay::wkRelay &relay)
+{
+  auto relay_ptr = relay.lock();
+  if(relay_ptr)
+    relay_ptr->onConnectFailed();
+}
+
+void Relay::onIdleWeak(const Relay::wkRelay &relay)
+{
+  auto relay_ptr = relay.lock();
+  if(relay_ptr)
+    relay_ptr->onIdle();
+}
+
+void Relay::onIdle()
+{
+  idle_.reset();
+  if(!transport_)
+    return;
+  LOG_INFO_LIMITED(10) << "tunnel to " << name_ << " idle for " << idle_timeout_ << " seconds, close it";
+  stats::add(stats::kIdleTimeouts);
+  if(clientCon_)
+    clientCon_->forceClose();
+  if(serverCon_)
+    serverCon_->forceClose();
+}
+
+void Relay::onHighWaterMark(Relay::ServerClient which, const Relay::TcpConnectionPtr &con, size_t bytes_to_sent)
+{
+  LOG_INFO_LIMITED(10) << (which == kServer ? "server" : "client") << " onHighWaterMark " << con->name()
+           << " bytes " << bytes_to_sent;
+  stats::add(stats::kHighWaterMarks);
+  if(con->outputBuffer()->readableBytes() > 0)
+  {
+    marks_[which].onHighWaterMark(bytes_to_sent);
+    pause_reading(other(which), kHighWater);
+    con->setWriteCompleteCallback(boost::bind(&Relay::onWriteCompleteWeak, wkRelay(shared_from_this()), which, _1));
+  }
+}
+
+void Relay::onWriteComplete(Relay::ServerClient which, const Relay::TcpConnectionPtr &con)
+{
+  LOG_INFO_LIMITED(10) << (which == kServer ? "server" : "client") << " onWriteComplete " << con->name();
+  con->setWriteCompleteCallback(muduo::net::WriteCompleteCallback());
+  if(marks_[which].onWriteComplete())
+  {
+    LOG_DEBUG << con->name() << " high water mark " << marks_[which].mark();
+    con->setHighWaterMarkCallback(boost::bind(&Relay::onHighWaterMarkWeak, wkRelay(shared_from_this()), which, _1, _2),
+                                  marks_[which].mark());
+  }
+  resume_reading(other(which), kHighWater);
+}
+
+void Relay::pause_reading(Relay::ServerClient which, int reason)
+{
+  const auto& con = connection(which);
+  if(!paused_[which] && con)
+    con->stopRead();
+  paused_[which] |= reason;
+}
+
+void Relay::resume_reading(Relay::ServerClient which, int reason)
+{
+  int paused = paused_[which];
+  paused_[which] &= ~reason;
+  const auto& con = connection(which);
+  if(paused && !paused_[which] && con)
+    con->startRead();
+}
+
+size_t Relay::buffered() const
+{
+  // the socks connection does not read before transport
+  if(!transport_ || !clientCon_)
+    return 0;
+  return serverCon_->outputBuffer()->readableBytes() + clientCon_->outputBuffer()->readableBytes();
+}
+
+void Relay::throttle(bool on)
+{
+  if(on)
+  {
+    pause_reading(kServer, kBudget);
+    pause_reading(kClient, kBudget);
+  }
+  else
+  {
+    resume_reading(kServer, kBudget);
+    resume_reading(kClient, kBudget);
+  }
+}
\ No newline at end of file
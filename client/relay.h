@@ -0,0 +1,123 @@
+#pragma once
+
+#include <boost/noncopyable.hpp>
+#include <memory>
+#include <muduo/net/TcpConnection.h>
+#include "flow_control.h"
+#include "timing_wheel.h"
+
+namespace zy
+{
+// relay between a socks client and the connection that carries its data, to socks_server
+// or straight to the target, with the backpressure of both directions: adaptive high water
+// marks, reading paused for the other side or for the buffer budget of the loop, and the
+// idle timeout, subclasses connect and reply
+class Relay : boost::noncopyable,
+              public std::enable_shared_from_this<Relay>,
+              public BufferBudget::Member
+{
+ public:
+  typedef muduo::net::TcpConnectionPtr TcpConnectionPtr;
+  typedef std::weak_ptr<Relay> wkRelay;
+
+  // name is the target, for logs
+  Relay(const std::string& name, const TcpConnectionPtr& serverCon);
+
+  virtual ~Relay();
+
+  // buffer budget of the loop, must be called before setup
+  void set_budget(BufferBudget* budget) { budget_ = budget; }
+
+  // connect and idle timeouts go to the wheel of the loop, must be called before setup
+  void set_wheel(TimingWheel* wheel) { wheel_ = wheel; }
+
+  // close the relay after this many seconds without traffic in transport, 0 means never
+  void set_idle_timeout(double timeout) { idle_timeout_ = timeout; }
+
+  void set_timeout(double timeout) { timeout_ = timeout; }
+
+  // traffic seen, push the idle timeout back
+  void touch()
+  {
+    if(idle_)
+      wheel_->refresh(idle_, idle_timeout_);
+  }
+
+  size_t buffered() const override;
+
+  void throttle(bool on) override;
+
+  // connection that carries the data, null before it is connected and after teardown
+  const TcpConnectionPtr& clientCon() const { return clientCon_; }
+
+ protected:
+  enum ServerClient
+  {
+    kServer,
+    kClient
+  };
+
+  // why a connection does not read, it reads again once all reasons are gone
+  enum PauseReason
+  {
+    kHighWater = 1, // output buffer of the other connection is over its mark
+    kBudget = 2 // the loop is over its buffer budget
+  };
+
+  // join the budget, watch the socks client, and start the connect timeout
+  void setup_relay();
+
+  // the connection that carries the data is up, watch its output buffer too
+  void set_client(const TcpConnectionPtr& con);
+
+  // data flows both ways from now on, the connect timeout is over, the idle timeout starts
+  // and the socks client reads unless it is paused
+  void start_transport();
+
+  // drop the connection that carries the data, nothing is relayed any more
+  void stop_relay();
+
+  virtual void onTimeout() = 0;
+
+  virtual void onConnectFailed() = 0;
+
+  static void onConnectFailedWeak(const wkRelay& relay);
+
+  const std::string name_;
+  TcpConnectionPtr serverCon_;
+  TcpConnectionPtr clientCon_;
+  TimingWheel* wheel_;
+  WheelEntryPtr timeout_entry_; // until transport
+  double timeout_;
+
+ private:
+  const TcpConnectionPtr& connection(ServerClient which) const { return which == kServer ? serverCon_ : clientCon_; }
+
+  static ServerClient other(ServerClient which) { return which == kServer ? kClient : kServer; }
+
+  void pause_reading(ServerClient which, int reason);
+
+  void resume_reading(ServerClient which, int reason);
+
+  void onWriteComplete(ServerClient which, const TcpConnectionPtr& con);
+
+  void onHighWaterMark(ServerClient which, const TcpConnectionPtr& con, size_t bytes_to_sent);
+
+  void onIdle();
+
+  static void onWriteCompleteWeak(const wkRelay& relay, ServerClient which, const TcpConnectionPtr& con);
+
+  static void onHighWaterMarkWeak(const wkRelay& relay, ServerClient which, const TcpConnectionPtr& con, size_t bytes_to_sent);
+
+  static void onTimeoutWeak(const wkRelay& relay);
+
+  static void onIdleWeak(const wkRelay& relay);
+
+  WheelEntryPtr idle_; // armed in transport
+  double idle_timeout_;
+  bool transport_;
+  AdaptiveMark marks_[2]; // of the output buffer of each connection
+  int paused_[2]; // PauseReason of each connection
+  BufferBudget* budget_;
+};
+}
\ No newline at end of file
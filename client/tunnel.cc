@@ -1,68 +1,170 @@
 #include "tunnel.h"
+#include "log_rate.h"
 #include "packet.h"
+#include "frame.h"
+#include "messages.h"
+#include "stats.h"
 
-#include <snappy.h>
 #include <muduo/net/EventLoop.h>
 #include <boost/bind.hpp>
+#include <algorithm>
 #include <muduo/base/Logging.h>
 #include <server.pb.h>
 
 using namespace zy;
+
+namespace
+{
+// optimistic, how long the request waits for the first payload of the socks client,
+// clients that wait for the target to speak first pay it once
+const double kEarlyDataWait = 0.02;
+}
+
 Tunnel::Tunnel(muduo::net::EventLoop *loop,
-               const muduo::net::InetAddress remote_addr,
+               const HappyEyeballsPtr &client,
                const std::string &domain_name,
                uint16_t port,
                const std::string &passwd,
                const Tunnel::TcpConnectionPtr &con)
-  : loop_(loop),
-    client_(loop_, remote_addr, "tunnel_client"),
-    serverCon_(con),
-    domain_name_(domain_name),
+  : Relay(domain_name, con),
+    loop_(loop),
+    client_(client),
+    ip_(),
     port_(port),
     passwd_(passwd),
-    timerId_(),
     state_(kInit),
-    timeout_(6)
+    onTransportCallback_(),
+    compressor_(),
+    raw_(false),
+    optimistic_(false),
+    fast_open_(false),
+    request_(),
+    waiting_(false),
+    wait_timer_(),
+    start_(),
+    first_byte_(false)
 {
 
 }
 
+Tunnel::~Tunnel()
+{
+  if(compressor_.raw_bytes() > 0)
+    LOG_INFO_LIMITED(10) << "tunnel to " << name_ << " compression " << compressor_.stats();
+}
+
 void Tunnel::setup() {
-  client_.setConnectionCallback(boost::bind(&Tunnel::onConnection, this, _1));
-  client_.setMessageCallback(boost::bind(&Tunnel::onMessage, this, _1, _2, _3));
-  serverCon_->setHighWaterMarkCallback(boost::bind(&Tunnel::onHighWaterMarkWeak, wkTunnel(shared_from_this()), kServer, _1, _2), 1024 * 1024);
-  auto timer_id = loop_->runAfter(timeout_, boost::bind(&Tunnel::onTimeoutWeak, wkTunnel(shared_from_this())));
-  timerId_.reset(new muduo::net::TimerId(timer_id));
+  start_ = muduo::Timestamp::now();
+  client_->setConnectionCallback(boost::bind(&Tunnel::onConnection, this, _1));
+  client_->setMessageCallback(boost::bind(&Tunnel::onMessage, this, _1, _2, _3));
+  client_->setFailCallback(boost::bind(&Relay::onConnectFailedWeak, wkRelay(shared_from_this())));
+  setup_relay();
   state_ = kSetup;
 }
 
+void Tunnel::connect()
+{
+  auto con = client_->connection();
+  if(con && con->connected())
+  {
+    // taken from pool
+    onConnection(con);
+    return;
+  }
+  // the request goes in the syn, so does the connect wait for the payload
+  if(fast_open_ && wait_early_data())
+    return;
+  start_connect();
+}
+
+void Tunnel::start_connect()
+{
+  if(fast_open_)
+  {
+    muduo::net::Buffer& buf = messages::output();
+    append_request(&buf);
+    request_ = buf.retrieveAllAsString();
+    client_->set_fast_open_data(request_);
+  }
+  client_->connect();
+}
+
+bool Tunnel::wait_early_data()
+{
+  if(!optimistic_ || serverCon_->inputBuffer()->readableBytes() > 0)
+    return false;
+  waiting_ = true;
+  wait_timer_ = loop_->runAfter(kEarlyDataWait, boost::bind(&Tunnel::onEarlyDataWeak, wkRelay(shared_from_this())));
+  return true;
+}
+
+void Tunnel::onEarlyData()
+{
+  if(!waiting_)
+    return;
+  waiting_ = false;
+  loop_->cancel(wait_timer_);
+  if(clientCon_)
+    send_request();
+  else
+    start_connect();
+}
+
+void Tunnel::send_request()
+{
+  muduo::net::Buffer& buf = messages::output();
+  append_request(&buf);
+  clientCon_->send(&buf);
+}
+
+void Tunnel::append_request(muduo::net::Buffer *buf)
+{
+  msg::ClientMsg& message = messages::client_msg();
+  message.set_type(msg::ClientMsg_Type_REQUEST);
+  auto request_ptr = message.mutable_request();
+  request_ptr->set_password(passwd_);
+  request_ptr->set_cmd(0x01);
+  request_ptr->set_addr(name_);
+  if(!ip_.empty())
+    request_ptr->set_ip(ip_);
+  request_ptr->set_port(port_);
+  request_ptr->set_codec(compressor_.codec());
+  request_ptr->set_codec_level(compressor_.level());
+  request_ptr->set_raw(raw_);
+  muduo::net::Buffer* input = serverCon_->inputBuffer();
+  if(optimistic_ && input->readableBytes() > 0)
+  {
+    size_t len = std::min(input->readableBytes(), kMaxEarlyData);
+    message.set_data(input->peek(), len);
+    input->retrieve(len);
+  }
+  frame::append_message(buf, message);
+}
+
 void Tunnel::onConnection(const Tunnel::TcpConnectionPtr &con)
 {
   LOG_DEBUG << con->peerAddress().toIpPort() << (con->connected() ? " up " : " down ");
   if(con->connected())
   {
-    LOG_INFO << "connect to remote server successful!";
+    LOG_INFO_LIMITED(10) << "connect to remote server successful!";
+    stats::observe(stats::kConnectSeconds, muduo::timeDifference(muduo::Timestamp::now(), start_));
     con->setTcpNoDelay(true);
-    clientCon_ = con;
+    set_client(con);
     state_ = kConnected;
-    msg::ClientMsg message;
-    message.set_type(msg::ClientMsg_Type_REQUEST);
-    auto request_ptr = message.mutable_request();
-    request_ptr->set_password(passwd_);
-    request_ptr->set_cmd(0x01);
-    request_ptr->set_addr(domain_name_);
-    request_ptr->set_port(port_);
-    muduo::net::Buffer buf;
+    if(request_.empty())
+    {
+      // a pooled connection is up before the socks client could send anything
+      if(!wait_early_data())
+        send_request();
+    }
+    else
     {
-      std::string compressed_str;
-      auto data = message.SerializeAsString();
-      snappy::Compress(data.data(), data.size(), &compressed_str);
-      buf.appendInt32(compressed_str.size());
-      buf.append(compressed_str.data(), compressed_str.size());
+      // the part that did not go in the syn
+      size_t sent = client_->fast_open_sent();
+      if(request_.size() > sent)
+        con->send(request_.data() + sent, static_cast<int>(request_.size() - sent));
+      std::string().swap(request_);
     }
-    con->send(&buf);
-    // set high water mark callback function
-    con->setHighWaterMarkCallback(boost::bind(&Tunnel::onHighWaterMarkWeak, shared_from_this(), kClient, _1, _2), 1024 * 1024);
   }
     // password not correct, teardown
   else
@@ -73,72 +175,88 @@ void Tunnel::onConnection(const Tunnel::TcpConnectionPtr &con)
 
 void Tunnel::onMessage(const Tunnel::TcpConnectionPtr &con, muduo::net::Buffer *buf, muduo::Timestamp receiveTime)
 {
-  LOG_DEBUG << domain_name_ << " transport " << buf->readableBytes() << "bytes to local_server";
+  LOG_DEBUG << name_ << " transport " << buf->readableBytes() << "bytes to local_server";
+  stats::add(stats::kBytesOut, buf->readableBytes());
+  touch();
+  frame::Header header;
+  frame::Status status = frame::kIncomplete;
   if(state_ == kConnected)
   {
-    if (buf->readableBytes() > 4 && static_cast<int32_t>(buf->readableBytes()) >= buf->peekInt32() + 4)
+    status = frame::peek(buf, &header);
+    if (status == frame::kComplete)
     {
-      int32_t length = buf->readInt32();
-      msg::ServerMsg serverMsg;
-
-      if (serverMsg.ParseFromArray(buf->peek(), length) && serverMsg.type() == msg::ServerMsg_Type_RESPONSE
-          && serverMsg.response().rep() == 0x00) {
-        buf->retrieve(length);
-
-        if (timerId_) {
-          loop_->cancel(*timerId_);
-          timerId_.reset();
-        }
-        auto response = serverMsg.response();
-        struct response successPacket;
-        successPacket.addr = response.addr();
-        successPacket.port = response.port();
-        serverCon_->send(&successPacket, sizeof(successPacket));
-        serverCon_->setContext(con);
-        serverCon_->startRead();
+      msg::ServerMsg& serverMsg = messages::server_msg();
+
+      if (header.type == frame::kMessage && !(header.flags & frame::kCodecMask)
+          && serverMsg.ParseFromArray(buf->peek() + frame::kHeaderLength, header.length)
+          && serverMsg.type() == msg::ServerMsg_Type_RESPONSE && serverMsg.response().rep() == 0x00) {
+        buf->retrieve(frame::kHeaderLength + header.length);
+
+        const auto& response = serverMsg.response();
+        if (!optimistic_)
+          send_success(serverCon_, response.addr(), response.addr6(), static_cast<uint16_t>(response.port()));
+        start_transport();
+        state_ = kTransport;
         if (onTransportCallback_)
           onTransportCallback_();
-        state_ = kTransport;
-        LOG_INFO << "built data pipe to " << domain_name_ << " : " << port_ << " successful!";
+        LOG_INFO_LIMITED(10) << "built data pipe to " << name_ << " : " << port_ << " successful!";
       } else {
-        LOG_ERROR << "cannot built data pipe of " << domain_name_ << " : " << port_;
+        LOG_ERROR_LIMITED(10) << "cannot built data pipe of " << name_ << " : " << port_;
         buf->retrieveAll();
         send_response_and_teardown(0x01);
+        return;
       }
     }
   }
+  if(state_ == kTransport && !first_byte_ && buf->readableBytes() > 0)
+  {
+    first_byte_ = true;
+    stats::observe(stats::kFirstByteSeconds, muduo::timeDifference(muduo::Timestamp::now(), start_));
+  }
+  if(state_ == kTransport && raw_)
+  {
+    serverCon_->send(buf);
+  }
   else if(state_ == kTransport)
   {
-    while(buf->readableBytes() > 4 && static_cast<int32_t>(buf->readableBytes()) >= 4 + buf->peekInt32())
+    std::string uncompressed_str;
+    while((status = frame::peek(buf, &header)) == frame::kComplete)
     {
-      int32_t length = buf->readInt32();
-      msg::ServerMsg serverMsg;
-      if(serverMsg.ParseFromArray(buf->peek(), length) && serverMsg.type() == msg::ServerMsg_Type_DATA && !serverMsg.data().empty())
+      muduo::StringPiece payload;
+      if(header.type == frame::kData && frame::payload(buf, header, &uncompressed_str, &payload))
       {
-        buf->retrieve(length);
-        serverCon_->send(serverMsg.data().data(), serverMsg.data().size());
+        // relay straight from the input buffer
+        serverCon_->send(payload);
+        buf->retrieve(frame::kHeaderLength + header.length);
       }
       else
       {
-        LOG_ERROR << "remote server error due to " << domain_name_;
+        LOG_ERROR << "remote server error due to " << name_;
         buf->retrieveAll();
         teardown();
         return;
       }
     }
   }
-  else
+  else if(state_ != kConnected)
   {
     LOG_ERROR << "unknown connection state " << state_;
     teardown();
   }
+  if(status == frame::kOversized)
+  {
+    LOG_ERROR << "frame too large " << header.length << " from remote server of " << name_;
+    buf->retrieveAll();
+    send_response_and_teardown(0x01);
+  }
 }
 
 void Tunnel::send_response_and_teardown(uint8_t rep)
 {
   struct response data;
   data.rep = rep;
-  if(serverCon_ && serverCon_->connected())
+  // an optimistic socks client got its reply already, closing is all it can be told
+  if(!optimistic_ && serverCon_ && serverCon_->connected())
   {
     serverCon_->send(&data, sizeof(data));
   }
@@ -150,81 +268,37 @@ void Tunnel::teardown()
   if(state_ != kTeardown)
   {
     state_ = kTeardown;
-    client_.setConnectionCallback(muduo::net::defaultConnectionCallback);
-    client_.setMessageCallback(muduo::net::defaultMessageCallback);
+    if(waiting_)
+    {
+      waiting_ = false;
+      loop_->cancel(wait_timer_);
+    }
+    client_->setConnectionCallback(muduo::net::defaultConnectionCallback);
+    client_->setMessageCallback(muduo::net::defaultMessageCallback);
+    client_->setFailCallback(HappyEyeballs::FailCallback());
     if (serverCon_) {
-      serverCon_->setContext(boost::any());
       serverCon_->shutdown();
     }
-    clientCon_.reset();
+    stop_relay();
   }
 }
 
-void Tunnel::onWriteCompleteWeak(const Tunnel::wkTunnel &tunnel,
-                                 Tunnel::ServerClient which,
-                                 const Tunnel::TcpConnectionPtr &con)
-{
-  auto tunnel_ptr = tunnel.lock();
-  if(tunnel_ptr)
-    tunnel_ptr->onWriteComplete(which, con);
-}
-
-void Tunnel::onHighWaterMarkWeak(const Tunnel::wkTunnel &tunnel,
-                                 Tunnel::ServerClient which,
-                                 const Tunnel::TcpConnectionPtr &con,
-                                 size_t bytes_to_sent)
-{
-  auto tunnel_ptr = tunnel.lock();
-  if(tunnel_ptr)
-    tunnel_ptr->onHighWaterMark(which, con, bytes_to_sent);
-}
-
-void Tunnel::onTimeoutWeak(const Tunnel::wkTunnel &tunnel)
-{
-  auto tunnel_ptr = tunnel.lock();
-  if(tunnel_ptr)
-    tunnel_ptr->onTimeout();
-}
-
 void Tunnel::onTimeout()
 {
-  LOG_ERROR << "remote server to " << domain_name_ << " timeout";
+  LOG_ERROR_LIMITED(10) << "remote server to " << name_ << " timeout";
+  stats::add(stats::kConnectTimeouts);
   send_response_and_teardown(0x04);
 }
 
-void Tunnel::onHighWaterMark(Tunnel::ServerClient which, const Tunnel::TcpConnectionPtr &con, size_t bytes_to_sent)
+void Tunnel::onConnectFailed()
 {
-  LOG_INFO << (which == kServer ? "server" : "client") << " onHighWaterMark " << con->name()
-           << " bytes " << bytes_to_sent;
-  if(which == kServer)
-  {
-    if(serverCon_->outputBuffer()->readableBytes() > 0)
-    {
-      clientCon_->stopRead();
-      serverCon_->setWriteCompleteCallback(boost::bind(&Tunnel::onWriteCompleteWeak, shared_from_this(), kServer, _1));
-    }
-  }
-  else
-  {
-    if(clientCon_->outputBuffer()->readableBytes() > 0)
-    {
-      serverCon_->stopRead();
-      clientCon_->setWriteCompleteCallback(boost::bind(&Tunnel::onWriteCompleteWeak, shared_from_this(), kClient, _1));
-    }
-  }
+  LOG_ERROR_LIMITED(10) << "connect to remote server for " << name_ << " failed";
+  send_response_and_teardown(0x01);
 }
 
-void Tunnel::onWriteComplete(Tunnel::ServerClient which, const Tunnel::TcpConnectionPtr &con)
+void Tunnel::onEarlyDataWeak(const wkRelay &relay)
 {
-  LOG_INFO << (which == kServer ? "server" : "client") << " onWriteComplete " << con->name();
-  if(which == kServer)
-  {
-    clientCon_->startRead();
-    serverCon_->setWriteCompleteCallback(muduo::net::WriteCompleteCallback());
-  }
-  else if (which == kClient)
-  {
-    serverCon_->startRead();
-    clientCon_->setWriteCompleteCallback(muduo::net::WriteCompleteCallback());
-  }
+  auto tunnel = relay.lock();
+  if(tunnel)
+    static_cast<Tunnel*>(tunnel.get())->onEarlyData();
 }
\ No newline at end of file
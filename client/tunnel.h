@@ -1,19 +1,17 @@
 #pragma once
 
-#include <boost/noncopyable.hpp>
-#include <memory>
-#include <muduo/net/TcpClient.h>
-#include <muduo/net/TcpClient.h>
-#include <muduo/net/TimerId.h>
 #include <client.pb.h>
+#include "compressor.h"
+#include "happy_eyeballs.h"
+#include "relay.h"
+
+#include <muduo/net/TimerId.h>
 
 namespace zy
 {
-class Tunnel : boost::noncopyable, public std::enable_shared_from_this<Tunnel>
+class Tunnel : public Relay
 {
  public:
-  typedef muduo::net::TcpConnectionPtr TcpConnectionPtr;
-  typedef std::weak_ptr<Tunnel> wkTunnel;
   typedef boost::function<void()> onTransportCallback;
 
   enum State
@@ -25,58 +23,91 @@ class Tunnel : boost::noncopyable, public std::enable_shared_from_this<Tunnel>
     kTeardown
   };
 
-  Tunnel(muduo::net::EventLoop* loop, const muduo::net::InetAddress remote_addr,
+  // client may be connected already, see ConnectionPool
+  Tunnel(muduo::net::EventLoop* loop, const HappyEyeballsPtr& client,
          const std::string& domain_name, uint16_t port,
          const std::string& passwd, const TcpConnectionPtr& con);
 
-  ~Tunnel() = default;
+  ~Tunnel();
 
   void onConnection(const TcpConnectionPtr& con);
 
   void onMessage(const TcpConnectionPtr& con, muduo::net::Buffer* buf, muduo::Timestamp receiveTime);
 
-  void connect() { client_.connect(); }
+  void connect();
 
   void setup();
 
   void teardown();
 
-  void set_timeout(double timeout) { timeout_ = timeout; }
-
   void set_onTransportCallback(const onTransportCallback& cb) { onTransportCallback_ = cb; }
 
+  // codec of data in both directions, sent to socks_server with the request
+  void set_codec(codec::Type type, int level) { compressor_.set_codec(type, level); }
+
+  // raw bytes of an ip literal, sent with the request so socks_server skips dns
+  void set_ip(const std::string& ip) { ip_ = ip; }
+
+  // relay without frames once connected, asked for in the request
+  void set_raw(bool raw) { raw_ = raw; }
+
+  bool raw() const { return raw_; }
+
+  // the socks client got its success reply already, the request waits a moment for its
+  // first payload and takes it along, later data waits in the input buffer for the response,
+  // a failure just closes
+  void set_optimistic(bool optimistic) { optimistic_ = optimistic; }
+
+  // optimistic, the socks client sent something, the request waiting for it goes now
+  void onEarlyData();
+
+  // payload sent with the request at most, more waits for the response
+  static const size_t kMaxEarlyData = 64 * 1024;
+
+  // send the request in the syn with tcp fast open if the client is not connected yet,
+  // must be called before connect
+  void set_fast_open(bool fast_open) { fast_open_ = fast_open; }
+
+  // encoder of data sent to socks_server
+  Compressor& compressor() { return compressor_; }
+
  private:
-  enum ServerClient
-  {
-    kServer,
-    kClient
-  };
+  void onTimeout() override;
 
-  void onWriteComplete(ServerClient which, const TcpConnectionPtr& con);
+  void onConnectFailed() override;
 
-  void onHighWaterMark(ServerClient which, const TcpConnectionPtr& con, size_t bytes_to_sent);
+  // connect to socks_server, with the request in the syn if fast open
+  void start_connect();
 
-  void onTimeout();
+  // optimistic and nothing to send with the request yet, hold it until onEarlyData
+  // or a short timer, false if there is no need to wait
+  bool wait_early_data();
 
-  static void onWriteCompleteWeak(const wkTunnel& tunnel, ServerClient which, const TcpConnectionPtr& con);
+  // framed REQUEST message, with the early data of an optimistic socks client
+  void append_request(muduo::net::Buffer* buf);
 
-  static void onHighWaterMarkWeak(const wkTunnel& tunnel, ServerClient which, const TcpConnectionPtr& con, size_t bytes_to_sent);
+  void send_request();
 
-  static void onTimeoutWeak(const wkTunnel& tunnel);
+  static void onEarlyDataWeak(const wkRelay& relay);
 
   void send_response_and_teardown(uint8_t rep);
 
   muduo::net::EventLoop* loop_;
-  muduo::net::TcpClient client_;
-  TcpConnectionPtr serverCon_;
-  TcpConnectionPtr clientCon_;
-  std::string domain_name_;
+  HappyEyeballsPtr client_;
+  std::string ip_;
   uint16_t port_;
   std::string passwd_;
-  std::unique_ptr<muduo::net::TimerId> timerId_;
   State state_;
-  double timeout_;
   onTransportCallback onTransportCallback_;
+  Compressor compressor_;
+  bool raw_;
+  bool optimistic_;
+  bool fast_open_;
+  std::string request_; // framed already, sent in the syn with fast open
+  bool waiting_; // the request waits for early data
+  muduo::net::TimerId wait_timer_;
+  muduo::Timestamp start_; // setup, for connect and first byte latency
+  bool first_byte_;
 };
 typedef std::shared_ptr<Tunnel> TunnelPtr;
 }
@@ -0,0 +1,276 @@
+#include "udp_association.h"
+#include "log_rate.h"
+#include "packet.h"
+#include "frame.h"
+#include "messages.h"
+#include "socks_address.h"
+#include "stats.h"
+
+#include <muduo/net/EventLoop.h>
+#include <muduo/base/Logging.h>
+#include <boost/bind.hpp>
+#include <server.pb.h>
+#include <string.h>
+
+using namespace zy;
+
+namespace
+{
+// rsv and frag in front of the address of every socks5 udp datagram
+const size_t kUdpHeaderLength = 3;
+const char kUdpHeader[kUdpHeaderLength] = { 0, 0, 0 };
+
+bool same_ip(const muduo::net::InetAddress& a, const muduo::net::InetAddress& b)
+{
+  if(a.family() != b.family())
+    return false;
+  if(a.family() == AF_INET)
+    return a.ipNetEndian() == b.ipNetEndian();
+  const struct sockaddr_in6* a6 = reinterpret_cast<const struct sockaddr_in6*>(a.getSockAddr());
+  const struct sockaddr_in6* b6 = reinterpret_cast<const struct sockaddr_in6*>(b.getSockAddr());
+  return ::memcmp(&a6->sin6_addr, &b6->sin6_addr, sizeof(a6->sin6_addr)) == 0;
+}
+}
+
+UdpAssociation::UdpAssociation(muduo::net::EventLoop *loop,
+                               const HappyEyeballsPtr &client,
+                               const std::string &passwd,
+                               const TcpConnectionPtr &con)
+  : loop_(loop),
+    client_(client),
+    serverCon_(con),
+    clientCon_(),
+    passwd_(passwd),
+    udp_(loop, con->localAddress().family()),
+    client_addr_(),
+    client_known_(false),
+    state_(kConnecting),
+    timeout_(6),
+    wheel_(nullptr),
+    timeout_entry_(),
+    onTransportCallback_()
+{
+
+}
+
+UdpAssociation::~UdpAssociation()
+{
+  TimingWheel::cancel(timeout_entry_);
+}
+
+bool UdpAssociation::setup()
+{
+  // the same address as the socks connection, so the client can reach it, any port
+  muduo::net::InetAddress addr(serverCon_->localAddress());
+  if(addr.family() == AF_INET)
+  {
+    struct sockaddr_in sin = *reinterpret_cast<const struct sockaddr_in*>(addr.getSockAddr());
+    sin.sin_port = 0;
+    addr = muduo::net::InetAddress(sin);
+  }
+  else
+  {
+    struct sockaddr_in6 sin6 = *reinterpret_cast<const struct sockaddr_in6*>(addr.getSockAddr());
+    sin6.sin6_port = 0;
+    addr = muduo::net::InetAddress(sin6);
+  }
+  if(!udp_.bind(addr))
+    return false;
+  udp_.setMessageCallback(boost::bind(&UdpAssociation::onClientMessage, this, _1, _2));
+  timeout_entry_ = wheel_->add(timeout_, boost::bind(&UdpAssociation::onTimeoutWeak, wkAssociation(shared_from_this())));
+  client_->setConnectionCallback(boost::bind(&UdpAssociation::onConnection, this, _1));
+  client_->setMessageCallback(boost::bind(&UdpAssociation::onMessage, this, _1, _2, _3));
+  client_->setFailCallback(boost::bind(&UdpAssociation::onConnectFailedWeak, wkAssociation(shared_from_this())));
+  auto con = client_->connection();
+  if(con && con->connected())
+  {
+    // taken from pool
+    onConnection(con);
+  }
+  else
+  {
+    client_->connect();
+  }
+  return true;
+}
+
+void UdpAssociation::onConnection(const TcpConnectionPtr &con)
+{
+  if(con->connected())
+  {
+    con->setTcpNoDelay(true);
+    clientCon_ = con;
+    msg::ClientMsg& message = messages::client_msg();
+    message.set_type(msg::ClientMsg_Type_REQUEST);
+    auto request_ptr = message.mutable_request();
+    request_ptr->set_password(passwd_);
+    request_ptr->set_cmd(0x03);
+    request_ptr->set_addr("");
+    request_ptr->set_port(0);
+    muduo::net::Buffer& buf = messages::output();
+    frame::append_message(&buf, message);
+    con->send(&buf);
+    state_ = kRequested;
+  }
+  else
+  {
+    teardown();
+  }
+}
+
+void UdpAssociation::onMessage(const TcpConnectionPtr &con, muduo::net::Buffer *buf, muduo::Timestamp receiveTime)
+{
+  if(state_ == kTeardown)
+  {
+    buf->retrieveAll();
+    return;
+  }
+  frame::Header header;
+  frame::Status status;
+  while((status = frame::peek(buf, &header)) == frame::kComplete)
+  {
+    const char* payload = buf->peek() + frame::kHeaderLength;
+    if(state_ == kRequested && header.type == frame::kMessage)
+    {
+      msg::ServerMsg& serverMsg = messages::server_msg();
+      if(!serverMsg.ParseFromArray(payload, header.length) || serverMsg.type() != msg::ServerMsg_Type_RESPONSE)
+      {
+        LOG_ERROR << "bad response of udp associate";
+        buf->retrieveAll();
+        send_response_and_teardown(0x01);
+        return;
+      }
+      buf->retrieve(frame::kHeaderLength + header.length);
+      if(serverMsg.response().rep() != 0x00)
+      {
+        send_response_and_teardown(static_cast<uint8_t>(serverMsg.response().rep()));
+        return;
+      }
+      TimingWheel::cancel(timeout_entry_);
+      timeout_entry_.reset();
+      // tell the client where to send its datagrams
+      muduo::net::InetAddress local = udp_.localAddress();
+      if(local.family() == AF_INET)
+      {
+        send_success(serverCon_, local.ipNetEndian(), std::string(), local.portNetEndian());
+      }
+      else
+      {
+        const struct sockaddr_in6* sin6 = reinterpret_cast<const struct sockaddr_in6*>(local.getSockAddr());
+        send_success(serverCon_, 0, std::string(reinterpret_cast<const char*>(&sin6->sin6_addr), 16),
+                     local.portNetEndian());
+      }
+      udp_.start();
+      state_ = kTransport;
+      if(onTransportCallback_)
+        onTransportCallback_();
+      LOG_INFO_LIMITED(10) << "udp associate of " << serverCon_->peerAddress().toIpPort() << " on " << local.toIpPort();
+    }
+    else if(state_ == kTransport && header.type == frame::kDatagram && !(header.flags & frame::kCodecMask))
+    {
+      stats::add(stats::kBytesOut, header.length);
+      // nobody to send to before the client sent something
+      if(client_known_)
+        udp_.send(client_addr_, kUdpHeader, kUdpHeaderLength, payload, header.length);
+      buf->retrieve(frame::kHeaderLength + header.length);
+    }
+    else
+    {
+      LOG_ERROR << "unexpected frame type " << static_cast<int>(header.type) << " of udp associate";
+      buf->retrieveAll();
+      send_response_and_teardown(0x01);
+      return;
+    }
+  }
+  udp_.flush();
+  if(status == frame::kOversized)
+  {
+    LOG_ERROR << "frame too large " << header.length << " of udp associate";
+    buf->retrieveAll();
+    send_response_and_teardown(0x01);
+  }
+}
+
+void UdpAssociation::onClientMessage(const UdpSocket::Datagram *datagrams, int count)
+{
+  if(!clientCon_)
+    return;
+  muduo::net::Buffer& buf = messages::output();
+  for(int i = 0; i < count; ++i)
+  {
+    const UdpSocket::Datagram& datagram = datagrams[i];
+    // only the host of the socks connection may use the association
+    if(!client_known_ && same_ip(datagram.peer, serverCon_->peerAddress()))
+    {
+      client_addr_ = datagram.peer;
+      client_known_ = true;
+    }
+    if(!client_known_ || datagram.peer.portNetEndian() != client_addr_.portNetEndian()
+       || !same_ip(datagram.peer, client_addr_))
+      continue;
+    const char* data = datagram.data.data();
+    size_t len = datagram.data.size();
+    // fragments are not supported, drop them as rfc 1928 allows
+    if(len <= kUdpHeaderLength || data[2] != 0
+       || socks::address_length(data + kUdpHeaderLength, len - kUdpHeaderLength) <= 0)
+    {
+      stats::add(stats::kDatagramsDropped);
+      continue;
+    }
+    stats::add(stats::kBytesIn, len);
+    frame::append(&buf, frame::kDatagram, data + kUdpHeaderLength, len - kUdpHeaderLength);
+  }
+  if(buf.readableBytes() > 0)
+    clientCon_->send(&buf);
+}
+
+void UdpAssociation::onTimeoutWeak(const wkAssociation &association)
+{
+  auto association_ptr = association.lock();
+  if(association_ptr)
+    association_ptr->onTimeout();
+}
+
+void UdpAssociation::onConnectFailedWeak(const wkAssociation &association)
+{
+  auto association_ptr = association.lock();
+  if(association_ptr)
+  {
+    LOG_ERROR << "udp associate connect to remote server failed";
+    association_ptr->send_response_and_teardown(0x01);
+  }
+}
+
+void UdpAssociation::onTimeout()
+{
+  LOG_ERROR_LIMITED(10) << "udp associate of " << serverCon_->peerAddress().toIpPort() << " timeout";
+  stats::add(stats::kConnectTimeouts);
+  send_response_and_teardown(0x04);
+}
+
+void UdpAssociation::send_response_and_teardown(uint8_t rep)
+{
+  // the reply is only due before transport, later the socks connection is just closed
+  if(state_ != kTransport && serverCon_->connected())
+  {
+    struct response data;
+    data.rep = rep;
+    serverCon_->send(&data, sizeof(data));
+  }
+  teardown();
+}
+
+void UdpAssociation::teardown()
+{
+  if(state_ != kTeardown)
+  {
+    state_ = kTeardown;
+    client_->setConnectionCallback(muduo::net::defaultConnectionCallback);
+    client_->setMessageCallback(muduo::net::defaultMessageCallback);
+    client_->setFailCallback(HappyEyeballs::FailCallback());
+    if(clientCon_)
+      clientCon_->shutdown();
+    serverCon_->shutdown();
+    clientCon_.reset();
+  }
+}
\ No newline at end of file
@@ -0,0 +1,83 @@
+#pragma once
+
+#include "happy_eyeballs.h"
+#include "timing_wheel.h"
+#include "udp_socket.h"
+
+#include <boost/noncopyable.hpp>
+#include <memory>
+#include <muduo/net/TcpConnection.h>
+
+namespace zy
+{
+// udp associate of one socks connection, datagrams of the socks client arrive at a udp
+// socket next to the socks connection and go to socks_server in kDatagram frames on a
+// connection of their own, replies come back the same way, the association lives as long
+// as the socks connection
+class UdpAssociation : boost::noncopyable,
+                       public std::enable_shared_from_this<UdpAssociation>
+{
+ public:
+  typedef muduo::net::TcpConnectionPtr TcpConnectionPtr;
+  typedef std::weak_ptr<UdpAssociation> wkAssociation;
+  typedef boost::function<void()> onTransportCallback;
+
+  // client may be connected already, see ConnectionPool
+  UdpAssociation(muduo::net::EventLoop* loop, const HappyEyeballsPtr& client,
+                 const std::string& passwd, const TcpConnectionPtr& con);
+
+  ~UdpAssociation();
+
+  void set_timeout(double timeout) { timeout_ = timeout; }
+
+  // connect timeout goes to the wheel of the loop, must be called before setup
+  void set_wheel(TimingWheel* wheel) { wheel_ = wheel; }
+
+  void set_onTransportCallback(const onTransportCallback& cb) { onTransportCallback_ = cb; }
+
+  // bind the udp socket to the local address of the socks connection and connect to
+  // socks_server, false if the socket can't be bound
+  bool setup();
+
+  void teardown();
+
+ private:
+  enum State
+  {
+    kConnecting,
+    kRequested,
+    kTransport,
+    kTeardown
+  };
+
+  void onConnection(const TcpConnectionPtr& con);
+
+  void onMessage(const TcpConnectionPtr& con, muduo::net::Buffer* buf, muduo::Timestamp receiveTime);
+
+  // datagrams of the socks client
+  void onClientMessage(const UdpSocket::Datagram* datagrams, int count);
+
+  void onTimeout();
+
+  static void onTimeoutWeak(const wkAssociation& association);
+
+  static void onConnectFailedWeak(const wkAssociation& association);
+
+  void send_response_and_teardown(uint8_t rep);
+
+  muduo::net::EventLoop* loop_;
+  HappyEyeballsPtr client_;
+  TcpConnectionPtr serverCon_; // socks connection
+  TcpConnectionPtr clientCon_; // to socks_server
+  std::string passwd_;
+  UdpSocket udp_;
+  muduo::net::InetAddress client_addr_; // where the socks client sends from, known with its first datagram
+  bool client_known_;
+  State state_;
+  double timeout_;
+  TimingWheel* wheel_;
+  WheelEntryPtr timeout_entry_;
+  onTransportCallback onTransportCallback_;
+};
+typedef std::shared_ptr<UdpAssociation> UdpAssociationPtr;
+}
\ No newline at end of file
@@ -0,0 +1,159 @@
+#include "codec.h"
+#include "frame.h"
+
+#include <muduo/net/Endian.h>
+#include <lz4.h>
+#include <snappy.h>
+#include <zstd.h>
+#include <stdlib.h>
+
+using namespace zy;
+
+namespace
+{
+// contexts are reused by every tunnel in the same thread
+__thread ZSTD_CCtx* t_cctx = nullptr;
+__thread ZSTD_DCtx* t_dctx = nullptr;
+}
+
+bool codec::parse(const std::string &name, Type *type, int *level)
+{
+  *level = 0;
+  if(name == "none")
+    *type = kNone;
+  else if(name == "snappy")
+    *type = kSnappy;
+  else if(name == "lz4")
+    *type = kLz4;
+  else if(name == "zstd")
+  {
+    *type = kZstd;
+    *level = 1;
+  }
+  else if(name.compare(0, 5, "zstd-") == 0)
+  {
+    *type = kZstd;
+    *level = atoi(name.c_str() + 5);
+    if(*level < 1 || *level > ZSTD_maxCLevel())
+      return false;
+  }
+  else
+    return false;
+  return true;
+}
+
+const char* codec::name(Type type)
+{
+  switch(type)
+  {
+    case kNone:
+      return "none";
+    case kSnappy:
+      return "snappy";
+    case kLz4:
+      return "lz4";
+    case kZstd:
+      return "zstd";
+  }
+  return "unknown";
+}
+
+bool codec::valid(int type)
+{
+  return type >= kNone && type <= kZstd;
+}
+
+size_t codec::max_compressed_length(Type type, size_t len)
+{
+  switch(type)
+  {
+    case kNone:
+      return len;
+    case kSnappy:
+      return snappy::MaxCompressedLength(len);
+    case kLz4:
+      return sizeof(uint32_t) + LZ4_compressBound(static_cast<int>(len));
+    case kZstd:
+      return ZSTD_compressBound(len);
+  }
+  return len;
+}
+
+size_t codec::compress(Type type, int level, const char *src, size_t len, char *dst)
+{
+  switch(type)
+  {
+    case kNone:
+      return 0;
+    case kSnappy:
+    {
+      size_t compressed_len = 0;
+      snappy::RawCompress(src, len, dst, &compressed_len);
+      return compressed_len;
+    }
+    case kLz4:
+    {
+      uint32_t be32 = muduo::net::sockets::hostToNetwork32(static_cast<uint32_t>(len));
+      ::memcpy(dst, &be32, sizeof(be32));
+      int capacity = LZ4_compressBound(static_cast<int>(len));
+      int compressed_len = LZ4_compress_default(src, dst + sizeof(be32), static_cast<int>(len), capacity);
+      return compressed_len > 0 ? sizeof(be32) + compressed_len : 0;
+    }
+    case kZstd:
+    {
+      if(!t_cctx)
+        t_cctx = ZSTD_createCCtx();
+      size_t compressed_len = ZSTD_compressCCtx(t_cctx, dst, ZSTD_compressBound(len), src, len, level);
+      return ZSTD_isError(compressed_len) ? 0 : compressed_len;
+    }
+  }
+  return 0;
+}
+
+bool codec::uncompress(Type type, const char *src, size_t len, std::string *dst)
+{
+  switch(type)
+  {
+    case kNone:
+      dst->assign(src, len);
+      return true;
+    case kSnappy:
+    {
+      // the length is whatever the peer says, check it before snappy allocates it
+      size_t raw_len;
+      if(!snappy::GetUncompressedLength(src, len, &raw_len) || raw_len > frame::kMaxLength)
+        return false;
+      return snappy::Uncompress(src, len, dst);
+    }
+    case kLz4:
+    {
+      uint32_t be32;
+      if(len < sizeof(be32))
+        return false;
+      ::memcpy(&be32, src, sizeof(be32));
+      uint32_t raw_len = muduo::net::sockets::networkToHost32(be32);
+      if(raw_len > frame::kMaxLength)
+        return false;
+      dst->resize(raw_len);
+      if(raw_len == 0)
+        return true;
+      int n = LZ4_decompress_safe(src + sizeof(be32), &*dst->begin(), static_cast<int>(len - sizeof(be32)),
+                                  static_cast<int>(raw_len));
+      return n == static_cast<int>(raw_len);
+    }
+    case kZstd:
+    {
+      unsigned long long raw_len = ZSTD_getFrameContentSize(src, len);
+      if(raw_len == ZSTD_CONTENTSIZE_UNKNOWN || raw_len == ZSTD_CONTENTSIZE_ERROR || raw_len > frame::kMaxLength)
+        return false;
+      if(!t_dctx)
+        t_dctx = ZSTD_createDCtx();
+      dst->resize(raw_len);
+      if(raw_len == 0)
+        return true;
+      size_t n = ZSTD_decompressDCtx(t_dctx, &*dst->begin(), raw_len, src, len);
+      return !ZSTD_isError(n) && n == raw_len;
+    }
+  }
+  return false;
+}
\ No newline at end of file
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <stddef.h>
+#include <string>
+
+namespace zy
+{
+// compression codecs of payload data, the type is carried in the frame flags,
+// so every frame can be decoded without knowing what was negotiated
+namespace codec
+{
+enum Type
+{
+  kNone = 0,
+  kSnappy = 1,
+  kLz4 = 2, // uint32_t raw length in network byte order, then a lz4 block
+  kZstd = 3
+};
+
+// parse "none", "snappy", "lz4", "zstd" or "zstd-N" where N is the level
+bool parse(const std::string& name, Type* type, int* level);
+
+const char* name(Type type);
+
+bool valid(int type);
+
+// capacity of dst needed by compress
+size_t max_compressed_length(Type type, size_t len);
+
+// return compressed length, 0 if fail
+size_t compress(Type type, int level, const char* src, size_t len, char* dst);
+
+bool uncompress(Type type, const char* src, size_t len, std::string* dst);
+}
+}
\ No newline at end of file
@@ -0,0 +1,169 @@
+#include "compressor.h"
+#include "stats.h"
+
+#include <muduo/base/Atomic.h>
+#include <algorithm>
+#include <stdio.h>
+
+using namespace zy;
+
+namespace
+{
+// small frames never pay off
+const size_t kMinLength = 256;
+// bytes compressed to probe a frame while compression is off
+const size_t kSampleLength = 4096;
+// compressed / raw ratio worth the cpu
+const double kGoodRatio = 0.9;
+const int kMinSkip = 16;
+const int kMaxSkip = 1024;
+
+muduo::AtomicInt64 g_raw_bytes;
+muduo::AtomicInt64 g_wire_bytes;
+
+// compressed payload of every tunnel of the thread until it is appended to a frame,
+// never freed, like the messages of messages.cc
+__thread std::string* t_scratch = nullptr;
+
+std::string& scratch()
+{
+  if(!t_scratch)
+    t_scratch = new std::string;
+  return *t_scratch;
+}
+
+// after every frame, a few huge frames should not pin memory
+void trim_scratch()
+{
+  if(t_scratch && t_scratch->capacity() > frame::kMaxScratch)
+    std::string().swap(*t_scratch);
+}
+}
+
+Compressor::Compressor(codec::Type type, int level)
+  : type_(type),
+    level_(level),
+    enabled_(true),
+    ratio_(-1), // no frame yet
+    skip_(kMinSkip),
+    skip_left_(0),
+    raw_bytes_(0),
+    wire_bytes_(0),
+    compressed_frames_(0),
+    raw_frames_(0)
+{
+
+}
+
+Compressor::~Compressor()
+{
+  g_raw_bytes.add(raw_bytes_);
+  g_wire_bytes.add(wire_bytes_);
+}
+
+int64_t Compressor::global_raw_bytes()
+{
+  return g_raw_bytes.get();
+}
+
+int64_t Compressor::global_wire_bytes()
+{
+  return g_wire_bytes.get();
+}
+
+std::string Compressor::stats() const
+{
+  int64_t global_raw = global_raw_bytes();
+  int64_t global_wire = global_wire_bytes();
+  char buf[256];
+  snprintf(buf, sizeof(buf), "ratio %.3f saved %ld bytes, %ld of %ld frames compressed, global ratio %.3f saved %ld bytes",
+           raw_bytes_ ? static_cast<double>(wire_bytes_) / raw_bytes_ : 1.0, raw_bytes_ - wire_bytes_,
+           compressed_frames_, compressed_frames_ + raw_frames_,
+           global_raw ? static_cast<double>(global_wire) / global_raw : 1.0, global_raw - global_wire);
+  return buf;
+}
+
+void Compressor::append(muduo::net::Buffer *buf, frame::Type type, const char *data, size_t len)
+{
+  const char* encoded;
+  size_t encoded_len;
+  uint8_t flags = encode(data, len, &encoded, &encoded_len);
+  frame::append(buf, type, encoded, encoded_len, flags);
+  trim_scratch();
+}
+
+void Compressor::append_stream(muduo::net::Buffer *buf, uint32_t stream_id, const char *data, size_t len)
+{
+  const char* encoded;
+  size_t encoded_len;
+  uint8_t flags = encode(data, len, &encoded, &encoded_len);
+  frame::append_stream(buf, stream_id, encoded, encoded_len, flags);
+  trim_scratch();
+}
+
+uint8_t Compressor::encode(const char *data, size_t len, const char **encoded, size_t *encoded_len)
+{
+  raw_bytes_ += len;
+  stats::add(stats::kRawBytes, len);
+  *encoded = data;
+  *encoded_len = len;
+  if(type_ == codec::kNone)
+  {
+    ++raw_frames_;
+    wire_bytes_ += len;
+    stats::add(stats::kWireBytes, len);
+    return 0;
+  }
+  if(len >= kMinLength && !enabled_ && --skip_left_ <= 0)
+  {
+    size_t sample = std::min(len, kSampleLength);
+    size_t compressed_len = compress(data, sample);
+    double sample_ratio = static_cast<double>(compressed_len) / sample;
+    if(compressed_len > 0 && sample_ratio < kGoodRatio)
+    {
+      enabled_ = true;
+      ratio_ = sample_ratio;
+      skip_ = kMinSkip;
+    }
+    else
+    {
+      // back off further every time the probe fails
+      skip_ = std::min(skip_ * 2, kMaxSkip);
+      skip_left_ = skip_;
+    }
+  }
+  uint8_t flags = 0;
+  if(len >= kMinLength && enabled_)
+  {
+    size_t compressed_len = compress(data, len);
+    double frame_ratio = compressed_len > 0 ? static_cast<double>(compressed_len) / len : 1.0;
+    ratio_ = ratio_ < 0 ? frame_ratio : 0.75 * ratio_ + 0.25 * frame_ratio;
+    if(ratio_ > kGoodRatio)
+    {
+      enabled_ = false;
+      skip_left_ = skip_;
+    }
+    if(compressed_len > 0 && compressed_len < len)
+    {
+      *encoded = scratch().data();
+      *encoded_len = compressed_len;
+      flags = static_cast<uint8_t>(type_);
+    }
+  }
+  if(flags != 0)
+    ++compressed_frames_;
+  else
+    ++raw_frames_;
+  wire_bytes_ += *encoded_len;
+  stats::add(stats::kWireBytes, *encoded_len);
+  return flags;
+}
+
+size_t Compressor::compress(const char *data, size_t len)
+{
+  size_t max_len = codec::max_compressed_length(type_, len);
+  std::string& buf = scratch();
+  if(buf.size() < max_len)
+    buf.resize(max_len);
+  return codec::compress(type_, level_, data, len, &*buf.begin());
+}
\ No newline at end of file
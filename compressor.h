@@ -0,0 +1,73 @@
+#pragma once
+
+#include "codec.h"
+#include "frame.h"
+
+#include <boost/noncopyable.hpp>
+#include <stdint.h>
+#include <string>
+
+namespace zy
+{
+// frame encoder of one tunnel or stream, compress frames only while it pays off,
+// most traffic is tls and does not compress at all, so after a few bad frames
+// compression is turned off and a cheap sample of a later frame is tried again
+class Compressor : boost::noncopyable
+{
+ public:
+  explicit Compressor(codec::Type type = codec::kSnappy, int level = 0);
+
+  void set_codec(codec::Type type, int level)
+  {
+    type_ = type;
+    level_ = level;
+  }
+
+  codec::Type codec() const { return type_; }
+
+  int level() const { return level_; }
+
+  // add stats of this tunnel to the global stats
+  ~Compressor();
+
+  void append(muduo::net::Buffer* buf, frame::Type type, const char* data, size_t len);
+
+  void append_stream(muduo::net::Buffer* buf, uint32_t stream_id, const char* data, size_t len);
+
+  // payload bytes before encoding
+  int64_t raw_bytes() const { return raw_bytes_; }
+
+  // payload bytes after encoding
+  int64_t wire_bytes() const { return wire_bytes_; }
+
+  int64_t compressed_frames() const { return compressed_frames_; }
+
+  int64_t raw_frames() const { return raw_frames_; }
+
+  // stats of all finished tunnels in this process
+  static int64_t global_raw_bytes();
+
+  static int64_t global_wire_bytes();
+
+  // human readable stats of this tunnel and of the process
+  std::string stats() const;
+
+ private:
+  // point data to the encoded payload, return the frame flags
+  uint8_t encode(const char* data, size_t len, const char** encoded, size_t* encoded_len);
+
+  // compress into the scratch of the thread, return compressed length
+  size_t compress(const char* data, size_t len);
+
+  codec::Type type_;
+  int level_;
+  bool enabled_;
+  double ratio_; // recent compressed / raw ratio
+  int skip_; // frames to skip after a failed try
+  int skip_left_;
+  int64_t raw_bytes_;
+  int64_t wire_bytes_;
+  int64_t compressed_frames_;
+  int64_t raw_frames_;
+};
+}
\ No newline at end of file
@@ -101,3 +101,101 @@ int config_json::dns_timeout() const {
 bool config_json::server_ipv6() const {
   return config_["server_ipv6"].GetBool();
 }
+
+std::string config_json::codec() const {
+  if(config_.HasMember("codec") && config_["codec"].IsString())
+    return config_["codec"].GetString();
+  return "snappy";
+}
+
+bool config_json::raw_relay() const {
+  return config_.HasMember("raw_relay") && config_["raw_relay"].IsBool() && config_["raw_relay"].GetBool();
+}
+
+bool config_json::optimistic() const {
+  return config_.HasMember("optimistic") && config_["optimistic"].IsBool() && config_["optimistic"].GetBool();
+}
+
+bool config_json::fast_open() const {
+  return config_.HasMember("fast_open") && config_["fast_open"].IsBool() && config_["fast_open"].GetBool();
+}
+
+std::string config_json::route_file() const {
+  if(config_.HasMember("route_file") && config_["route_file"].IsString())
+    return config_["route_file"].GetString();
+  return "";
+}
+
+int config_json::route_reload_interval() const {
+  return get_int("route_reload_interval", 5);
+}
+
+int config_json::buffer_budget_mb() const {
+  return get_int("buffer_budget_mb", 1024);
+}
+
+int config_json::stats_port() const {
+  return get_int("stats_port", 0);
+}
+
+std::string config_json::stats_address() const {
+  if(config_.HasMember("stats_address") && config_["stats_address"].IsString())
+    return config_["stats_address"].GetString();
+  return "127.0.0.1";
+}
+
+std::string config_json::dns_servers() const {
+  if(config_.HasMember("dns_servers") && config_["dns_servers"].IsString())
+    return config_["dns_servers"].GetString();
+  return "";
+}
+
+int config_json::dns_min_ttl() const {
+  return get_int("dns_min_ttl", 30);
+}
+
+int config_json::dns_max_ttl() const {
+  return get_int("dns_max_ttl", 3600);
+}
+
+int config_json::dns_negative_ttl() const {
+  return get_int("dns_negative_ttl", 5);
+}
+
+int config_json::threads() const {
+  return get_int("threads", 0);
+}
+
+int config_json::workers() const {
+  return get_int("workers", 0);
+}
+
+bool config_json::reuseport_cpu() const {
+  return config_.HasMember("reuseport_cpu") && config_["reuseport_cpu"].IsBool() && config_["reuseport_cpu"].GetBool();
+}
+
+int config_json::mux_connections() const {
+  return get_int("mux_connections", 0);
+}
+
+int config_json::pool_min() const {
+  return get_int("pool_min", 0);
+}
+
+int config_json::pool_max() const {
+  return get_int("pool_max", 0);
+}
+
+int config_json::pool_idle_timeout() const {
+  return get_int("pool_idle_timeout", 30);
+}
+
+int config_json::idle_timeout() const {
+  return get_int("idle_timeout", 300);
+}
+
+int config_json::get_int(const char *key, int default_value) const {
+  if(config_.HasMember(key) && config_[key].IsNumber())
+    return config_[key].GetInt();
+  return default_value;
+}
@@ -42,7 +42,71 @@ class config_json : boost::noncopyable
 
   bool server_ipv6() const;
 
+  // clamps of the ttl of cached dns answers, and how long failures are cached, in seconds
+  int dns_min_ttl() const;
+  int dns_max_ttl() const;
+  int dns_negative_ttl() const;
+
+  // "host:port,host:port" of dns servers, empty means resolv.conf
+  std::string dns_servers() const;
+
+  // number of io threads, 0 means run everything in the main loop
+  int threads() const;
+
+  // socks_server processes sharing server_port by SO_REUSEPORT, each with threads io threads,
+  // its own resolver and stats_port + its index, 0 means a single process
+  int workers() const;
+
+  // steer connections to the worker pinned to the cpu that received them, best with
+  // one worker per cpu
+  bool reuseport_cpu() const;
+
+  // multiplexed connections per io thread of local_server, 0 means disabled
+  int mux_connections() const;
+
+  // size of pre-connected tunnel connections per io thread of local_server
+  int pool_min() const;
+  int pool_max() const;
+  int pool_idle_timeout() const;
+
+  // seconds a tunnel in transport may go without traffic before it is closed, 0 means never,
+  // default 300
+  int idle_timeout() const;
+
+  // codec of tunnel data: none, snappy, lz4, zstd or zstd-N, default snappy
+  std::string codec() const;
+
+  // relay tunnel data without frames, so socks_server can splice it, only with codec none
+  bool raw_relay() const;
+
+  // local_server replies success to socks clients at once and sends their first payload
+  // with the request, saves a round trip to socks_server, a failed connect just closes
+  bool optimistic() const;
+
+  // tcp fast open, socks_server accepts it and both send their first frame in the syn
+  // once they have a cookie of the peer, needs net.ipv4.tcp_fastopen of the kernel
+  bool fast_open() const;
+
+  // rule file of local_server, connects it matches go straight to the target instead of
+  // through socks_server, see RouteTable, empty means none
+  std::string route_file() const;
+
+  // seconds between checks of the route file for changes, 0 means never, default 5
+  int route_reload_interval() const;
+
+  // bytes buffered in output buffers of all tunnels of the process, in MB, default 1024,
+  // the tunnels holding most stop reading while it is exceeded
+  int buffer_budget_mb() const;
+
+  // prometheus stats on http://stats_address:stats_port/metrics, 0 means disabled,
+  // the address defaults to 127.0.0.1
+  int stats_port() const;
+  std::string stats_address() const;
+
  private:
+  // optional key, return default_value if not given
+  int get_int(const char* key, int default_value) const;
+
   rapidjson::Document config_;
 };
 }
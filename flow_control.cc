@@ -0,0 +1,121 @@
+#include "flow_control.h"
+#include "stats.h"
+
+#include <muduo/net/EventLoop.h>
+#include <muduo/base/Logging.h>
+#include <boost/bind.hpp>
+#include <algorithm>
+#include <functional>
+#include <utility>
+#include <vector>
+
+using namespace zy;
+
+namespace
+{
+// bytes a peer may have buffered, in seconds of its drain rate
+const double kDrainSeconds = 0.1;
+const double kCheckInterval = 0.1;
+const double kResumeRatio = 0.75;
+}
+
+const size_t AdaptiveMark::kMinMark;
+const size_t AdaptiveMark::kMaxMark;
+const size_t AdaptiveMark::kInitialMark;
+
+void AdaptiveMark::onHighWaterMark(size_t bytes)
+{
+  bytes_ = bytes;
+  since_ = muduo::Timestamp::now();
+}
+
+bool AdaptiveMark::onWriteComplete()
+{
+  if(!since_.valid())
+    return false;
+  double seconds = muduo::timeDifference(muduo::Timestamp::now(), since_);
+  since_ = muduo::Timestamp::invalid();
+  if(seconds <= 0)
+    return false;
+  double target = static_cast<double>(bytes_) / seconds * kDrainSeconds;
+  // move half way, a single slow write should not collapse the mark
+  size_t mark = static_cast<size_t>((static_cast<double>(mark_) + target) / 2);
+  mark = std::min(std::max(mark, kMinMark), kMaxMark);
+  if(mark == mark_)
+    return false;
+  mark_ = mark;
+  return true;
+}
+
+BufferBudget::BufferBudget(muduo::net::EventLoop *loop, size_t budget)
+  : loop_(loop),
+    budget_(budget),
+    members_(),
+    throttled_(),
+    timerId_(loop_->runEvery(kCheckInterval, boost::bind(&BufferBudget::check, this)))
+{
+
+}
+
+BufferBudget::~BufferBudget()
+{
+  loop_->cancel(timerId_);
+}
+
+void BufferBudget::add(Member *member)
+{
+  members_.insert(member);
+}
+
+void BufferBudget::remove(Member *member)
+{
+  members_.erase(member);
+  throttled_.erase(member);
+}
+
+void BufferBudget::check()
+{
+  size_t total = 0;
+  size_t active = 0; // of the members still reading
+  std::vector<std::pair<size_t, Member*>> heavy;
+  for(Member* member : members_)
+  {
+    size_t buffered = member->buffered();
+    total += buffered;
+    if(buffered > 0 && !throttled_.count(member))
+    {
+      active += buffered;
+      heavy.push_back(std::make_pair(buffered, member));
+    }
+  }
+  if(total > budget_)
+  {
+    // stop the heaviest until what the members still reading hold fits in the budget again,
+    // the bytes of members throttled on earlier checks are draining already
+    size_t target = static_cast<size_t>(budget_ * kResumeRatio);
+    if(active <= target)
+      return;
+    std::sort(heavy.begin(), heavy.end(), std::greater<std::pair<size_t, Member*>>());
+    size_t excess = active - target;
+    size_t stopped = 0;
+    bool throttling = !throttled_.empty();
+    for(auto& member : heavy)
+    {
+      if(stopped >= excess)
+        break;
+      member.second->throttle(true);
+      throttled_.insert(member.second);
+      stopped += member.first;
+      stats::add(stats::kBudgetThrottles);
+    }
+    if(!throttling)
+      LOG_WARN << "buffered " << total << " bytes over budget " << budget_ << ", "
+               << throttled_.size() << " tunnels throttled";
+  }
+  else if(!throttled_.empty() && total < budget_ * kResumeRatio)
+  {
+    for(Member* member : throttled_)
+      member->throttle(false);
+    throttled_.clear();
+  }
+}
\ No newline at end of file
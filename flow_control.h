@@ -0,0 +1,89 @@
+#pragma once
+
+#include <muduo/base/Timestamp.h>
+#include <muduo/net/TimerId.h>
+#include <boost/noncopyable.hpp>
+#include <stddef.h>
+#include <stdint.h>
+#include <unordered_set>
+
+namespace muduo
+{
+namespace net
+{
+class EventLoop;
+}
+}
+
+namespace zy
+{
+// high water mark of one output buffer of a tunnel, follows how fast the peer drains it,
+// when the buffer crosses the mark its reader is stopped until the buffer is written out,
+// then the mark becomes what the peer drains in kDrainSeconds, so a bulk stream on a fast
+// link gets a deep buffer, and a slow peer can't pin megabytes
+class AdaptiveMark
+{
+ public:
+  static const size_t kMinMark = 64 * 1024;
+  static const size_t kMaxMark = 16 * 1024 * 1024;
+  static const size_t kInitialMark = 1024 * 1024;
+
+  AdaptiveMark()
+      : mark_(kInitialMark),
+        bytes_(0),
+        since_()
+  { }
+
+  size_t mark() const { return mark_; }
+
+  // the buffer crossed the mark with bytes in it
+  void onHighWaterMark(size_t bytes);
+
+  // the buffer is written out, return true if the mark changed
+  bool onWriteComplete();
+
+ private:
+  size_t mark_;
+  size_t bytes_;
+  muduo::Timestamp since_;
+};
+
+// limit on bytes in output buffers of the tunnels of one loop, the process wide budget
+// is split over the io loops, so nothing is shared between threads,
+// checked every kCheckInterval, when the loop is over budget the tunnels holding
+// most bytes stop reading, until the loop is below kResumeRatio of the budget
+class BufferBudget : boost::noncopyable
+{
+ public:
+  class Member
+  {
+   public:
+    virtual ~Member() = default;
+
+    // bytes in output buffers of the member
+    virtual size_t buffered() const = 0;
+
+    virtual void throttle(bool on) = 0;
+  };
+
+  BufferBudget(muduo::net::EventLoop* loop, size_t budget);
+
+  ~BufferBudget();
+
+  // in loop thread, a member removes itself before it is destroyed
+  void add(Member* member);
+
+  void remove(Member* member);
+
+  size_t budget() const { return budget_; }
+
+ private:
+  void check();
+
+  muduo::net::EventLoop* loop_;
+  size_t budget_;
+  std::unordered_set<Member*> members_;
+  std::unordered_set<Member*> throttled_;
+  muduo::net::TimerId timerId_;
+};
+}
\ No newline at end of file
@@ -0,0 +1,151 @@
+#include "frame.h"
+#include "codec.h"
+
+#include <google/protobuf/message.h>
+#include <muduo/base/Logging.h>
+#include <muduo/net/Endian.h>
+
+using namespace zy;
+
+namespace
+{
+void encode_header(char* dst, uint32_t length, uint8_t type, uint8_t flags)
+{
+  uint32_t be32 = muduo::net::sockets::hostToNetwork32(length);
+  ::memcpy(dst, &be32, sizeof(be32));
+  dst[4] = static_cast<char>(type);
+  dst[5] = static_cast<char>(flags);
+  dst[6] = 0;
+  dst[7] = 0;
+}
+}
+
+frame::Status frame::peek(const muduo::net::Buffer *buf, Header *header)
+{
+  if(buf->readableBytes() < kHeaderLength)
+    return kIncomplete;
+  const char* data = buf->peek();
+  uint32_t be32;
+  ::memcpy(&be32, data, sizeof(be32));
+  header->length = muduo::net::sockets::networkToHost32(be32);
+  header->type = static_cast<uint8_t>(data[4]);
+  header->flags = static_cast<uint8_t>(data[5]);
+  if(header->length > kMaxLength)
+    return kOversized;
+  return buf->readableBytes() >= kHeaderLength + header->length ? kComplete : kIncomplete;
+}
+
+bool frame::payload(const muduo::net::Buffer *buf, const Header &header, std::string *scratch, muduo::StringPiece *data)
+{
+  const char* begin = buf->peek() + kHeaderLength;
+  size_t length = header.length;
+  if(header.type == kStreamData)
+  {
+    if(length < sizeof(uint32_t))
+      return false;
+    begin += sizeof(uint32_t);
+    length -= sizeof(uint32_t);
+  }
+  int type = header.flags & kCodecMask;
+  if(type != codec::kNone)
+  {
+    if(!codec::valid(type) || !codec::uncompress(static_cast<codec::Type>(type), begin, length, scratch))
+      return false;
+    *data = muduo::StringPiece(scratch->data(), static_cast<int>(scratch->size()));
+  }
+  else
+  {
+    *data = muduo::StringPiece(begin, static_cast<int>(length));
+  }
+  return true;
+}
+
+bool frame::decode(muduo::net::Buffer *buf, std::string *scratch, Handler *handler)
+{
+  bool ok = true;
+  Header header;
+  Status status = kIncomplete;
+  while(ok && (status = peek(buf, &header)) == kComplete)
+  {
+    int type = header.flags & kCodecMask;
+    muduo::StringPiece data;
+    if(type != codec::kNone && !handler->accepts(type))
+    {
+      LOG_ERROR << "frame of codec " << type << " not negotiated";
+      ok = false;
+    }
+    else if(!payload(buf, header, scratch, &data))
+    {
+      LOG_ERROR << "uncompress frame error!";
+      ok = false;
+    }
+    else if(!handler->onFrame(header, data))
+    {
+      break;
+    }
+    else
+    {
+      buf->retrieve(kHeaderLength + header.length);
+    }
+  }
+  if(ok && status == kOversized)
+  {
+    LOG_ERROR << "frame too large " << header.length;
+    ok = false;
+  }
+  if(scratch->capacity() > kMaxScratch)
+    std::string().swap(*scratch);
+  return ok;
+}
+
+uint32_t frame::stream_id(const muduo::net::Buffer *buf)
+{
+  uint32_t be32;
+  ::memcpy(&be32, buf->peek() + kHeaderLength, sizeof(be32));
+  return muduo::net::sockets::networkToHost32(be32);
+}
+
+void frame::prepend_header(muduo::net::Buffer *buf, Type type, uint8_t flags)
+{
+  char header[kHeaderLength];
+  encode_header(header, static_cast<uint32_t>(buf->readableBytes()), static_cast<uint8_t>(type), flags);
+  buf->prepend(header, sizeof(header));
+}
+
+void frame::append(muduo::net::Buffer *buf, Type type, const char *data, size_t len, uint8_t flags)
+{
+  char header[kHeaderLength];
+  encode_header(header, static_cast<uint32_t>(len), static_cast<uint8_t>(type), flags);
+  buf->append(header, sizeof(header));
+  buf->append(data, len);
+}
+
+void frame::append_stream(muduo::net::Buffer *buf, uint32_t stream_id, const char *data, size_t len, uint8_t flags)
+{
+  char header[kHeaderLength + sizeof(uint32_t)];
+  encode_header(header, static_cast<uint32_t>(sizeof(uint32_t) + len), kStreamData, flags);
+  uint32_t be32 = muduo::net::sockets::hostToNetwork32(stream_id);
+  ::memcpy(header + kHeaderLength, &be32, sizeof(be32));
+  buf->append(header, sizeof(header));
+  buf->append(data, len);
+}
+
+void frame::append_datagram(muduo::net::Buffer *buf, const char *addr, size_t addr_len, const char *data, size_t len)
+{
+  char header[kHeaderLength];
+  encode_header(header, static_cast<uint32_t>(addr_len + len), kDatagram, 0);
+  buf->append(header, sizeof(header));
+  buf->append(addr, addr_len);
+  buf->append(data, len);
+}
+
+void frame::append_message(muduo::net::Buffer *buf, const google::protobuf::Message &message)
+{
+  size_t length = message.ByteSizeLong();
+  char header[kHeaderLength];
+  encode_header(header, static_cast<uint32_t>(length), kMessage, 0);
+  buf->append(header, sizeof(header));
+  buf->ensureWritableBytes(length);
+  message.SerializeWithCachedSizesToArray(reinterpret_cast<uint8_t*>(buf->beginWrite()));
+  buf->hasWritten(length);
+}
\ No newline at end of file
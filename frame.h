@@ -0,0 +1,108 @@
+#pragma once
+
+#include <muduo/base/StringPiece.h>
+#include <muduo/net/Buffer.h>
+#include <stdint.h>
+#include <string>
+
+namespace google
+{
+namespace protobuf
+{
+class Message;
+}
+}
+
+namespace zy
+{
+// every frame between local_server and socks_server starts with a fixed header
+//   uint32_t length; // payload length, network byte order
+//   uint8_t type;
+//   uint8_t flags;
+//   uint16_t reserved;
+// protobuf is only used for the payload of kMessage frames, payload data is carried raw
+namespace frame
+{
+enum Type
+{
+  kMessage = 1, // ClientMsg or ServerMsg
+  kData = 2, // payload data of a tunnel
+  kStreamData = 3, // uint32_t stream id in network byte order, then payload data of the stream
+  // one datagram of a udp association, address as in socks5 udp requests, atyp, address
+  // and port in network byte order, then the payload, the address is the target from
+  // local_server and the sender from socks_server
+  kDatagram = 4
+};
+
+enum Flag
+{
+  kCodecMask = 0x07 // codec::Type of the payload data, the stream id is never compressed
+};
+
+const size_t kHeaderLength = 8;
+
+// a frame never gets larger than this, or the peer is broken
+const uint32_t kMaxLength = 64 * 1024 * 1024;
+
+// scratch larger than this is given back after use, a few huge frames should not pin memory
+const size_t kMaxScratch = 4 * 1024 * 1024;
+
+static_assert(kHeaderLength <= muduo::net::Buffer::kCheapPrepend, "header should fit in cheap prepend of Buffer");
+
+struct Header
+{
+  uint32_t length;
+  uint8_t type;
+  uint8_t flags;
+};
+
+enum Status
+{
+  kIncomplete,
+  kComplete, // a whole frame is readable
+  kOversized // the header says more than kMaxLength, the connection should go
+};
+
+// the header at the front of buf, the buffer is not retrieved
+Status peek(const muduo::net::Buffer* buf, Header* header);
+
+// payload data of the frame at the front of buf, after the stream id of a kStreamData frame,
+// uncompressed into scratch if needed, false if it is corrupted,
+// caller retrieves kHeaderLength + header.length after use
+bool payload(const muduo::net::Buffer* buf, const Header& header, std::string* scratch, muduo::StringPiece* data);
+
+// what decode does with the frames of a connection
+class Handler
+{
+ public:
+  virtual ~Handler() = default;
+
+  // asked before anything of this codec is uncompressed
+  virtual bool accepts(int codec) = 0;
+
+  // the frame is at the front of the buffer, payload points into it or into scratch,
+  // false stops decoding and leaves the frame unless the handler retrieved it
+  virtual bool onFrame(const Header& header, const muduo::StringPiece& payload) = 0;
+};
+
+// hand every whole frame of buf to handler and retrieve it, compressed payload is uncompressed
+// into scratch, which keeps its capacity up to kMaxScratch, so decoding allocates nothing once
+// warmed up. false if the peer is broken, buf is left as it is then
+bool decode(muduo::net::Buffer* buf, std::string* scratch, Handler* handler);
+
+// stream id of the kStreamData frame at the front of buf
+uint32_t stream_id(const muduo::net::Buffer* buf);
+
+// turn all readable bytes of buf into one frame in place, no copy
+void prepend_header(muduo::net::Buffer* buf, Type type, uint8_t flags = 0);
+
+// data is already encoded as flags says, see Compressor
+void append(muduo::net::Buffer* buf, Type type, const char* data, size_t len, uint8_t flags = 0);
+
+void append_stream(muduo::net::Buffer* buf, uint32_t stream_id, const char* data, size_t len, uint8_t flags = 0);
+
+void append_datagram(muduo::net::Buffer* buf, const char* addr, size_t addr_len, const char* data, size_t len);
+
+void append_message(muduo::net::Buffer* buf, const google::protobuf::Message& message);
+}
+}
\ No newline at end of file
@@ -0,0 +1,316 @@
+#include "happy_eyeballs.h"
+#include "log_rate.h"
+#include "stats.h"
+
+#include <muduo/net/Channel.h>
+#include <muduo/net/EventLoop.h>
+#include <muduo/net/TcpConnection.h>
+#include <muduo/base/Logging.h>
+#include <boost/bind.hpp>
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+using namespace zy;
+
+namespace
+{
+socklen_t sockaddr_length(const struct sockaddr* addr)
+{
+  return addr->sa_family == AF_INET6 ? sizeof(struct sockaddr_in6) : sizeof(struct sockaddr_in);
+}
+
+muduo::net::InetAddress socket_address(int sockfd, bool peer)
+{
+  struct sockaddr_in6 addr;
+  socklen_t len = sizeof addr;
+  ::memset(&addr, 0, sizeof addr);
+  auto sa = reinterpret_cast<struct sockaddr*>(&addr);
+  if((peer ? ::getpeername(sockfd, sa, &len) : ::getsockname(sockfd, sa, &len)) < 0)
+    LOG_SYSERR << (peer ? "getpeername" : "getsockname");
+  if(addr.sin6_family == AF_INET)
+    return muduo::net::InetAddress(*reinterpret_cast<struct sockaddr_in*>(&addr));
+  return muduo::net::InetAddress(addr);
+}
+
+// a connect to a port of this host in the ephemeral range may connect to itself
+bool is_self_connect(int sockfd)
+{
+  auto local = socket_address(sockfd, false);
+  auto peer = socket_address(sockfd, true);
+  return local.toIpPort() == peer.toIpPort();
+}
+
+// the peer acked the data sent in the syn
+bool syn_data(int sockfd)
+{
+  struct tcp_info info;
+  socklen_t len = sizeof info;
+  ::memset(&info, 0, sizeof info);
+  return ::getsockopt(sockfd, IPPROTO_TCP, TCP_INFO, &info, &len) == 0 && (info.tcpi_options & TCPI_OPT_SYN_DATA);
+}
+
+void release_channel(const boost::shared_ptr<muduo::net::Channel>&)
+{
+}
+}
+
+constexpr double HappyEyeballs::kAttemptDelay;
+
+HappyEyeballs::HappyEyeballs(muduo::net::EventLoop *loop,
+                             const AddressList &addresses,
+                             const muduo::string &name)
+    : loop_(loop),
+      addresses_(addresses),
+      name_(name),
+      attempts_(),
+      timerId_(),
+      timerActive_(false),
+      stopped_(false),
+      attempt_delay_(kAttemptDelay),
+      winnerFd_(-1),
+      fast_open_data_(),
+      fastOpenSent_(0),
+      connection_(),
+      connectionCallback_(),
+      messageCallback_(),
+      winnerCallback_(),
+      failCallback_()
+{
+
+}
+
+HappyEyeballs::~HappyEyeballs()
+{
+  stop();
+  // callbacks of the connection are bound to weak pointers, they do nothing from now on
+  if(connection_)
+    connection_->forceClose();
+}
+
+void HappyEyeballs::connect()
+{
+  if(addresses_.empty())
+  {
+    LOG_ERROR << name_ << " has no address to connect";
+    if(failCallback_)
+      failCallback_();
+    return;
+  }
+  start_attempt();
+}
+
+void HappyEyeballs::stop()
+{
+  stopped_ = true;
+  if(timerActive_)
+  {
+    loop_->cancel(timerId_);
+    timerActive_ = false;
+  }
+  for(size_t i = 0; i < attempts_.size(); ++i)
+    close_attempt(i, true);
+}
+
+void HappyEyeballs::start_attempt()
+{
+  if(timerActive_)
+  {
+    loop_->cancel(timerId_);
+    timerActive_ = false;
+  }
+  if(stopped_ || attempts_.size() >= addresses_.size())
+    return;
+  size_t index = attempts_.size();
+  attempts_.push_back(Attempt());
+  const muduo::net::InetAddress& addr = addresses_[index];
+  LOG_DEBUG << name_ << " attempt " << index << " to " << addr.toIpPort();
+
+  int sockfd = ::socket(addr.family(), SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, IPPROTO_TCP);
+  if(sockfd < 0)
+  {
+    LOG_SYSERR << name_ << " socket";
+    onFailed(index);
+    return;
+  }
+  attempts_[index].fd = sockfd;
+  int saved_errno = EOPNOTSUPP;
+  if(!fast_open_data_.empty())
+  {
+    // connects like connect(2) and puts as much data in the syn as the cookie allows,
+    // without a cookie nothing is sent and the handshake goes on as usual
+    ssize_t n = ::sendto(sockfd, fast_open_data_.data(), fast_open_data_.size(), MSG_FASTOPEN | MSG_NOSIGNAL,
+                         addr.getSockAddr(), sockaddr_length(addr.getSockAddr()));
+    saved_errno = n >= 0 ? EINPROGRESS : errno;
+    attempts_[index].fast_open = true;
+    attempts_[index].sent = n > 0 ? static_cast<size_t>(n) : 0;
+  }
+  // fast open is not enabled for clients by the kernel, or not asked for
+  if(saved_errno == EOPNOTSUPP)
+  {
+    int ret = ::connect(sockfd, addr.getSockAddr(), sockaddr_length(addr.getSockAddr()));
+    saved_errno = ret == 0 ? 0 : errno;
+  }
+  if(saved_errno != 0 && saved_errno != EINPROGRESS && saved_errno != EINTR)
+  {
+    LOG_WARN_LIMITED(10) << name_ << " connect to " << addr.toIpPort() << " failed: " << strerror(saved_errno);
+    onFailed(index);
+    return;
+  }
+  ChannelPtr channel(new muduo::net::Channel(loop_, sockfd));
+  channel->tie(shared_from_this());
+  channel->setWriteCallback(boost::bind(&HappyEyeballs::onWritable, this, index));
+  channel->setErrorCallback(boost::bind(&HappyEyeballs::onWritable, this, index));
+  channel->enableWriting();
+  attempts_[index].channel = channel;
+  if(attempts_.size() < addresses_.size())
+  {
+    timerActive_ = true;
+    timerId_ = loop_->runAfter(attempt_delay_,
+                               boost::bind(&HappyEyeballs::onAttemptWeak, wkHappyEyeballs(shared_from_this())));
+  }
+}
+
+void HappyEyeballs::onWritable(size_t index)
+{
+  int sockfd = attempts_[index].fd;
+  if(sockfd < 0)
+    return;
+  int err = 0;
+  socklen_t len = sizeof err;
+  if(::getsockopt(sockfd, SOL_SOCKET, SO_ERROR, &err, &len) < 0)
+    err = errno;
+  if(err)
+  {
+    LOG_WARN_LIMITED(10) << name_ << " connect to " << addresses_[index].toIpPort() << " failed: " << strerror(err);
+    onFailed(index);
+  }
+  else if(is_self_connect(sockfd))
+  {
+    LOG_WARN_LIMITED(10) << name_ << " self connect";
+    onFailed(index);
+  }
+  else
+  {
+    onConnected(index);
+  }
+}
+
+void HappyEyeballs::onConnected(size_t index)
+{
+  int sockfd = attempts_[index].fd;
+  // the connection owns the fd from now on
+  bool fast_open = attempts_[index].fast_open;
+  fastOpenSent_ = attempts_[index].sent;
+  close_attempt(index, false);
+  stop();
+  winnerFd_ = sockfd;
+  if(fast_open)
+    stats::add(fastOpenSent_ > 0 && syn_data(sockfd) ? stats::kTfoConnects : stats::kTfoFallbacks);
+  const muduo::net::InetAddress& addr = addresses_[index];
+  LOG_DEBUG << name_ << " attempt " << index << " to " << addr.toIpPort() << " won";
+
+  char buf[32];
+  snprintf(buf, sizeof buf, "#%d", sockfd);
+  muduo::net::TcpConnectionPtr con(
+      new muduo::net::TcpConnection(loop_, name_ + buf, sockfd, socket_address(sockfd, false), addr));
+  wkHappyEyeballs self(shared_from_this());
+  con->setConnectionCallback(boost::bind(&HappyEyeballs::onConnectionWeak, self, _1));
+  con->setMessageCallback(boost::bind(&HappyEyeballs::onMessageWeak, self, _1, _2, _3));
+  con->setCloseCallback(boost::bind(&HappyEyeballs::removeConnection, loop_, _1));
+  connection_ = con;
+  if(winnerCallback_)
+    winnerCallback_(addr);
+  con->connectEstablished();
+}
+
+void HappyEyeballs::onFailed(size_t index)
+{
+  close_attempt(index, true);
+  if(attempts_.size() < addresses_.size())
+  {
+    // no need to wait for the delay, the next one goes now
+    start_attempt();
+    return;
+  }
+  for(const auto& attempt : attempts_)
+  {
+    if(attempt.fd >= 0)
+      return;
+  }
+  LOG_WARN_LIMITED(10) << name_ << " all " << addresses_.size() << " addresses failed";
+  if(!stopped_ && failCallback_)
+    failCallback_();
+}
+
+void HappyEyeballs::close_attempt(size_t index, bool close_fd)
+{
+  auto& attempt = attempts_[index];
+  if(attempt.channel)
+  {
+    attempt.channel->disableAll();
+    attempt.channel->remove();
+    // may be in the middle of its handleEvent
+    loop_->queueInLoop(boost::bind(&release_channel, attempt.channel));
+    attempt.channel.reset();
+  }
+  if(attempt.fd >= 0 && close_fd)
+    ::close(attempt.fd);
+  attempt.fd = -1;
+}
+
+void HappyEyeballs::onConnection(const muduo::net::TcpConnectionPtr &con)
+{
+  if(connectionCallback_)
+    connectionCallback_(con);
+  if(!con->connected())
+    connection_.reset();
+}
+
+void HappyEyeballs::onMessage(const muduo::net::TcpConnectionPtr &con,
+                              muduo::net::Buffer *buf,
+                              muduo::Timestamp receiveTime)
+{
+  if(messageCallback_)
+    messageCallback_(con, buf, receiveTime);
+  else
+    buf->retrieveAll();
+}
+
+void HappyEyeballs::onAttemptWeak(const wkHappyEyeballs &connector)
+{
+  auto self = connector.lock();
+  if(self)
+  {
+    self->timerActive_ = false;
+    self->start_attempt();
+  }
+}
+
+void HappyEyeballs::onConnectionWeak(const wkHappyEyeballs &connector, const muduo::net::TcpConnectionPtr &con)
+{
+  auto self = connector.lock();
+  if(self)
+    self->onConnection(con);
+}
+
+void HappyEyeballs::onMessageWeak(const wkHappyEyeballs &connector,
+                                  const muduo::net::TcpConnectionPtr &con,
+                                  muduo::net::Buffer *buf,
+                                  muduo::Timestamp receiveTime)
+{
+  auto self = connector.lock();
+  if(self)
+    self->onMessage(con, buf, receiveTime);
+  else
+    buf->retrieveAll();
+}
+
+void HappyEyeballs::removeConnection(muduo::net::EventLoop *loop, const muduo::net::TcpConnectionPtr &con)
+{
+  loop->queueInLoop(boost::bind(&muduo::net::TcpConnection::connectDestroyed, con));
+}
\ No newline at end of file
@@ -0,0 +1,132 @@
+#pragma once
+
+#include <muduo/net/Callbacks.h>
+#include <muduo/net/InetAddress.h>
+#include <muduo/net/TimerId.h>
+#include <boost/enable_shared_from_this.hpp>
+#include <boost/noncopyable.hpp>
+#include <string>
+#include <vector>
+
+namespace muduo
+{
+namespace net
+{
+class Channel;
+class EventLoop;
+}
+}
+
+namespace zy
+{
+// connect to every address of a host in the way of RFC 8305, attempts start
+// attempt_delay apart in the given order, or right after the previous one fails,
+// the first connected one wins and the others are dropped
+class HappyEyeballs : boost::noncopyable, public boost::enable_shared_from_this<HappyEyeballs>
+{
+ public:
+  typedef std::vector<muduo::net::InetAddress> AddressList;
+  typedef boost::function<void(const muduo::net::InetAddress&)> WinnerCallback;
+  typedef boost::function<void()> FailCallback;
+
+  // delay between attempts recommended by RFC 8305
+  static constexpr double kAttemptDelay = 0.25;
+
+  HappyEyeballs(muduo::net::EventLoop* loop, const AddressList& addresses, const muduo::string& name);
+
+  ~HappyEyeballs();
+
+  // called when the winner is up and when it is down
+  void setConnectionCallback(const muduo::net::ConnectionCallback& cb) { connectionCallback_ = cb; }
+
+  void setMessageCallback(const muduo::net::MessageCallback& cb) { messageCallback_ = cb; }
+
+  // called with the address of the winner before the connection callback
+  void setWinnerCallback(const WinnerCallback& cb) { winnerCallback_ = cb; }
+
+  // called when every attempt failed
+  void setFailCallback(const FailCallback& cb) { failCallback_ = cb; }
+
+  void set_attempt_delay(double delay) { attempt_delay_ = delay; }
+
+  // sent in the syn of every attempt with tcp fast open, or after a full handshake when
+  // there is no cookie of the peer yet, must be set before connect
+  void set_fast_open_data(const std::string& data) { fast_open_data_ = data; }
+
+  // bytes of the fast open data the winner has sent already, the rest is up to the caller
+  size_t fast_open_sent() const { return fastOpenSent_; }
+
+  // established connection of the winner, null before
+  const muduo::net::TcpConnectionPtr& connection() const { return connection_; }
+
+  // must be held by a shared_ptr
+  void connect();
+
+  // give up the attempts still connecting
+  void stop();
+
+  // socket of the winner, -1 before it is connected
+  int fd() const { return winnerFd_; }
+
+ private:
+  typedef boost::shared_ptr<muduo::net::Channel> ChannelPtr;
+  typedef boost::weak_ptr<HappyEyeballs> wkHappyEyeballs;
+
+  struct Attempt
+  {
+    Attempt()
+        : fd(-1),
+          channel(),
+          fast_open(false),
+          sent(0)
+    { }
+
+    int fd; // -1 once finished
+    ChannelPtr channel;
+    bool fast_open; // the syn was sent by sendto(2) with MSG_FASTOPEN
+    size_t sent; // of the fast open data
+
+  };
+
+  void start_attempt();
+
+  void onWritable(size_t index);
+
+  void onConnected(size_t index);
+
+  void onFailed(size_t index);
+
+  void close_attempt(size_t index, bool close_fd);
+
+  void onConnection(const muduo::net::TcpConnectionPtr& con);
+
+  void onMessage(const muduo::net::TcpConnectionPtr& con, muduo::net::Buffer* buf, muduo::Timestamp receiveTime);
+
+  static void onAttemptWeak(const wkHappyEyeballs& connector);
+
+  static void onConnectionWeak(const wkHappyEyeballs& connector, const muduo::net::TcpConnectionPtr& con);
+
+  static void onMessageWeak(const wkHappyEyeballs& connector, const muduo::net::TcpConnectionPtr& con,
+                            muduo::net::Buffer* buf, muduo::Timestamp receiveTime);
+
+  static void removeConnection(muduo::net::EventLoop* loop, const muduo::net::TcpConnectionPtr& con);
+
+  muduo::net::EventLoop* loop_;
+  AddressList addresses_;
+  muduo::string name_;
+  std::vector<Attempt> attempts_;
+  muduo::net::TimerId timerId_;
+  bool timerActive_;
+  bool stopped_;
+  double attempt_delay_;
+  int winnerFd_;
+  std::string fast_open_data_;
+  size_t fastOpenSent_;
+  muduo::net::TcpConnectionPtr connection_;
+  muduo::net::ConnectionCallback connectionCallback_;
+  muduo::net::MessageCallback messageCallback_;
+  WinnerCallback winnerCallback_;
+  FailCallback failCallback_;
+};
+typedef boost::shared_ptr<HappyEyeballs> HappyEyeballsPtr;
+}
\ No newline at end of file
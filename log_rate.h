@@ -0,0 +1,48 @@
+#pragma once
+
+#include "stats.h"
+
+#include <muduo/base/Logging.h>
+#include <time.h>
+
+namespace zy
+{
+// per connection log lines, LOG_INFO_LIMITED(n) and friends log the first n lines of a
+// call site in every second of a thread, the rest are counted in stats::kLogSuppressed,
+// so a connection storm does not turn into a log storm
+namespace logging
+{
+struct Rate
+{
+  time_t second;
+  int count;
+};
+
+inline bool allow(Rate* rate, int per_second)
+{
+  time_t now = ::time(NULL);
+  if(now != rate->second)
+  {
+    rate->second = now;
+    rate->count = 0;
+  }
+  if(rate->count < per_second)
+  {
+    ++rate->count;
+    return true;
+  }
+  stats::add(stats::kLogSuppressed);
+  return false;
+}
+}
+}
+
+#define LOG_LIMITED(level, per_second) \
+  if(muduo::Logger::logLevel() <= muduo::Logger::level \
+     && zy::logging::allow([]() -> zy::logging::Rate* { static __thread zy::logging::Rate rate; return &rate; }(), \
+                           per_second)) \
+    muduo::Logger(__FILE__, __LINE__, muduo::Logger::level, __func__).stream()
+
+#define LOG_INFO_LIMITED(per_second) LOG_LIMITED(INFO, per_second)
+#define LOG_WARN_LIMITED(per_second) LOG_LIMITED(WARN, per_second)
+#define LOG_ERROR_LIMITED(per_second) LOG_LIMITED(ERROR, per_second)
\ No newline at end of file
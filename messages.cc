@@ -0,0 +1,36 @@
+#include "messages.h"
+
+using namespace zy;
+
+namespace
+{
+// never freed, like the zstd contexts of codec.cc, io threads live as long as the process
+__thread msg::ClientMsg* t_client_msg = nullptr;
+__thread msg::ServerMsg* t_server_msg = nullptr;
+__thread muduo::net::Buffer* t_output = nullptr;
+}
+
+msg::ClientMsg& messages::client_msg()
+{
+  if(!t_client_msg)
+    t_client_msg = new msg::ClientMsg;
+  t_client_msg->Clear();
+  return *t_client_msg;
+}
+
+msg::ServerMsg& messages::server_msg()
+{
+  if(!t_server_msg)
+    t_server_msg = new msg::ServerMsg;
+  t_server_msg->Clear();
+  return *t_server_msg;
+}
+
+muduo::net::Buffer& messages::output()
+{
+  if(!t_output)
+    t_output = new muduo::net::Buffer;
+  // send() leaves the buffer alone if the connection is down
+  t_output->retrieveAll();
+  return *t_output;
+}
\ No newline at end of file
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <client.pb.h>
+#include <muduo/net/Buffer.h>
+#include <server.pb.h>
+
+namespace zy
+{
+// protobuf messages of the calling thread, reused by every handshake of its loop,
+// Clear() keeps the nested request or response and the capacity of strings,
+// so building or parsing one allocates nothing once warmed up,
+// a message is only valid until the next call in the same thread
+namespace messages
+{
+// cleared
+msg::ClientMsg& client_msg();
+
+msg::ServerMsg& server_msg();
+
+// empty output buffer to serialize into, TcpConnection::send(Buffer*) retrieves all of it
+muduo::net::Buffer& output();
+}
+}
\ No newline at end of file
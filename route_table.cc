@@ -0,0 +1,401 @@
+#include "route_table.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <algorithm>
+#include <fstream>
+#include <new>
+#include <sstream>
+#include <string.h>
+
+using namespace zy;
+
+namespace
+{
+inline char lower(char c)
+{
+  return c >= 'A' && c <= 'Z' ? static_cast<char>(c + ('a' - 'A')) : c;
+}
+
+// 16 bytes in network byte order
+inline unsigned __int128 to_uint128(const uint8_t* bytes)
+{
+  unsigned __int128 value = 0;
+  for(int i = 0; i < 16; ++i)
+    value = (value << 8) | bytes[i];
+  return value;
+}
+}
+
+RouteTable::RouteTable()
+  : domains_(),
+    table_(),
+    mask_(0),
+    labels_(),
+    v4_(),
+    v6_(),
+    domain_rules_(0),
+    cidr_rules_(0)
+{
+
+}
+
+bool RouteTable::load(const std::string &path, std::string *error)
+{
+  std::ifstream file(path.c_str());
+  if(!file)
+  {
+    *error = "can't open " + path;
+    return false;
+  }
+  std::string line;
+  int line_no = 0;
+  while(std::getline(file, line))
+  {
+    ++line_no;
+    if(!add_rule(line, error))
+    {
+      std::ostringstream os;
+      os << path << ":" << line_no << " " << *error;
+      *error = os.str();
+      return false;
+    }
+  }
+  compile();
+  return true;
+}
+
+bool RouteTable::add_rule(const std::string &line, std::string *error)
+{
+  std::istringstream is(line.substr(0, line.find('#')));
+  std::string first, second, rest;
+  is >> first >> second >> rest;
+  if(first.empty())
+    return true;
+  if(!rest.empty())
+  {
+    *error = "too many fields";
+    return false;
+  }
+  Route route = kDirect;
+  std::string pattern = first;
+  if(!second.empty())
+  {
+    if(first == "direct")
+      route = kDirect;
+    else if(first == "proxy")
+      route = kProxy;
+    else
+    {
+      *error = "unknown route " + first;
+      return false;
+    }
+    pattern = second;
+  }
+  // anything with a colon or a slash is a cidr, a domain never ends with a digit
+  bool cidr = pattern.find_first_of(":/") != std::string::npos || ::isdigit(static_cast<unsigned char>(pattern.back()));
+  if(cidr ? !add_cidr(pattern, route) : !add_domain(pattern, route))
+  {
+    *error = "invalid pattern " + pattern;
+    return false;
+  }
+  return true;
+}
+
+bool RouteTable::add_domain(const std::string &suffix, Route route)
+{
+  std::string domain = suffix;
+  if(domain.compare(0, 2, "*.") == 0)
+    domain.erase(0, 2);
+  else if(!domain.empty() && domain[0] == '.')
+    domain.erase(0, 1);
+  if(!domain.empty() && domain.back() == '.')
+    domain.pop_back();
+  if(domain.empty() || domain.size() > 253)
+    return false;
+  size_t label_len = 0;
+  for(char& c : domain)
+  {
+    c = lower(c);
+    if(c == '.')
+    {
+      if(label_len == 0)
+        return false;
+      label_len = 0;
+    }
+    else if(++label_len > 63)
+    {
+      return false;
+    }
+  }
+  if(label_len == 0)
+    return false;
+  // a later rule of the same domain wins
+  domains_[domain] = static_cast<uint8_t>(route + 1);
+  ++domain_rules_;
+  return true;
+}
+
+bool RouteTable::add_cidr(const std::string &cidr, Route route)
+{
+  size_t slash = cidr.find('/');
+  std::string ip = cidr.substr(0, slash);
+  bool v6 = ip.find(':') != std::string::npos;
+  int max_len = v6 ? 128 : 32;
+  int prefix_len = max_len;
+  if(slash != std::string::npos)
+  {
+    const char* start = cidr.c_str() + slash + 1;
+    char* end = nullptr;
+    long len = ::strtol(start, &end, 10);
+    if(end == start || *end != '\0' || len < 0 || len > max_len)
+      return false;
+    prefix_len = static_cast<int>(len);
+  }
+  uint8_t route_byte = static_cast<uint8_t>(route + 1);
+  if(v6)
+  {
+    struct in6_addr addr;
+    if(::inet_pton(AF_INET6, ip.c_str(), &addr) != 1)
+      return false;
+    uint128_t mask = prefix_len == 0 ? 0 : ~static_cast<uint128_t>(0) << (128 - prefix_len);
+    uint128_t first = to_uint128(addr.s6_addr) & mask;
+    v6_.push_back(Range<uint128_t>{first, first | ~mask, route_byte});
+  }
+  else
+  {
+    struct in_addr addr;
+    if(::inet_pton(AF_INET, ip.c_str(), &addr) != 1)
+      return false;
+    uint32_t mask = prefix_len == 0 ? 0 : ~static_cast<uint32_t>(0) << (32 - prefix_len);
+    uint32_t first = ntohl(addr.s_addr) & mask;
+    v4_.push_back(Range<uint32_t>{first, first | ~mask, route_byte});
+  }
+  ++cidr_rules_;
+  return true;
+}
+
+uint32_t RouteTable::hash_label(const char *label, size_t len)
+{
+  // fnv-1a, case folded
+  uint32_t hash = 2166136261u;
+  for(size_t i = 0; i < len; ++i)
+  {
+    hash ^= static_cast<uint8_t>(lower(label[i]));
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
+bool RouteTable::same_label(const RouteTable::Edge &edge, const char *label, size_t len) const
+{
+  if(edge.len != len)
+    return false;
+  const char* stored = edge.label;
+  if(len > kInlineLabel)
+  {
+    uint32_t offset;
+    ::memcpy(&offset, edge.label, sizeof offset);
+    stored = &labels_[offset];
+  }
+  for(size_t i = 0; i < len; ++i)
+  {
+    if(stored[i] != lower(label[i]))
+      return false;
+  }
+  return true;
+}
+
+void RouteTable::compile()
+{
+  // build the trie with a map keyed by parent node and label, then lay its edges out,
+  // the edge to node n is edges[n - 1]
+  std::unordered_map<std::string, uint32_t> children;
+  std::vector<Edge> edges;
+  labels_.clear();
+  for(const auto& item : domains_)
+  {
+    const std::string& domain = item.first;
+    uint32_t node = 0;
+    size_t end = domain.size();
+    while(true)
+    {
+      size_t dot = domain.rfind('.', end - 1);
+      size_t start = dot == std::string::npos ? 0 : dot + 1;
+      std::string key(reinterpret_cast<const char*>(&node), sizeof node);
+      key.append(domain, start, end - start);
+      auto it = children.find(key);
+      if(it == children.end())
+      {
+        size_t len = end - start;
+        Edge edge;
+        ::memset(&edge, 0, sizeof edge);
+        edge.parent = node;
+        edge.hash = hash_label(domain.data() + start, len);
+        edge.child = static_cast<uint32_t>(edges.size() + 1);
+        edge.len = static_cast<uint8_t>(len);
+        if(len <= kInlineLabel)
+        {
+          ::memcpy(edge.label, domain.data() + start, len);
+        }
+        else
+        {
+          uint32_t offset = static_cast<uint32_t>(labels_.size());
+          ::memcpy(edge.label, &offset, sizeof offset);
+          labels_.append(domain, start, len);
+        }
+        edges.push_back(edge);
+        it = children.insert(std::make_pair(key, edge.child)).first;
+      }
+      node = it->second;
+      if(start == 0)
+        break;
+      end = start - 1;
+    }
+    edges[node - 1].route = item.second;
+  }
+  std::unordered_map<std::string, uint8_t>().swap(domains_);
+
+  // at most half full, probes stay short
+  size_t size = 16;
+  while(size < edges.size() * 2)
+    size <<= 1;
+  void* table = nullptr;
+  if(::posix_memalign(&table, 64, size * sizeof(Edge)) != 0)
+    throw std::bad_alloc();
+  ::memset(table, 0, size * sizeof(Edge));
+  table_.reset(static_cast<Edge*>(table));
+  mask_ = size - 1;
+  for(const auto& edge : edges)
+  {
+    size_t i = slot(edge.parent, edge.hash);
+    while(table_[i].child)
+      i = (i + 1) & mask_;
+    table_[i] = edge;
+  }
+
+  flatten(&v4_);
+  flatten(&v6_);
+}
+
+template<typename T>
+void RouteTable::flatten(std::vector<Range<T>> *ranges)
+{
+  // wider first for the same start, so a prefix comes right before the ones nested in it,
+  // and stable so of two equal prefixes the later rule is the inner one
+  std::stable_sort(ranges->begin(), ranges->end(), [](const Range<T>& a, const Range<T>& b)
+  {
+    return a.first < b.first || (a.first == b.first && a.last > b.last);
+  });
+  const T max = static_cast<T>(~static_cast<T>(0));
+  std::vector<Range<T>> out;
+  std::vector<Range<T>> open; // prefixes the cursor is in, innermost last
+  T cursor = 0;
+  auto emit = [&out](T first, T last, uint8_t route)
+  {
+    if(first > last)
+      return;
+    if(!out.empty() && out.back().route == route && out.back().last + 1 == first)
+      out.back().last = last;
+    else
+      out.push_back(Range<T>{first, last, route});
+  };
+  for(const auto& range : *ranges)
+  {
+    while(!open.empty() && open.back().last < range.first)
+    {
+      emit(cursor, open.back().last, open.back().route);
+      cursor = open.back().last + 1;
+      open.pop_back();
+    }
+    if(!open.empty() && cursor < range.first)
+      emit(cursor, range.first - 1, open.back().route);
+    cursor = range.first;
+    open.push_back(range);
+  }
+  while(!open.empty())
+  {
+    emit(cursor, open.back().last, open.back().route);
+    // everything still open ends at the top of the address space as well
+    if(open.back().last == max)
+      break;
+    cursor = open.back().last + 1;
+    open.pop_back();
+  }
+  ranges->swap(out);
+}
+
+template<typename T>
+uint8_t RouteTable::lookup(const std::vector<Range<T>> &ranges, T addr)
+{
+  auto it = std::upper_bound(ranges.begin(), ranges.end(), addr, [](T value, const Range<T>& range)
+  {
+    return value < range.first;
+  });
+  if(it == ranges.begin())
+    return 0;
+  --it;
+  return addr <= it->last ? it->route : 0;
+}
+
+RouteTable::Route RouteTable::match_domain(const char *domain, size_t len) const
+{
+  if(len > 0 && domain[len - 1] == '.')
+    --len;
+  uint8_t best = 0;
+  uint32_t node = 0;
+  size_t end = len;
+  while(end > 0 && table_)
+  {
+    size_t start = end;
+    while(start > 0 && domain[start - 1] != '.')
+      --start;
+    const char* label = domain + start;
+    size_t label_len = end - start;
+    uint32_t hash = hash_label(label, label_len);
+    const Edge* found = nullptr;
+    for(size_t i = slot(node, hash); table_[i].child; i = (i + 1) & mask_)
+    {
+      const Edge& edge = table_[i];
+      if(edge.parent == node && edge.hash == hash && same_label(edge, label, label_len))
+      {
+        found = &edge;
+        break;
+      }
+    }
+    if(!found)
+      break;
+    node = found->child;
+    if(found->route)
+      best = found->route;
+    if(start == 0)
+      break;
+    end = start - 1;
+  }
+  return best ? static_cast<Route>(best - 1) : kProxy;
+}
+
+RouteTable::Route RouteTable::match_address(const muduo::net::InetAddress &addr) const
+{
+  uint8_t route = 0;
+  if(addr.family() == AF_INET)
+  {
+    const struct sockaddr_in* sin = reinterpret_cast<const struct sockaddr_in*>(addr.getSockAddr());
+    route = lookup(v4_, static_cast<uint32_t>(ntohl(sin->sin_addr.s_addr)));
+  }
+  else if(addr.family() == AF_INET6)
+  {
+    const struct sockaddr_in6* sin6 = reinterpret_cast<const struct sockaddr_in6*>(addr.getSockAddr());
+    if(IN6_IS_ADDR_V4MAPPED(&sin6->sin6_addr))
+    {
+      const uint8_t* bytes = sin6->sin6_addr.s6_addr + 12;
+      uint32_t v4 = static_cast<uint32_t>(bytes[0]) << 24 | bytes[1] << 16 | bytes[2] << 8 | bytes[3];
+      route = lookup(v4_, v4);
+    }
+    else
+    {
+      route = lookup(v6_, to_uint128(sin6->sin6_addr.s6_addr));
+    }
+  }
+  return route ? static_cast<Route>(route - 1) : kProxy;
+}
\ No newline at end of file
@@ -0,0 +1,111 @@
+#pragma once
+
+#include <muduo/net/InetAddress.h>
+#include <boost/noncopyable.hpp>
+#include <stdint.h>
+#include <stdlib.h>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace zy
+{
+// rules of local_server for where a connect goes, by domain suffix or cidr, the longest
+// match wins and what nothing matches goes through socks_server, rules are added and
+// compiled once, a compiled table is never modified and is shared by all loops
+//
+// domains become a trie of reversed labels, "www.example.com" walks com, example, www,
+// its edges sit in one open addressed table keyed by parent node and label, an edge holds
+// its label and the route of its child in half a cache line, so a lookup mostly costs one
+// cache miss per label, cidrs are flattened to sorted disjoint ranges for a binary search
+class RouteTable : boost::noncopyable
+{
+ public:
+  enum Route
+  {
+    kProxy,
+    kDirect
+  };
+
+  RouteTable();
+
+  // one rule per line, "direct example.com", "proxy 10.0.0.0/8", or a bare pattern for
+  // direct, a domain matches itself and its subdomains, '#' starts a comment
+  bool load(const std::string& path, std::string* error);
+
+  bool add_rule(const std::string& line, std::string* error);
+
+  // false if suffix is not a domain name, a leading "*." or "." is ignored
+  bool add_domain(const std::string& suffix, Route route);
+
+  // false if cidr is not an address with an optional prefix length
+  bool add_cidr(const std::string& cidr, Route route);
+
+  // must be called once after all rules are added, before any match
+  void compile();
+
+  Route match_domain(const char* domain, size_t len) const;
+
+  Route match_domain(const std::string& domain) const { return match_domain(domain.data(), domain.size()); }
+
+  Route match_address(const muduo::net::InetAddress& addr) const;
+
+  size_t domain_rules() const { return domain_rules_; }
+
+  size_t cidr_rules() const { return cidr_rules_; }
+
+ private:
+  typedef unsigned __int128 uint128_t;
+
+  // labels up to this long are kept in the edge, longer ones in labels_
+  static const size_t kInlineLabel = 18;
+
+  struct Edge
+  {
+    uint32_t parent;
+    uint32_t hash; // of the label
+    uint32_t child; // 0 for an empty slot, the root is nobody's child
+    uint8_t route; // of the child, Route + 1, 0 for none
+    uint8_t len; // of the label
+    char label[kInlineLabel]; // lowercase, or the offset of it in labels_ if longer
+  };
+  static_assert(sizeof(Edge) == 32, "edge is half a cache line");
+
+  struct FreeDeleter
+  {
+    void operator()(Edge* edges) const { ::free(edges); }
+  };
+
+  // a prefix before compile, a piece of the flattened ranges after
+  template<typename T>
+  struct Range
+  {
+    T first;
+    T last;
+    uint8_t route; // Route + 1, 0 for none
+  };
+
+  static uint32_t hash_label(const char* label, size_t len);
+
+  bool same_label(const Edge& edge, const char* label, size_t len) const;
+
+  size_t slot(uint32_t parent, uint32_t hash) const { return (hash ^ (parent * 0x9e3779b1u)) & mask_; }
+
+  // nested prefixes cut the ones they are in, so every address falls in one range at most
+  template<typename T>
+  static void flatten(std::vector<Range<T>>* ranges);
+
+  template<typename T>
+  static uint8_t lookup(const std::vector<Range<T>>& ranges, T addr);
+
+  std::unordered_map<std::string, uint8_t> domains_; // lowercase, until compile
+  std::unique_ptr<Edge[], FreeDeleter> table_; // aligned to cache lines
+  size_t mask_;
+  std::string labels_;
+  std::vector<Range<uint32_t>> v4_;
+  std::vector<Range<uint128_t>> v6_;
+  size_t domain_rules_;
+  size_t cidr_rules_;
+};
+}
\ No newline at end of file
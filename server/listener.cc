@@ -0,0 +1,207 @@
+#include "listener.h"
+#include "log_rate.h"
+#include "stats.h"
+
+#include <muduo/net/Channel.h>
+#include <muduo/net/EventLoop.h>
+#include <muduo/net/EventLoopThreadPool.h>
+#include <muduo/net/TcpConnection.h>
+#include <muduo/base/Logging.h>
+#include <boost/bind.hpp>
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/filter.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+using namespace zy;
+
+namespace
+{
+socklen_t sockaddr_length(const struct sockaddr* addr)
+{
+  return addr->sa_family == AF_INET6 ? sizeof(struct sockaddr_in6) : sizeof(struct sockaddr_in);
+}
+
+muduo::net::InetAddress local_address(int sockfd)
+{
+  struct sockaddr_in6 addr;
+  socklen_t len = sizeof addr;
+  ::memset(&addr, 0, sizeof addr);
+  if(::getsockname(sockfd, reinterpret_cast<struct sockaddr*>(&addr), &len) < 0)
+    LOG_SYSERR << "getsockname";
+  if(addr.sin6_family == AF_INET)
+    return muduo::net::InetAddress(*reinterpret_cast<struct sockaddr_in*>(&addr));
+  return muduo::net::InetAddress(addr);
+}
+
+// the connection came with data in its syn
+bool syn_data(int sockfd)
+{
+  struct tcp_info info;
+  socklen_t len = sizeof info;
+  ::memset(&info, 0, sizeof info);
+  return ::getsockopt(sockfd, IPPROTO_TCP, TCP_INFO, &info, &len) == 0 && (info.tcpi_options & TCPI_OPT_SYN_DATA);
+}
+}
+
+Listener::Listener(muduo::net::EventLoop *loop,
+                   const muduo::net::InetAddress &listenAddr,
+                   const muduo::string &name,
+                   bool reusePort)
+    : loop_(loop),
+      listenAddr_(listenAddr),
+      name_(name),
+      listenFd_(::socket(listenAddr.family(), SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, IPPROTO_TCP)),
+      idleFd_(::open("/dev/null", O_RDONLY | O_CLOEXEC)),
+      acceptChannel_(),
+      threadPool_(new muduo::net::EventLoopThreadPool(loop, name)),
+      threadInitCallback_(),
+      acceptCallback_(),
+      connectionCallback_(muduo::net::defaultConnectionCallback),
+      messageCallback_(muduo::net::defaultMessageCallback),
+      fastOpen_(0),
+      cpuSteering_(false),
+      started_(false),
+      nextConnId_(1),
+      connections_()
+{
+  if(listenFd_ < 0)
+  {
+    LOG_SYSFATAL << "Listener socket";
+  }
+  int on = 1;
+  ::setsockopt(listenFd_, SOL_SOCKET, SO_REUSEADDR, &on, sizeof on);
+  if(reusePort && ::setsockopt(listenFd_, SOL_SOCKET, SO_REUSEPORT, &on, sizeof on) < 0)
+  {
+    LOG_SYSFATAL << "Listener reuse port";
+  }
+  const struct sockaddr* addr = listenAddr_.getSockAddr();
+  if(::bind(listenFd_, addr, sockaddr_length(addr)) < 0)
+  {
+    LOG_SYSFATAL << "Listener bind " << listenAddr_.toIpPort();
+  }
+  acceptChannel_.reset(new muduo::net::Channel(loop_, listenFd_));
+  acceptChannel_->setReadCallback(boost::bind(&Listener::onAccept, this, _1));
+}
+
+Listener::~Listener()
+{
+  acceptChannel_->disableAll();
+  acceptChannel_->remove();
+  ::close(listenFd_);
+  ::close(idleFd_);
+  for(auto& item : connections_)
+  {
+    muduo::net::TcpConnectionPtr con(item.second);
+    item.second.reset();
+    con->getLoop()->runInLoop(boost::bind(&muduo::net::TcpConnection::connectDestroyed, con));
+  }
+}
+
+void Listener::setThreadNum(int threads)
+{
+  threadPool_->setThreadNum(threads);
+}
+
+void Listener::start()
+{
+  if(started_)
+    return;
+  started_ = true;
+  threadPool_->start(threadInitCallback_);
+  if(fastOpen_ > 0 && ::setsockopt(listenFd_, IPPROTO_TCP, TCP_FASTOPEN, &fastOpen_, sizeof fastOpen_) < 0)
+  {
+    LOG_SYSERR << "Listener fast open " << listenAddr_.toIpPort();
+  }
+  if(::listen(listenFd_, SOMAXCONN) < 0)
+  {
+    LOG_SYSFATAL << "Listener listen " << listenAddr_.toIpPort();
+  }
+  if(cpuSteering_)
+  {
+    // return the cpu id, the index of the listener in the group, out of range falls back to the hash
+    struct sock_filter code[] =
+    {
+      { BPF_LD | BPF_W | BPF_ABS, 0, 0, static_cast<uint32_t>(SKF_AD_OFF + SKF_AD_CPU) },
+      { BPF_RET | BPF_A, 0, 0, 0 }
+    };
+    struct sock_fprog prog = { sizeof code / sizeof code[0], code };
+    if(::setsockopt(listenFd_, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog, sizeof prog) < 0)
+      LOG_SYSERR << "Listener cpu steering " << listenAddr_.toIpPort();
+  }
+  acceptChannel_->enableReading();
+}
+
+void Listener::onAccept(muduo::Timestamp)
+{
+  struct sockaddr_in6 addr;
+  socklen_t len = sizeof addr;
+  ::memset(&addr, 0, sizeof addr);
+  int sockfd = ::accept4(listenFd_, reinterpret_cast<struct sockaddr*>(&addr), &len, SOCK_NONBLOCK | SOCK_CLOEXEC);
+  if(sockfd >= 0)
+  {
+    if(fastOpen_ > 0 && syn_data(sockfd))
+      stats::add(stats::kTfoAccepted);
+    if(addr.sin6_family == AF_INET)
+      newConnection(sockfd, muduo::net::InetAddress(*reinterpret_cast<struct sockaddr_in*>(&addr)));
+    else
+      newConnection(sockfd, muduo::net::InetAddress(addr));
+  }
+  else if(errno == EMFILE)
+  {
+    // the same trick as muduo's Acceptor, or the listen fd keeps being readable
+    LOG_SYSERR << "Listener accept";
+    ::close(idleFd_);
+    idleFd_ = ::accept(listenFd_, NULL, NULL);
+    ::close(idleFd_);
+    idleFd_ = ::open("/dev/null", O_RDONLY | O_CLOEXEC);
+  }
+  else if(errno != EAGAIN && errno != EINTR && errno != ECONNABORTED)
+  {
+    LOG_SYSERR << "Listener accept";
+  }
+}
+
+void Listener::newConnection(int sockfd, const muduo::net::InetAddress &peerAddr)
+{
+  loop_->assertInLoopThread();
+  muduo::net::EventLoop* ioLoop = threadPool_->getNextLoop();
+  char buf[64];
+  snprintf(buf, sizeof buf, "-%s#%d", listenAddr_.toIpPort().c_str(), nextConnId_);
+  ++nextConnId_;
+  muduo::string conName = name_ + buf;
+
+  LOG_INFO_LIMITED(10) << "Listener::newConnection [" << name_ << "] - new connection [" << conName
+           << "] from " << peerAddr.toIpPort();
+  muduo::net::TcpConnectionPtr con(new muduo::net::TcpConnection(ioLoop, conName, sockfd, local_address(sockfd), peerAddr));
+  connections_[conName] = con;
+  con->setConnectionCallback(connectionCallback_);
+  con->setMessageCallback(messageCallback_);
+  con->setCloseCallback(boost::bind(&Listener::removeConnection, this, _1));
+  ioLoop->runInLoop(boost::bind(&Listener::establish, this, con, sockfd));
+}
+
+void Listener::establish(const muduo::net::TcpConnectionPtr &con, int sockfd)
+{
+  if(acceptCallback_)
+    acceptCallback_(con, sockfd);
+  con->connectEstablished();
+}
+
+void Listener::removeConnection(const muduo::net::TcpConnectionPtr &con)
+{
+  loop_->runInLoop(boost::bind(&Listener::removeConnectionInLoop, this, con));
+}
+
+void Listener::removeConnectionInLoop(const muduo::net::TcpConnectionPtr &con)
+{
+  loop_->assertInLoopThread();
+  LOG_INFO_LIMITED(10) << "Listener::removeConnectionInLoop [" << name_ << "] - connection " << con->name();
+  connections_.erase(con->name());
+  con->getLoop()->queueInLoop(boost::bind(&muduo::net::TcpConnection::connectDestroyed, con));
+}
\ No newline at end of file
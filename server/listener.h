@@ -0,0 +1,85 @@
+#pragma once
+
+#include <muduo/net/Callbacks.h>
+#include <muduo/net/InetAddress.h>
+#include <boost/noncopyable.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <map>
+
+namespace muduo
+{
+namespace net
+{
+class Channel;
+class EventLoop;
+class EventLoopThreadPool;
+}
+}
+
+namespace zy
+{
+// accept connections the way of muduo::net::TcpServer, but the sockets are
+// created here, so their fds can be handed to splice(2)
+class Listener : boost::noncopyable
+{
+ public:
+  typedef boost::function<void(muduo::net::EventLoop*)> ThreadInitCallback;
+  // called in the io loop before the connection callback, with the fd of the connection
+  typedef boost::function<void(const muduo::net::TcpConnectionPtr&, int)> AcceptCallback;
+
+  // with reusePort, more listeners, mostly of other processes, may bind the same address
+  // and the kernel spreads connections over them
+  Listener(muduo::net::EventLoop* loop, const muduo::net::InetAddress& listenAddr, const muduo::string& name,
+           bool reusePort = false);
+
+  ~Listener();
+
+  // must be called before start
+  void setThreadNum(int threads);
+
+  void setThreadInitCallback(const ThreadInitCallback& cb) { threadInitCallback_ = cb; }
+
+  void setAcceptCallback(const AcceptCallback& cb) { acceptCallback_ = cb; }
+
+  void setConnectionCallback(const muduo::net::ConnectionCallback& cb) { connectionCallback_ = cb; }
+
+  void setMessageCallback(const muduo::net::MessageCallback& cb) { messageCallback_ = cb; }
+
+  // accept tcp fast open with this many pending requests, 0 means off, must be called before start
+  void setFastOpen(int queue) { fastOpen_ = queue; }
+
+  // the SO_REUSEPORT group hands a connection to its listener with the index of the cpu
+  // that received it, listeners join the group in the order they start, must be called before start
+  void setCpuSteering(bool on) { cpuSteering_ = on; }
+
+  void start();
+
+ private:
+  void onAccept(muduo::Timestamp receiveTime);
+
+  void newConnection(int sockfd, const muduo::net::InetAddress& peerAddr);
+
+  void establish(const muduo::net::TcpConnectionPtr& con, int sockfd);
+
+  void removeConnection(const muduo::net::TcpConnectionPtr& con);
+
+  void removeConnectionInLoop(const muduo::net::TcpConnectionPtr& con);
+
+  muduo::net::EventLoop* loop_;
+  muduo::net::InetAddress listenAddr_;
+  muduo::string name_;
+  int listenFd_;
+  int idleFd_; // closed to accept and drop a connection when out of fds
+  boost::scoped_ptr<muduo::net::Channel> acceptChannel_;
+  boost::scoped_ptr<muduo::net::EventLoopThreadPool> threadPool_;
+  ThreadInitCallback threadInitCallback_;
+  AcceptCallback acceptCallback_;
+  muduo::net::ConnectionCallback connectionCallback_;
+  muduo::net::MessageCallback messageCallback_;
+  int fastOpen_;
+  bool cpuSteering_;
+  bool started_;
+  int nextConnId_;
+  std::map<muduo::string, muduo::net::TcpConnectionPtr> connections_;
+};
+}
\ No newline at end of file
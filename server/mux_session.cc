@@ -0,0 +1,398 @@
+#include "mux_session.h"
+#include "log_rate.h"
+#include "frame.h"
+#include "messages.h"
+#include "socks_address.h"
+#include "stats.h"
+
+#include <client.pb.h>
+#include <server.pb.h>
+#include <muduo/base/Logging.h>
+#include <muduo/net/EventLoop.h>
+#include <boost/bind.hpp>
+#include <algorithm>
+
+using namespace zy;
+
+MuxSession::MuxSession(muduo::net::EventLoop *loop,
+                       const muduo::net::TcpConnectionPtr &serverCon,
+                       Resolver &resolver,
+                       const std::string &passwd)
+  : loop_(loop),
+    serverCon_(serverCon),
+    resolver_(resolver),
+    passwd_(passwd),
+    streams_(),
+    codecs_(0),
+    timeout_(5), // default timeout is 5 second
+    wheel_(nullptr)
+{
+
+}
+
+MuxSession::~MuxSession()
+{
+  LOG_INFO_LIMITED(10) << "~MuxSession";
+}
+
+void MuxSession::onMessage(const msg::ClientMsg &message)
+{
+  uint32_t id = message.stream_id();
+  switch(message.type())
+  {
+    case msg::ClientMsg_Type_OPEN:
+      onOpen(id, message);
+      break;
+    case msg::ClientMsg_Type_CLOSE:
+      close_stream(id, false);
+      break;
+    case msg::ClientMsg_Type_WINDOW:
+      onWindow(id, message.window());
+      break;
+    default:
+      LOG_ERROR << "unexpected message type " << message.type() << " on multiplexed connection";
+      serverCon_->shutdown();
+  }
+}
+
+void MuxSession::onOpen(uint32_t id, const msg::ClientMsg &message)
+{
+  if(!message.has_request() || streams_.count(id))
+  {
+    LOG_ERROR << "invalid open of stream " << id;
+    serverCon_->shutdown();
+    return;
+  }
+  auto& request = message.request();
+  if(request.password() != passwd_)
+  {
+    LOG_WARN_LIMITED(10) << "invalid password!";
+    send_response(id, 0x05);
+    serverCon_->shutdown();
+    return;
+  }
+  else if(request.cmd() != 0x01)
+  {
+    LOG_ERROR << "unsupport command " << request.cmd();
+    send_response(id, 0x07);
+    return;
+  }
+  auto& stream = streams_[id];
+  if(codec::valid(request.codec()))
+  {
+    stream.compressor.set_codec(static_cast<codec::Type>(request.codec()), request.codec_level());
+    codecs_ |= 1 << request.codec();
+  }
+  muduo::string domain = request.addr().c_str();
+  uint16_t port = static_cast<uint16_t>(request.port());
+  stream.host = domain;
+  muduo::net::InetAddress addr;
+  if(socks::ip_address(request.ip().data(), request.ip().size(), port, &addr))
+  {
+    // ip literal, nothing to resolve
+    onResolve(id, Resolver::AddressList(1, addr));
+    return;
+  }
+  wkSession session(shared_from_this());
+  resolver_.resolve(domain, port,
+                    boost::bind(&MuxSession::onResolveWeak, session, id, _1),
+                    boost::bind(&MuxSession::onResolveErrorWeak, session, id));
+}
+
+void MuxSession::onResolve(uint32_t id, const Resolver::AddressList &addresses)
+{
+  auto it = streams_.find(id);
+  // closed by local_server while resolving
+  if(it == streams_.end())
+    return;
+  auto& stream = it->second;
+  stream.state = kConnecting;
+  stream.client.reset(new HappyEyeballs(loop_, addresses, "mux_client"));
+  stream.client->setWinnerCallback(boost::bind(&Resolver::prefer, &resolver_, stream.host, _1));
+  wkSession session(shared_from_this());
+  stream.client->setConnectionCallback(boost::bind(&MuxSession::onClientConnectionWeak, session, id, _1));
+  stream.client->setFailCallback(boost::bind(&MuxSession::onConnectFailedWeak, session, id));
+  stream.client->setMessageCallback(boost::bind(&MuxSession::onClientMessageWeak, session, id, _1, _2));
+  stream.timeout = wheel_->add(timeout_, boost::bind(&MuxSession::onTimeoutWeak, session, id));
+  stream.connect_start = muduo::Timestamp::now();
+  stream.client->connect();
+}
+
+void MuxSession::onResolveError(uint32_t id)
+{
+  auto it = streams_.find(id);
+  if(it == streams_.end())
+    return;
+  LOG_INFO_LIMITED(10) << "stream " << id << " resolve error";
+  send_response(id, 0x03);
+  streams_.erase(it);
+}
+
+void MuxSession::onClientConnection(uint32_t id, const muduo::net::TcpConnectionPtr &con)
+{
+  LOG_DEBUG << "stream " << id << (con->connected() ? " up" : " down");
+  auto it = streams_.find(id);
+  if(con->connected())
+  {
+    if(it == streams_.end() || it->second.state != kConnecting)
+    {
+      con->shutdown();
+      return;
+    }
+    auto& stream = it->second;
+    TimingWheel::cancel(stream.timeout);
+    stats::observe(stats::kConnectSeconds, muduo::timeDifference(muduo::Timestamp::now(), stream.connect_start));
+    con->setTcpNoDelay(true);
+    stream.clientCon = con;
+    stream.state = kTransport;
+    LOG_INFO_LIMITED(10) << "stream " << id << " built! " << serverCon_->peerAddress().toIpPort() << " <-> "
+             << con->peerAddress().toIpPort();
+    send_response(id, 0x00, &con->localAddress());
+  }
+  else if(it != streams_.end())
+  {
+    auto& stream = it->second;
+    if(stream.clientCon && stream.clientCon->inputBuffer()->readableBytes() > 0)
+    {
+      // wait for window update of local_server to relay the rest
+      stream.state = kClosing;
+    }
+    else
+    {
+      close_stream(id, true);
+    }
+  }
+}
+
+void MuxSession::onClientMessage(uint32_t id, const muduo::net::TcpConnectionPtr &con, muduo::net::Buffer *buf)
+{
+  auto it = streams_.find(id);
+  if(it == streams_.end())
+  {
+    buf->retrieveAll();
+    return;
+  }
+  flush_client_input(id, it->second);
+}
+
+void MuxSession::flush_client_input(uint32_t id, Stream &stream)
+{
+  auto buf = stream.clientCon->inputBuffer();
+  while(buf->readableBytes() > 0 && stream.send_window > 0)
+  {
+    size_t length = std::min(buf->readableBytes(), static_cast<size_t>(stream.send_window));
+    muduo::net::Buffer& msg_buf = messages::output();
+    stream.compressor.append_stream(&msg_buf, id, buf->peek(), length);
+    buf->retrieve(length);
+    stats::add(stats::kBytesOut, length);
+    stream.send_window -= static_cast<int32_t>(length);
+    serverCon_->send(&msg_buf);
+  }
+  if(stream.state == kClosing)
+  {
+    if(buf->readableBytes() == 0)
+      close_stream(id, true);
+  }
+  else if(buf->readableBytes() > 0 && !stream.paused)
+  {
+    stream.paused = true;
+    stream.clientCon->stopRead();
+  }
+  else if(buf->readableBytes() == 0 && stream.paused)
+  {
+    stream.paused = false;
+    stream.clientCon->startRead();
+  }
+}
+
+void MuxSession::onData(uint32_t id, const char *data, size_t len)
+{
+  auto it = streams_.find(id);
+  // stream may be closed by target meanwhile
+  if(it == streams_.end() || it->second.state != kTransport)
+    return;
+  auto& stream = it->second;
+  // bytes not granted back yet include those still in the output buffer, a peer that
+  // ignores the window would have them pile up there
+  if(len > static_cast<size_t>(kStreamWindow - stream.recv_pending))
+  {
+    LOG_ERROR_LIMITED(10) << "stream " << id << " of " << serverCon_->peerAddress().toIp() << " overruns its window";
+    close_stream(id, true);
+    return;
+  }
+  stream.clientCon->send(data, static_cast<int>(len));
+  stream.recv_pending += static_cast<int32_t>(len);
+  if(stream.clientCon->outputBuffer()->readableBytes() == 0)
+  {
+    if(stream.recv_pending >= kStreamWindow / 4)
+      grant_window(id, stream);
+  }
+  else
+  {
+    // target is slow, grant window after it drains
+    stream.clientCon->setWriteCompleteCallback(boost::bind(&MuxSession::onClientWriteCompleteWeak,
+        wkSession(shared_from_this()), id, _1));
+  }
+}
+
+void MuxSession::onClientWriteComplete(uint32_t id, const muduo::net::TcpConnectionPtr &con)
+{
+  con->setWriteCompleteCallback(muduo::net::WriteCompleteCallback());
+  auto it = streams_.find(id);
+  if(it != streams_.end() && it->second.recv_pending > 0)
+    grant_window(id, it->second);
+}
+
+void MuxSession::onWindow(uint32_t id, uint32_t window)
+{
+  auto it = streams_.find(id);
+  if(it == streams_.end())
+    return;
+  auto& stream = it->second;
+  stream.send_window += static_cast<int32_t>(window);
+  if(stream.clientCon)
+    flush_client_input(id, stream);
+}
+
+void MuxSession::grant_window(uint32_t id, Stream &stream)
+{
+  msg::ServerMsg& serverMsg = messages::server_msg();
+  serverMsg.set_type(msg::ServerMsg_Type_WINDOW);
+  serverMsg.set_stream_id(id);
+  serverMsg.set_window(static_cast<uint32_t>(stream.recv_pending));
+  stream.recv_pending = 0;
+  send_message(serverMsg);
+}
+
+void MuxSession::onTimeout(uint32_t id)
+{
+  auto it = streams_.find(id);
+  if(it == streams_.end() || it->second.state != kConnecting)
+    return;
+  LOG_WARN_LIMITED(10) << "stream " << id << " of " << serverCon_->peerAddress().toIp() << " connect timeout";
+  stats::add(stats::kConnectTimeouts);
+  it->second.client->stop();
+  send_response(id, 0x04);
+  close_stream(id, false);
+}
+
+void MuxSession::onConnectFailed(uint32_t id)
+{
+  auto it = streams_.find(id);
+  if(it == streams_.end() || it->second.state != kConnecting)
+    return;
+  LOG_WARN_LIMITED(10) << "stream " << id << " of " << serverCon_->peerAddress().toIp() << " connect failed";
+  send_response(id, 0x05);
+  close_stream(id, false);
+}
+
+void MuxSession::close_stream(uint32_t id, bool notify)
+{
+  auto it = streams_.find(id);
+  if(it == streams_.end())
+    return;
+  auto& stream = it->second;
+  if(notify)
+  {
+    msg::ServerMsg& serverMsg = messages::server_msg();
+    serverMsg.set_type(msg::ServerMsg_Type_CLOSE);
+    serverMsg.set_stream_id(id);
+    send_message(serverMsg);
+  }
+  TimingWheel::cancel(stream.timeout);
+  if(stream.clientCon)
+    stream.clientCon->shutdown();
+  if(stream.client)
+    loop_->queueInLoop(boost::bind(&MuxSession::destroy_client, stream.client));
+  streams_.erase(it);
+}
+
+void MuxSession::teardown()
+{
+  while(!streams_.empty())
+    close_stream(streams_.begin()->first, false);
+}
+
+void MuxSession::send_response(uint32_t id, int rep, const muduo::net::InetAddress *addr)
+{
+  msg::ServerMsg& serverMsg = messages::server_msg();
+  serverMsg.set_type(msg::ServerMsg_Type_RESPONSE);
+  serverMsg.set_stream_id(id);
+  auto response_ptr = serverMsg.mutable_response();
+  response_ptr->set_rep(rep);
+  if(addr && addr->family() == AF_INET)
+  {
+    response_ptr->set_addr(addr->ipNetEndian());
+    response_ptr->set_port(addr->portNetEndian());
+  }
+  else if(addr)
+  {
+    const struct sockaddr_in6* sin6 = reinterpret_cast<const struct sockaddr_in6*>(addr->getSockAddr());
+    response_ptr->set_addr6(&sin6->sin6_addr, sizeof(sin6->sin6_addr));
+    response_ptr->set_port(addr->portNetEndian());
+  }
+  send_message(serverMsg);
+}
+
+void MuxSession::send_message(const msg::ServerMsg &message)
+{
+  muduo::net::Buffer& msg_buf = messages::output();
+  frame::append_message(&msg_buf, message);
+  serverCon_->send(&msg_buf);
+}
+
+void MuxSession::onResolveWeak(const wkSession &session, uint32_t id, const Resolver::AddressList &addresses)
+{
+  auto session_ptr = session.lock();
+  if(session_ptr)
+    session_ptr->onResolve(id, addresses);
+}
+
+void MuxSession::onResolveErrorWeak(const wkSession &session, uint32_t id)
+{
+  auto session_ptr = session.lock();
+  if(session_ptr)
+    session_ptr->onResolveError(id);
+}
+
+void MuxSession::onClientConnectionWeak(const wkSession &session, uint32_t id, const muduo::net::TcpConnectionPtr &con)
+{
+  auto session_ptr = session.lock();
+  if(session_ptr)
+    session_ptr->onClientConnection(id, con);
+  else if(con->connected())
+    con->shutdown();
+}
+
+void MuxSession::onClientMessageWeak(const wkSession &session,
+                                     uint32_t id,
+                                     const muduo::net::TcpConnectionPtr &con,
+                                     muduo::net::Buffer *buf)
+{
+  auto session_ptr = session.lock();
+  if(session_ptr)
+    session_ptr->onClientMessage(id, con, buf);
+  else
+    buf->retrieveAll();
+}
+
+void MuxSession::onClientWriteCompleteWeak(const wkSession &session, uint32_t id, const muduo::net::TcpConnectionPtr &con)
+{
+  auto session_ptr = session.lock();
+  if(session_ptr)
+    session_ptr->onClientWriteComplete(id, con);
+}
+
+void MuxSession::onConnectFailedWeak(const wkSession &session, uint32_t id)
+{
+  auto session_ptr = session.lock();
+  if(session_ptr)
+    session_ptr->onConnectFailed(id);
+}
+
+void MuxSession::onTimeoutWeak(const wkSession &session, uint32_t id)
+{
+  auto session_ptr = session.lock();
+  if(session_ptr)
+    session_ptr->onTimeout(id);
+}
\ No newline at end of file
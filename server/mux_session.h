@@ -0,0 +1,148 @@
+#pragma once
+
+#include "Resolver.h"
+#include "compressor.h"
+#include "happy_eyeballs.h"
+#include "timing_wheel.h"
+
+#include <boost/noncopyable.hpp>
+#include <boost/enable_shared_from_this.hpp>
+#include <muduo/net/TcpClient.h>
+#include <unordered_map>
+
+namespace msg
+{
+class ClientMsg;
+class ServerMsg;
+}
+
+namespace zy
+{
+// one multiplexed connection from local_server, every stream on it is a socks
+// session with its own target connection and its own flow control window
+class MuxSession : boost::noncopyable, public boost::enable_shared_from_this<MuxSession>
+{
+ public:
+  // bytes a peer may send on one stream before it gets a window update, more closes the stream
+  static const int32_t kStreamWindow = 256 * 1024;
+
+  MuxSession(muduo::net::EventLoop* loop, const muduo::net::TcpConnectionPtr& serverCon,
+             Resolver& resolver, const std::string& passwd);
+
+  ~MuxSession();
+
+  // control frames, OPEN, CLOSE and WINDOW
+  void onMessage(const msg::ClientMsg& message);
+
+  // payload data of a frame::kStreamData frame
+  void onStreamData(uint32_t id, const muduo::StringPiece& data) { onData(id, data.data(), data.size()); }
+
+  // true if a stream opened with the password asked for codec type
+  bool accepts(int type) const { return codecs_ & (1 << type); }
+
+  // mux connection is down, close all streams
+  void teardown();
+
+  void set_timeout(double timeout) { timeout_ = timeout; }
+
+  // connect timeouts of streams go to the wheel of the loop
+  void set_wheel(TimingWheel* wheel) { wheel_ = wheel; }
+
+ private:
+  typedef boost::weak_ptr<MuxSession> wkSession;
+
+  enum StreamState
+  {
+    kResolving,
+    kConnecting,
+    kTransport,
+    kClosing // target is down, relay what is left in its input buffer
+  };
+
+  struct Stream
+  {
+    Stream()
+        : state(kResolving),
+          host(),
+          client(),
+          clientCon(),
+          timeout(),
+          send_window(kStreamWindow),
+          recv_pending(0),
+          paused(false),
+          compressor(codec::kNone),
+          connect_start()
+    { }
+
+    StreamState state;
+    muduo::string host;
+    HappyEyeballsPtr client;
+    muduo::net::TcpConnectionPtr clientCon;
+    WheelEntryPtr timeout;
+    int32_t send_window; // bytes we may still send to local_server
+    int32_t recv_pending; // bytes written to target but not granted back yet
+    bool paused; // stop read from target because the window is used up
+    Compressor compressor; // codec of data sent back to local_server
+    muduo::Timestamp connect_start;
+  };
+
+  void onOpen(uint32_t id, const msg::ClientMsg& message);
+
+  void onData(uint32_t id, const char* data, size_t len);
+
+  void onWindow(uint32_t id, uint32_t window);
+
+  void onResolve(uint32_t id, const Resolver::AddressList& addresses);
+
+  void onResolveError(uint32_t id);
+
+  void onClientConnection(uint32_t id, const muduo::net::TcpConnectionPtr& con);
+
+  void onClientMessage(uint32_t id, const muduo::net::TcpConnectionPtr& con, muduo::net::Buffer* buf);
+
+  void onClientWriteComplete(uint32_t id, const muduo::net::TcpConnectionPtr& con);
+
+  void onTimeout(uint32_t id);
+
+  void onConnectFailed(uint32_t id);
+
+  // relay buffered target data as long as the stream window allows
+  void flush_client_input(uint32_t id, Stream& stream);
+
+  void grant_window(uint32_t id, Stream& stream);
+
+  void close_stream(uint32_t id, bool notify);
+
+  void send_response(uint32_t id, int rep, const muduo::net::InetAddress* addr = nullptr);
+
+  void send_message(const msg::ServerMsg& message);
+
+  static void onResolveWeak(const wkSession& session, uint32_t id, const Resolver::AddressList& addresses);
+
+  static void onResolveErrorWeak(const wkSession& session, uint32_t id);
+
+  static void onClientConnectionWeak(const wkSession& session, uint32_t id, const muduo::net::TcpConnectionPtr& con);
+
+  static void onClientMessageWeak(const wkSession& session, uint32_t id, const muduo::net::TcpConnectionPtr& con,
+                                  muduo::net::Buffer* buf);
+
+  static void onClientWriteCompleteWeak(const wkSession& session, uint32_t id, const muduo::net::TcpConnectionPtr& con);
+
+  static void onTimeoutWeak(const wkSession& session, uint32_t id);
+
+  static void onConnectFailedWeak(const wkSession& session, uint32_t id);
+
+  // TcpClient must not be destroyed inside its own callbacks
+  static void destroy_client(const HappyEyeballsPtr&) { }
+
+  muduo::net::EventLoop* loop_;
+  muduo::net::TcpConnectionPtr serverCon_;
+  Resolver& resolver_;
+  std::string passwd_;
+  std::unordered_map<uint32_t, Stream> streams_;
+  int codecs_; // bit of every codec::Type negotiated by a stream
+  double timeout_;
+  TimingWheel* wheel_;
+};
+typedef boost::shared_ptr<MuxSession> MuxSessionPtr;
+}
\ No newline at end of file
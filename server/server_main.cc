@@ -2,13 +2,25 @@
 #include <muduo/base/Logging.h>
 #include <muduo/base/LogFile.h>
 
+#include "async_log.h"
 #include "socks_server.h"
+#include "stats_server.h"
 
 #include "config_json.h"
 
+#include <algorithm>
+#include <sched.h>
+#include <signal.h>
+#include <sys/prctl.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+
 using namespace zy;
 
+// the parent of workers logs in place, a log thread would not survive fork
 std::unique_ptr<muduo::LogFile> g_logFile;
+std::unique_ptr<AsyncLog> g_asyncLog;
 
 void outputFunc(const char* msg, int len)
 {
@@ -20,45 +32,246 @@ void flushFunc()
   g_logFile->flush();
 }
 
-void init_log()
+void asyncOutputFunc(const char* msg, int len)
 {
-  g_logFile.reset(new muduo::LogFile("/tmp/zy_socks", 500 * 1024, false, 3, 100));
-  muduo::Logger::setOutput(outputFunc);
-  muduo::Logger::setLogLevel(muduo::Logger::WARN);
-  muduo::Logger::setFlush(flushFunc);
+  g_asyncLog->append(msg, len);
 }
 
-int main(int argc, char* argv[])
+void asyncFlushFunc()
+{
+  g_asyncLog->flush();
+}
+
+void init_log(bool async)
 {
-  if(argc != 2)
+  if(async)
   {
-    fprintf(stderr, "Usage: %s config_path", ::basename(argv[0]));
-    exit(-1);
+    g_asyncLog.reset(new AsyncLog("/tmp/zy_socks", 500 * 1024));
+    g_asyncLog->start();
+    muduo::Logger::setOutput(asyncOutputFunc);
+    muduo::Logger::setFlush(asyncFlushFunc);
   }
+  else
+  {
+    g_logFile.reset(new muduo::LogFile("/tmp/zy_socks", 500 * 1024, true, 3, 100));
+    muduo::Logger::setOutput(outputFunc);
+    muduo::Logger::setFlush(flushFunc);
+  }
+  muduo::Logger::setLogLevel(muduo::Logger::WARN);
+}
 
-  config_json config(argv[1]);
-
+// worker is the index in workers mode, -1 for a single process, ready_fd gets a byte once
+// the server listens
+void run_server(const config_json& config, int worker, int ready_fd)
+{
   double dns_timeout = config.dns_timeout();
+  int dns_min_ttl = config.dns_min_ttl();
+  int dns_max_ttl = config.dns_max_ttl();
+  int dns_negative_ttl = config.dns_negative_ttl();
   double timeout = config.timeout();
   std::string passwd = config.password();
   uint16_t port = config.server_port();
   bool ipv6 = config.server_ipv6();
+  int threads = config.threads();
+  int stats_port = config.stats_port();
+  std::string stats_address = config.stats_address();
+  bool cpu_steering = worker >= 0 && config.reuseport_cpu();
 
-  if(daemon(0, 0) == -1)
+  if(cpu_steering)
   {
-    fprintf(stderr, "create daemon process error!");
-    exit(-1);
+    // io threads inherit it, connections received by this cpu come to this worker
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(worker % ::sysconf(_SC_NPROCESSORS_ONLN), &cpus);
+    if(::sched_setaffinity(0, sizeof cpus, &cpus) < 0)
+      LOG_SYSERR << "worker " << worker << " sched_setaffinity";
   }
 
-  init_log();
-
-  LOG_INFO << "pid = " << ::getpid();
+  LOG_INFO << "pid = " << ::getpid() << " worker = " << worker << " threads = " << threads;
 
   muduo::net::EventLoop loop;
-  socks_server server(&loop, muduo::net::InetAddress(port, false, ipv6), passwd);
+  socks_server server(&loop, muduo::net::InetAddress(port, false, ipv6), passwd, worker >= 0);
   server.set_dns_timeout(dns_timeout);
+  server.set_dns_ttl(dns_min_ttl, dns_max_ttl);
+  server.set_dns_negative_ttl(dns_negative_ttl);
+  server.set_dns_servers(config.dns_servers());
   server.set_tunnel_timeout(timeout);
+  server.set_idle_timeout(config.idle_timeout());
+  server.set_fast_open(config.fast_open());
+  server.set_cpu_steering(cpu_steering);
+  server.set_thread_num(threads);
+  server.set_buffer_budget(static_cast<size_t>(config.buffer_budget_mb()) * 1024 * 1024);
   server.start();
+  if(ready_fd >= 0)
+  {
+    char ready = 1;
+    if(::write(ready_fd, &ready, 1) != 1)
+      LOG_SYSERR << "worker " << worker << " ready";
+    ::close(ready_fd);
+  }
+
+  std::unique_ptr<StatsServer> stats_server;
+  if(stats_port > 0)
+  {
+    // every worker counts on its own
+    if(worker >= 0)
+      stats_port += worker;
+    stats_server.reset(new StatsServer(&loop, muduo::net::InetAddress(stats_address.c_str(), static_cast<uint16_t>(stats_port)), "zy_socks_"));
+    stats_server->start();
+  }
 
   loop.loop();
 }
+
+// a worker that dies soon after it started is started again after a delay, from
+// kMinBackoff doubling up to kMaxBackoff, the parent gives up after kMaxFailures of them
+// in a row, a worker up for kHealthySeconds starts over without delay
+const double kMinBackoff = 0.1;
+const double kMaxBackoff = 5;
+const double kHealthySeconds = 10;
+const int kMaxFailures = 8;
+
+struct Worker
+{
+  pid_t pid = -1;
+  muduo::Timestamp started;
+  double backoff = 0; // before the next start
+  int failures = 0; // starts in a row that failed or died soon
+};
+
+// fork a worker and wait until it listens, so workers join the SO_REUSEPORT group
+// in the order of their index, which is what cpu steering relies on, -1 if it died first
+pid_t start_worker(const config_json& config, int worker)
+{
+  int ready[2];
+  if(::pipe(ready) < 0)
+  {
+    LOG_SYSFATAL << "pipe";
+  }
+  // or the child writes what is buffered again
+  g_logFile->flush();
+  pid_t pid = ::fork();
+  if(pid == 0)
+  {
+    ::close(ready[0]);
+    // a worker never outlives the parent
+    ::prctl(PR_SET_PDEATHSIG, SIGTERM);
+    g_logFile.reset();
+    init_log(true);
+    run_server(config, worker, ready[1]);
+    _exit(0);
+  }
+  if(pid < 0)
+  {
+    LOG_SYSFATAL << "fork";
+  }
+  ::close(ready[1]);
+  char byte;
+  // nothing read if the worker died before it listens
+  bool started = ::read(ready[0], &byte, 1) == 1;
+  ::close(ready[0]);
+  if(!started)
+  {
+    LOG_ERROR << "worker " << worker << " did not start";
+    ::waitpid(pid, NULL, 0);
+    return -1;
+  }
+  return pid;
+}
+
+// start a worker again, with the backoff of it, exit if it keeps failing
+void restart_worker(const config_json& config, int index, Worker* worker)
+{
+  for(;;)
+  {
+    if(worker->backoff > 0)
+    {
+      LOG_ERROR << "start worker " << index << " again in " << worker->backoff << " seconds";
+      ::usleep(static_cast<useconds_t>(worker->backoff * 1000 * 1000));
+    }
+    worker->backoff = worker->backoff > 0 ? std::min(worker->backoff * 2, kMaxBackoff) : kMinBackoff;
+    worker->pid = start_worker(config, index);
+    worker->started = muduo::Timestamp::now();
+    if(worker->pid > 0)
+      return;
+    if(++worker->failures >= kMaxFailures)
+    {
+      LOG_FATAL << "worker " << index << " failed " << worker->failures << " times in a row, give up";
+    }
+  }
+}
+
+// start the workers and start a worker again if it dies, a restarted worker joins the
+// SO_REUSEPORT group at its end, so cpu steering may be off until all of them restart
+void run_workers(const config_json& config, int workers)
+{
+  std::vector<Worker> pool(workers);
+  for(int i = 0; i < workers; ++i)
+  {
+    // a worker that can't start now, with a bad config or a port in use, never will
+    pool[i].pid = start_worker(config, i);
+    pool[i].started = muduo::Timestamp::now();
+    if(pool[i].pid < 0)
+    {
+      LOG_FATAL << "worker " << i << " failed to start";
+    }
+  }
+  LOG_WARN << workers << " workers started";
+  for(;;)
+  {
+    int status = 0;
+    pid_t pid = ::waitpid(-1, &status, 0);
+    if(pid < 0)
+    {
+      if(errno == EINTR)
+        continue;
+      LOG_SYSFATAL << "waitpid";
+    }
+    for(int i = 0; i < workers; ++i)
+    {
+      Worker& worker = pool[i];
+      if(worker.pid == pid)
+      {
+        LOG_ERROR << "worker " << i << " pid " << pid << " exited with status " << status << ", start it again";
+        if(muduo::timeDifference(muduo::Timestamp::now(), worker.started) >= kHealthySeconds)
+        {
+          worker.backoff = 0;
+          worker.failures = 0;
+        }
+        else if(++worker.failures >= kMaxFailures)
+        {
+          LOG_FATAL << "worker " << i << " died soon after start " << worker.failures << " times in a row, give up";
+        }
+        restart_worker(config, i, &worker);
+        break;
+      }
+    }
+  }
+}
+
+int main(int argc, char* argv[])
+{
+  // -f keeps the process in foreground, for bench
+  bool foreground = argc == 3 && ::strcmp(argv[2], "-f") == 0;
+  if(argc != 2 && !foreground)
+  {
+    fprintf(stderr, "Usage: %s config_path [-f]", ::basename(argv[0]));
+    exit(-1);
+  }
+
+  config_json config(argv[1]);
+  int workers = config.workers();
+
+  if(!foreground && daemon(0, 0) == -1)
+  {
+    fprintf(stderr, "create daemon process error!");
+    exit(-1);
+  }
+
+  init_log(workers <= 0);
+
+  if(workers > 0)
+    run_workers(config, workers);
+  else
+    run_server(config, -1, -1);
+}
\ No newline at end of file
@@ -1,168 +1,332 @@
 #include "socks_server.h"
+#include "log_rate.h"
+#include "frame.h"
+#include "messages.h"
+#include "socks_address.h"
 
 #include <client.pb.h>
 #include <muduo/base/Logging.h>
 #include <muduo/net/EventLoop.h>
 #include <boost/bind.hpp>
-#include <snappy.h>
+#include <algorithm>
 #include <server.pb.h>
 
 using namespace zy;
 
 socks_server::socks_server(muduo::net::EventLoop *loop,
                                const muduo::net::InetAddress &addr,
-                               const std::string &passwd)
+                               const std::string &passwd,
+                               bool reuse_port)
   : loop_(loop),
-    server_(loop_, addr, "proxy_server"),
-    resolver_(loop_),
+    server_(loop_, addr, "proxy_server", reuse_port),
     passwd_(passwd),
-    con_states_(),
-    tunnels_(),
+    mutex_(),
+    loop_states_(),
     dns_timeout_(3),
-    tunnel_timeout_(5)
+    dns_min_ttl_(30),
+    dns_max_ttl_(3600),
+    dns_negative_ttl_(5),
+    dns_servers_(),
+    tunnel_timeout_(5),
+    idle_timeout_(0),
+    fast_open_(false),
+    threads_(0),
+    buffer_budget_(1024 * 1024 * 1024)
 {
+  server_.setAcceptCallback(boost::bind(&socks_server::onAccept, this, _1, _2));
   server_.setConnectionCallback(boost::bind(&socks_server::onConnection, this, _1));
   server_.setMessageCallback(boost::bind(&socks_server::onMessage, this, _1, _2, _3));
-  resolver_.set_timeout(dns_timeout_);
-  resolver_.setResolveCallback(boost::bind(&socks_server::onResolve, this, _1, _2));
-  resolver_.setErrorCallback(boost::bind(&socks_server::onResolveError, this, _1, _2));
+  server_.setThreadInitCallback(boost::bind(&socks_server::onThreadInit, this, _1));
+}
+
+// called in every io loop before it starts looping, or in the base loop if no thread pool
+void socks_server::onThreadInit(muduo::net::EventLoop *loop)
+{
+  std::unique_ptr<LoopState> state(new LoopState(loop, buffer_budget_ / std::max(threads_, 1)));
+  state->resolver.set_timeout(dns_timeout_);
+  state->resolver.set_ttl(dns_min_ttl_, dns_max_ttl_);
+  state->resolver.set_negative_ttl(dns_negative_ttl_);
+  state->resolver.set_servers(dns_servers_);
+  state->resolver.setResolveCallback(boost::bind(&socks_server::onResolve, this, _1, _2, _3));
+  state->resolver.setErrorCallback(boost::bind(&socks_server::onResolveError, this, _1, _2));
+  muduo::MutexLockGuard lock(mutex_);
+  loop_states_[loop] = std::move(state);
+}
+
+// loop_states_ is never modified after start(), so lookups need no lock
+socks_server::LoopState& socks_server::loop_state(muduo::net::EventLoop *loop)
+{
+  auto it = loop_states_.find(loop);
+  if(it == loop_states_.end())
+  {
+    LOG_FATAL << "can't find state of event loop " << loop;
+  }
+  return *it->second;
+}
+
+stats::Metric socks_server::state_metric(conState state)
+{
+  switch(state)
+  {
+    case kStart:
+      return stats::kConnectionsStart;
+    case kGotcmd:
+      return stats::kConnectionsGotcmd;
+    case kResolved:
+      return stats::kConnectionsResolved;
+    case kTransport:
+      return stats::kConnectionsTransport;
+    case kMux:
+      return stats::kConnectionsMux;
+  }
+  return stats::kConnectionsStart;
+}
+
+socks_server::ConState* socks_server::con_state(const muduo::net::TcpConnectionPtr &con)
+{
+  ConState* const* con_state = boost::any_cast<ConState*>(&con->getContext());
+  return con_state ? *con_state : nullptr;
+}
+
+// runs before onConnection, in the loop of the connection
+void socks_server::onAccept(const muduo::net::TcpConnectionPtr &con, int sockfd)
+{
+  ConState* con_state = loop_state(con->getLoop()).con_states.acquire();
+  con_state->fd = sockfd;
+  con->setContext(con_state);
+  stats::add(state_metric(kStart));
 }
 
 void socks_server::onConnection(const muduo::net::TcpConnectionPtr &con)
 {
-  auto con_name = con->name();
-  LOG_DEBUG << con_name << (con->connected() ? " up" : " down");
+  LOG_DEBUG << con->name() << (con->connected() ? " up" : " down");
   if(con->connected())
   {
     con->setTcpNoDelay(true);
-    con_states_[con_name] = kStart;
   }
   else
   {
-    erase_from_con_states(con_name);
-    erase_from_tunnels(con_name);
+    ConState* con_state = this->con_state(con);
+    if(!con_state)
+      return;
+    LOG_DEBUG << con->name() << " read " << con_state->read_bytes << " bytes in " << con_state->read_events << " events";
+    if(con_state->mux)
+      con_state->mux->teardown();
+    stats::add(state_metric(con_state->state), -1);
+    con->setContext(boost::any());
+    loop_state(con->getLoop()).con_states.release(con_state);
   }
 }
 
-void socks_server::erase_from_con_states(const muduo::string &con_name)
+void socks_server::onMessage(const muduo::net::TcpConnectionPtr &con,
+                             muduo::net::Buffer *buf,
+                             muduo::Timestamp receiveTime)
 {
-  auto it = con_states_.find(con_name);
-  if(it != con_states_.end())
-    con_states_.erase(it);
+  ConState* con_state_ptr = con_state(con);
+  if(!con_state_ptr)
+  {
+    LOG_FATAL << "connection without state " << con->name();
+  }
+  auto& con_state = *con_state_ptr;
+  auto& state = con_state.state;
+  ++con_state.read_events;
+  con_state.read_bytes += buf->readableBytes();
+  stats::add(stats::kBytesIn, buf->readableBytes());
+  if(state == kTransport && con_state.raw && con_state.tunnel && con_state.tunnel->clientCon())
+  {
+    // spliced tunnels never get here, this is the fallback of them
+    con_state.tunnel->touch();
+    con_state.tunnel->clientCon()->send(buf);
+    return;
+  }
+  // payload points into buf, or into scratch for compressed frames, it is relayed from there
+  FrameHandler handler(this, con, con_state_ptr, buf);
+  if(!frame::decode(buf, &loop_state(con->getLoop()).scratch, &handler))
+  {
+    buf->retrieveAll();
+    con->shutdown();
+    return;
+  }
+  // datagrams of all frames of this read go out together
+  if(con_state.udp)
+    con_state.udp->flush();
 }
 
-void socks_server::erase_from_tunnels(const muduo::string &con_name)
+bool socks_server::FrameHandler::accepts(int codec)
 {
-  auto it = tunnels_.find(con_name);
-  if(it != tunnels_.end())
-    tunnels_.erase(it);
+  // nothing is uncompressed for a peer before its request with the password asked for the codec
+  return con_state_->state == kMux ? con_state_->mux->accepts(codec) : codec == con_state_->codec;
 }
 
-void socks_server::onMessage(const muduo::net::TcpConnectionPtr &con,
-                             muduo::net::Buffer *buf,
-                             muduo::Timestamp receiveTime)
+bool socks_server::FrameHandler::onFrame(const frame::Header &header, const muduo::StringPiece &payload)
+{
+  return server_->onFrame(con_, con_state_, buf_, header, payload);
+}
+
+bool socks_server::onFrame(const muduo::net::TcpConnectionPtr &con,
+                           ConState *con_state_ptr,
+                           muduo::net::Buffer *buf,
+                           const frame::Header &header,
+                           const muduo::StringPiece &payload)
 {
-  auto con_name = con->name();
-  if(!con_states_.count(con_name))
+  auto& con_state = *con_state_ptr;
+  auto& state = con_state.state;
+  if(header.type == frame::kData && state == kTransport && con_state.tunnel && con_state.tunnel->clientCon())
+  {
+    // relay straight from the input buffer
+    con_state.tunnel->touch();
+    con_state.tunnel->clientCon()->send(payload);
+  }
+  else if(header.type == frame::kDatagram && state == kTransport && con_state.udp)
   {
-    LOG_FATAL << "can't find specified connection in con_states " << con_name;
+    con_state.udp->onDatagram(payload);
   }
-  auto& state = con_states_[con_name];
-  while(buf->readableBytes() > 4 && static_cast<int32_t>(buf->readableBytes()) >=  4 + buf->peekInt32())
+  else if(header.type == frame::kStreamData && state == kMux)
   {
-    int32_t length = buf->readInt32();
-    msg::ClientMsg message;
+    con_state.mux->onStreamData(frame::stream_id(buf), payload);
+  }
+  else if(header.type == frame::kMessage)
+  {
+    msg::ClientMsg& message = messages::client_msg();
+    if(!message.ParseFromArray(payload.data(), payload.size()))
+    {
+      // parse error, close the connection immediately
+      LOG_ERROR << "parse from array error!";
+      buf->retrieveAll();
+      con->shutdown();
+      return false;
+    }
+    if(state == kMux)
     {
-      std::string uncompressed_str;
+      con_state.mux->onMessage(message);
+    }
+    else if(state == kStart && message.type() == msg::ClientMsg_Type_OPEN)
+    {
+      // first stream of a multiplexed connection, the session checks password of every stream
+      MuxSessionPtr session(new MuxSession(con->getLoop(), con, loop_state(con->getLoop()).resolver, passwd_));
+      session->set_timeout(tunnel_timeout_);
+      session->set_wheel(&loop_state(con->getLoop()).wheel);
+      con_state.mux = session;
+      set_con_state(con_state_ptr, kMux);
+      session->onMessage(message);
+    }
+    else if(state == kStart && message.type() == msg::ClientMsg_Type_REQUEST)
+    {
+      const auto& request = message.request();
+      if(request.password() != passwd_)
+      {
+        LOG_WARN_LIMITED(10) << "invalid password!";
+        buf->retrieveAll();
+        send_response_and_down(0x05, con);
+        return false;
+      }
+      else if(request.cmd() != 0x01 && request.cmd() != 0x03)
+      {
+        LOG_ERROR << "unsupport command " << request.cmd();
+        buf->retrieveAll();
+        send_response_and_down(0x07, con);
+        return false;
+      }
+      if(codec::valid(request.codec()))
       {
-        std::string compressed_str(buf->peek(), buf->peek() + length);
-        buf->retrieve(length);
-        snappy::Uncompress(compressed_str.data(), compressed_str.size(), &uncompressed_str);
+        con_state.codec = static_cast<codec::Type>(request.codec());
+        con_state.codec_level = request.codec_level();
       }
-      if(message.ParseFromArray(uncompressed_str.data(), uncompressed_str.size()))
+      if(request.cmd() == 0x03)
       {
-        if(state == kTransport && message.type() == msg::ClientMsg_Type_DATA && !con->getContext().empty())
-        {
-          auto clientCon = boost::any_cast<const muduo::net::TcpConnectionPtr&>(con->getContext());
-          clientCon->send(message.data().data(), message.data().size());
-        }
-        else if(state == kStart && message.type() == msg::ClientMsg_Type_REQUEST)
-        {
-          auto request = message.request();
-          if(request.password() != passwd_)
-          {
-            LOG_WARN << "invalid password!";
-            send_response_and_down(0x05, con);
-            return;
-          }
-          else if(request.cmd() != 0x01)
-          {
-            LOG_ERROR << "unsupport command " << request.cmd();
-            send_response_and_down(0x07, con);
-            return;
-          }
-          muduo::string domain = request.addr().c_str();
-          uint16_t port = static_cast<uint16_t>(request.port());
-          resolver_.resolve(domain, port, boost::weak_ptr<muduo::net::TcpConnection>(con));
-          // stop read now, until resolve the domain and connection to specified host
-          con->stopRead();
-          state = kGotcmd;
-        }
-        else
-        {
-          LOG_ERROR << "unknown connection state!";
-          con->shutdown();
-        }
+        // udp associate, datagrams follow in kDatagram frames on this connection
+        con_state.udp.reset(new UdpRelay(con->getLoop(), con, loop_state(con->getLoop()).resolver));
+        set_con_state(con_state_ptr, kTransport);
+        send_response(0x00, con);
+        return true;
       }
-      else // parse error, close the connection immediately
+      con_state.raw = request.raw() && con_state.codec == codec::kNone;
+      con_state.early_data = message.data();
+      muduo::string domain = request.addr().c_str();
+      uint16_t port = static_cast<uint16_t>(request.port());
+      // bytes after the request wait in buf until the tunnel is up
+      buf->retrieve(frame::kHeaderLength + header.length);
+      // stop read now, until resolve the domain and connection to specified host
+      con->stopRead();
+      set_con_state(con_state_ptr, kGotcmd);
+      muduo::net::InetAddress addr;
+      if(socks::ip_address(request.ip().data(), request.ip().size(), port, &addr))
       {
-        LOG_ERROR << "parse from array error!";
-        con->shutdown();
+        // ip literal, nothing to resolve
+        onResolve(con, domain, Resolver::AddressList(1, addr));
+        return false;
       }
+      loop_state(con->getLoop()).resolver.resolve(domain, port, boost::weak_ptr<muduo::net::TcpConnection>(con));
+      return false;
     }
+    else
+    {
+      LOG_ERROR << "unknown connection state!";
+      buf->retrieveAll();
+      con->shutdown();
+      return false;
+    }
+  }
+  else
+  {
+    LOG_ERROR << "unexpected frame type " << static_cast<int>(header.type) << " in state " << state;
+    buf->retrieveAll();
+    con->shutdown();
+    return false;
   }
+  return true;
 }
 
-// send response to client and shutdown the connection
-void socks_server::send_response_and_down(int rep, const muduo::net::TcpConnectionPtr &con)
+void socks_server::send_response(int rep, const muduo::net::TcpConnectionPtr &con)
 {
-  muduo::net::Buffer msg_buf;
+  muduo::net::Buffer& msg_buf = messages::output();
   {
-    msg::ServerMsg response;
+    msg::ServerMsg& response = messages::server_msg();
     response.set_type(msg::ServerMsg_Type_RESPONSE);
     auto reponse_ptr = response.mutable_response();
     reponse_ptr->set_rep(rep);
-    std::string response_str = response.SerializeAsString();
-
-    int length = static_cast<int32_t>(response_str.size());
-    msg_buf.appendInt32(length);
-    msg_buf.append(response_str.data(), length);
+    frame::append_message(&msg_buf, response);
   }
   con->send(&msg_buf);
+}
+
+// send response to client and shutdown the connection
+void socks_server::send_response_and_down(int rep, const muduo::net::TcpConnectionPtr &con)
+{
+  send_response(rep, con);
   con->shutdown();
 }
 
 
-void socks_server::onResolve(const muduo::net::TcpConnectionPtr &con , const muduo::net::InetAddress &addr)
+void socks_server::onResolve(const muduo::net::TcpConnectionPtr &con,
+                             const muduo::string &host,
+                             const Resolver::AddressList &addresses)
 {
-  con_states_[con->name()] = kResolved;
-  TunnelPtr tunnel(new Tunnel(loop_, addr, con));
+  auto loop = con->getLoop();
+  ConState* con_state = this->con_state(con);
+  if(!con_state)
+    return;
+  set_con_state(con_state, kResolved);
+  // the proxy client shares the loop of the accepted connection
+  TunnelPtr tunnel(new Tunnel(loop, addresses, con));
   tunnel->set_timeout(tunnel_timeout_);
-  tunnel->setOnConnectionCallback(boost::bind(&socks_server::set_con_state, this, con->name(), kTransport));
+  tunnel->setWinnerCallback(boost::bind(&Resolver::prefer, &loop_state(loop).resolver, host, _1));
+  tunnel->set_codec(con_state->codec, con_state->codec_level);
+  tunnel->set_raw(con_state->raw, con_state->fd);
+  tunnel->set_early_data(&con_state->early_data);
+  tunnel->set_fast_open(fast_open_);
+  tunnel->set_budget(&loop_state(loop).budget);
+  tunnel->set_wheel(&loop_state(loop).wheel);
+  tunnel->set_idle_timeout(idle_timeout_);
+  tunnel->setOnConnectionCallback(boost::bind(&socks_server::set_con_state, con_state, kTransport));
   tunnel->setup();
+  con_state->tunnel = tunnel;
   tunnel->connect();
-  tunnels_[con->name()] = tunnel;
 }
 
 void socks_server::onResolveError(const muduo::net::TcpConnectionPtr &con, const muduo::string &host)
 {
-  LOG_INFO << "onResolveError due to resolve " << host;
+  LOG_INFO_LIMITED(10) << "onResolveError due to resolve " << host;
   send_response_and_down(0x03, con);
 }
 
-void socks_server::set_con_state(const muduo::string &name, socks_server::conState state) 
-{
-  if(con_states_.count(name))
-    con_states_[name] = state;
-}
-
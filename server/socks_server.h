@@ -1,10 +1,19 @@
 #pragma once
 
 #include "Resolver.h"
+#include "codec.h"
+#include "frame.h"
+#include "listener.h"
+#include "mux_session.h"
+#include "session_pool.h"
+#include "stats.h"
 #include "tunnel.h"
+#include "udp_relay.h"
 
 #include <boost/noncopyable.hpp>
-#include <muduo/net/TcpServer.h>
+#include <muduo/base/Mutex.h>
+#include <memory>
+#include <string>
 #include <unordered_map>
 
 namespace zy
@@ -17,44 +26,187 @@ class socks_server : boost::noncopyable
     kStart, // just connected
     kGotcmd, // get command already
     kResolved, // got ip address already
-    kTransport // connect to remote server successful, now swap data
+    kTransport, // connect to remote server successful, now swap data
+    kMux // multiplexed connection, carry many streams
+  };
+
+  // everything of an accepted connection, taken from the SessionPool of its loop
+  // and kept in the context of the connection
+  struct ConState
+  {
+    ConState() { reset(); }
+
+    void reset()
+    {
+      state = kStart;
+      codec = codec::kNone;
+      codec_level = 0;
+      raw = false;
+      fd = -1;
+      tunnel.reset();
+      mux.reset();
+      udp.reset();
+      std::string().swap(early_data);
+      read_events = 0;
+      read_bytes = 0;
+    }
+
+    conState state;
+    // requested by local_server, used for data sent back to it
+    codec::Type codec;
+    int codec_level;
+    bool raw; // no frames in transport
+    int fd; // socket of the connection, for splice
+    TunnelPtr tunnel;
+    MuxSessionPtr mux;
+    UdpRelayPtr udp; // udp associate, instead of tunnel
+    std::string early_data; // sent with the request, until the tunnel takes it
+    int64_t read_events;
+    int64_t read_bytes;
   };
   
+  // reuse_port lets the workers of server_main share the address
   socks_server(muduo::net::EventLoop* loop, const muduo::net::InetAddress& addr,
-               const std::string& passwd);
+               const std::string& passwd, bool reuse_port = false);
+
+  void onAccept(const muduo::net::TcpConnectionPtr& con, int sockfd);
 
   void onConnection(const muduo::net::TcpConnectionPtr& con);
 
   void onMessage(const muduo::net::TcpConnectionPtr& con, muduo::net::Buffer* buf, muduo::Timestamp receiveTime);
   
-  void set_con_state(const muduo::string& name, conState state);
+  // every state change goes here, to keep the gauges of stats right
+  static void set_con_state(ConState* con_state, conState state)
+  {
+    stats::move(state_metric(con_state->state), state_metric(state));
+    con_state->state = state;
+  }
+
+  static stats::Metric state_metric(conState state);
  
   void start() { server_.start(); }
   
   void set_dns_timeout(double timeout) { dns_timeout_ = timeout; }
+
+  void set_dns_ttl(int min_ttl, int max_ttl)
+  {
+    dns_min_ttl_ = min_ttl;
+    dns_max_ttl_ = max_ttl;
+  }
+
+  void set_dns_negative_ttl(int ttl) { dns_negative_ttl_ = ttl; }
+
+  // "host:port,host:port", empty means resolv.conf
+  void set_dns_servers(const std::string& servers) { dns_servers_ = servers; }
   
   void set_tunnel_timeout(double timeout) { tunnel_timeout_ = timeout; }
+
+  // close transport tunnels without traffic for this many seconds, 0 means never
+  void set_idle_timeout(double timeout) { idle_timeout_ = timeout; }
+
+  // accept tcp fast open, and send early data of optimistic requests in the syn to targets,
+  // must be called before start
+  void set_fast_open(bool fast_open)
+  {
+    fast_open_ = fast_open;
+    server_.setFastOpen(fast_open ? kFastOpenQueue : 0);
+  }
+
+  // see Listener::setCpuSteering, must be called before start
+  void set_cpu_steering(bool on) { server_.setCpuSteering(on); }
+
+  // pending fast open requests of the listen socket
+  static const int kFastOpenQueue = 256;
+
+  // must be called before start
+  void set_thread_num(int threads)
+  {
+    threads_ = threads;
+    server_.setThreadNum(threads);
+  }
+
+  // bytes in output buffers of all tunnels, split over the io loops, must be called before start
+  void set_buffer_budget(size_t bytes) { buffer_budget_ = bytes; }
   
  private:
+  // everything touched by a connection lives in the loop of that connection,
+  // so the io threads never share any state
+  struct LoopState : boost::noncopyable
+  {
+    LoopState(muduo::net::EventLoop* loop, size_t budget_bytes)
+        : wheel(loop),
+          resolver(loop, &wheel),
+          con_states(),
+          scratch(),
+          budget(loop, budget_bytes)
+    { }
+
+    TimingWheel wheel; // before everything that puts timeouts on it
+    Resolver resolver;
+    SessionPool<ConState> con_states;
+    // compressed frames of every connection of the loop are uncompressed here,
+    // it keeps its capacity, so decoding allocates nothing once warmed up
+    std::string scratch;
+    BufferBudget budget;
+  };
+
+  // frames of an accepted connection, see frame::decode
+  class FrameHandler : public frame::Handler
+  {
+   public:
+    FrameHandler(socks_server* server, const muduo::net::TcpConnectionPtr& con,
+                 ConState* con_state, muduo::net::Buffer* buf)
+        : server_(server),
+          con_(con),
+          con_state_(con_state),
+          buf_(buf)
+    { }
+
+    bool accepts(int codec) override;
+
+    bool onFrame(const frame::Header& header, const muduo::StringPiece& payload) override;
+
+   private:
+    socks_server* server_;
+    const muduo::net::TcpConnectionPtr& con_;
+    ConState* con_state_;
+    muduo::net::Buffer* buf_;
+  };
+
+  void onThreadInit(muduo::net::EventLoop* loop);
+
+  LoopState& loop_state(muduo::net::EventLoop* loop);
+
+  // null once the connection is down
+  static ConState* con_state(const muduo::net::TcpConnectionPtr& con);
     
-  void onResolve(const muduo::net::TcpConnectionPtr& con, const muduo::net::InetAddress& addr);
+  // false stops the frames of this read, buf is dealt with then
+  bool onFrame(const muduo::net::TcpConnectionPtr& con, ConState* con_state, muduo::net::Buffer* buf,
+               const frame::Header& header, const muduo::StringPiece& payload);
+
+  void onResolve(const muduo::net::TcpConnectionPtr& con, const muduo::string& host, const Resolver::AddressList& addresses);
   
   void onResolveError(const muduo::net::TcpConnectionPtr& con, const muduo::string& host);
   
-  void erase_from_con_states(const muduo::string& con_name);
-
-  void erase_from_tunnels(const muduo::string& con_name);
+  void send_response(int rep, const muduo::net::TcpConnectionPtr& con);
 
   void send_response_and_down(int rep, const muduo::net::TcpConnectionPtr& con);
 
   muduo::net::EventLoop* loop_;
-  muduo::net::TcpServer server_;
-  Resolver resolver_;
+  Listener server_;
   std::string passwd_;
-  std::unordered_map<muduo::string, conState> con_states_;
-  std::unordered_map<muduo::string, TunnelPtr> tunnels_;
+  muduo::MutexLock mutex_; // guard loop_states_ while io threads are starting
+  std::unordered_map<muduo::net::EventLoop*, std::unique_ptr<LoopState>> loop_states_;
   double dns_timeout_; 
+  int dns_min_ttl_;
+  int dns_max_ttl_;
+  int dns_negative_ttl_;
+  std::string dns_servers_;
   double tunnel_timeout_;
+  double idle_timeout_;
+  bool fast_open_;
+  int threads_;
+  size_t buffer_budget_;
 };
 
 }
\ No newline at end of file
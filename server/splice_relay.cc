@@ -0,0 +1,223 @@
+#include "splice_relay.h"
+#include "stats.h"
+
+#include <muduo/net/Channel.h>
+#include <muduo/base/Logging.h>
+#include <boost/bind.hpp>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+using namespace zy;
+
+namespace
+{
+// splices per event, so one busy tunnel can't starve the loop
+const int kMaxRounds = 16;
+
+void release_channel(const boost::shared_ptr<muduo::net::Channel>&)
+{
+}
+}
+
+SpliceRelay::SpliceRelay(muduo::net::EventLoop *loop)
+    : loop_(loop),
+      fds_{-1, -1},
+      channels_(),
+      directions_(),
+      finished_(false),
+      closeCallback_()
+{
+
+}
+
+SpliceRelay::~SpliceRelay()
+{
+  release();
+}
+
+bool SpliceRelay::start(int fd0, int fd1)
+{
+  for(int i = 0; i < 2; ++i)
+  {
+    int pipefd[2];
+    if(::pipe2(pipefd, O_NONBLOCK | O_CLOEXEC) < 0)
+    {
+      LOG_SYSERR << "SpliceRelay pipe2";
+      release();
+      return false;
+    }
+    auto& direction = directions_[i];
+    direction.from = i;
+    direction.to = 1 - i;
+    direction.pipe_read = pipefd[0];
+    direction.pipe_write = pipefd[1];
+    // may be refused by pipe-max-size or the per user limit, keep the default size then
+    ::fcntl(direction.pipe_write, F_SETPIPE_SZ, kPipeSize);
+    int size = ::fcntl(direction.pipe_write, F_GETPIPE_SZ);
+    direction.pipe_size = size > 0 ? static_cast<size_t>(size) : 65536;
+  }
+  fds_[0] = ::fcntl(fd0, F_DUPFD_CLOEXEC, 0);
+  fds_[1] = ::fcntl(fd1, F_DUPFD_CLOEXEC, 0);
+  if(fds_[0] < 0 || fds_[1] < 0)
+  {
+    LOG_SYSERR << "SpliceRelay dup";
+    release();
+    return false;
+  }
+  for(int i = 0; i < 2; ++i)
+  {
+    channels_[i].reset(new muduo::net::Channel(loop_, fds_[i]));
+    channels_[i]->tie(shared_from_this());
+    channels_[i]->setReadCallback(boost::bind(&SpliceRelay::onEvent, this));
+    channels_[i]->setWriteCallback(boost::bind(&SpliceRelay::onEvent, this));
+    // hang up and errors show up as splice failures or end of file
+    channels_[i]->setCloseCallback(boost::bind(&SpliceRelay::onEvent, this));
+    channels_[i]->setErrorCallback(boost::bind(&SpliceRelay::onEvent, this));
+    channels_[i]->enableReading();
+  }
+  // the peers may have sent something before the channels exist
+  onEvent();
+  return true;
+}
+
+// an event of either socket may let both directions move, readable for one and writable for the other
+void SpliceRelay::onEvent()
+{
+  if(finished_)
+    return;
+  for(auto& direction : directions_)
+  {
+    if(!direction.done && !pump(direction))
+    {
+      finish(true);
+      return;
+    }
+  }
+  if(directions_[0].done && directions_[1].done)
+    finish(false);
+  else
+    update_channels();
+}
+
+bool SpliceRelay::pump(Direction &direction)
+{
+  for(int round = 0; round < kMaxRounds; ++round)
+  {
+    bool progress = false;
+    if(direction.pending > 0)
+    {
+      ssize_t n = ::splice(direction.pipe_read, NULL, fds_[direction.to], NULL, direction.pending,
+                           SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+      if(n > 0)
+      {
+        direction.pending -= static_cast<size_t>(n);
+        direction.bytes += n;
+        // fd0 is the accepted connection
+        stats::add(direction.from == 0 ? stats::kBytesIn : stats::kBytesOut, n);
+        progress = true;
+      }
+      else if(n < 0 && errno != EAGAIN && errno != EINTR)
+      {
+        LOG_SYSERR << "SpliceRelay splice to socket";
+        return false;
+      }
+    }
+    if(direction.eof)
+    {
+      if(direction.pending == 0)
+      {
+        ::shutdown(fds_[direction.to], SHUT_WR);
+        direction.done = true;
+      }
+      return true;
+    }
+    if(direction.pending < direction.pipe_size)
+    {
+      ssize_t n = ::splice(fds_[direction.from], NULL, direction.pipe_write, NULL,
+                           direction.pipe_size - direction.pending, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+      if(n > 0)
+      {
+        direction.pending += static_cast<size_t>(n);
+        progress = true;
+      }
+      else if(n == 0)
+      {
+        direction.eof = true;
+        progress = true;
+      }
+      else if(errno != EAGAIN && errno != EINTR)
+      {
+        LOG_SYSERR << "SpliceRelay splice from socket";
+        return false;
+      }
+    }
+    if(!progress)
+      break;
+  }
+  return true;
+}
+
+void SpliceRelay::update_channels()
+{
+  for(int i = 0; i < 2; ++i)
+  {
+    const auto& reading = directions_[i]; // fds_[i] is the source of direction i
+    const auto& writing = directions_[1 - i]; // and the destination of the other one
+    bool want_read = !reading.eof && reading.pending < reading.pipe_size;
+    bool want_write = !writing.done && writing.pending > 0;
+    auto& channel = channels_[i];
+    if(want_read != channel->isReading())
+    {
+      if(want_read)
+        channel->enableReading();
+      else
+        channel->disableReading();
+    }
+    if(want_write != channel->isWriting())
+    {
+      if(want_write)
+        channel->enableWriting();
+      else
+        channel->disableWriting();
+    }
+  }
+}
+
+void SpliceRelay::finish(bool error)
+{
+  finished_ = true;
+  LOG_DEBUG << "SpliceRelay finished " << (error ? "with error" : "") << " bytes "
+            << directions_[0].bytes << " " << directions_[1].bytes;
+  release();
+  if(closeCallback_)
+    closeCallback_();
+}
+
+void SpliceRelay::release()
+{
+  for(int i = 0; i < 2; ++i)
+  {
+    if(channels_[i])
+    {
+      channels_[i]->disableAll();
+      channels_[i]->remove();
+      // may be in the middle of its handleEvent
+      loop_->queueInLoop(boost::bind(&release_channel, channels_[i]));
+      channels_[i].reset();
+    }
+    if(fds_[i] >= 0)
+    {
+      ::close(fds_[i]);
+      fds_[i] = -1;
+    }
+    auto& direction = directions_[i];
+    if(direction.pipe_read >= 0)
+    {
+      ::close(direction.pipe_read);
+      ::close(direction.pipe_write);
+      direction.pipe_read = direction.pipe_write = -1;
+    }
+  }
+}
\ No newline at end of file
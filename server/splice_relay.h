@@ -0,0 +1,92 @@
+#pragma once
+
+#include <muduo/net/EventLoop.h>
+#include <boost/enable_shared_from_this.hpp>
+#include <boost/function.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+#include <stdint.h>
+
+namespace muduo
+{
+namespace net
+{
+class Channel;
+}
+}
+
+namespace zy
+{
+// relay two sockets through a pipe per direction with splice(2), the bytes never
+// enter user space, the pipe plays the role of the high water mark: a socket is
+// not read while its pipe is full, until the other socket drains it
+class SpliceRelay : boost::noncopyable, public boost::enable_shared_from_this<SpliceRelay>
+{
+ public:
+  typedef boost::function<void()> CloseCallback;
+
+  // pipe capacity asked for, the same as the high water mark of the buffer path
+  static const int kPipeSize = 1024 * 1024;
+
+  explicit SpliceRelay(muduo::net::EventLoop* loop);
+
+  ~SpliceRelay();
+
+  // called once both directions are finished or on error, the sockets are shut down
+  // for writing but still open, the caller closes them
+  void setCloseCallback(const CloseCallback& cb) { closeCallback_ = cb; }
+
+  // must be held by a shared_ptr, relay between fd0 and fd1 which the caller stopped
+  // reading from and has nothing left to write to, return false if pipes can't be made
+  bool start(int fd0, int fd1);
+
+  // bytes moved from fd0 to fd1 and from fd1 to fd0
+  int64_t bytes(int from) const { return directions_[from].bytes; }
+
+ private:
+  struct Direction
+  {
+    Direction()
+        : from(-1),
+          to(-1),
+          pipe_read(-1),
+          pipe_write(-1),
+          pipe_size(0),
+          pending(0),
+          eof(false),
+          done(false),
+          bytes(0)
+    { }
+
+    int from;
+    int to;
+    int pipe_read;
+    int pipe_write;
+    size_t pipe_size;
+    size_t pending; // bytes in the pipe
+    bool eof;
+    bool done;
+    int64_t bytes;
+  };
+  typedef boost::shared_ptr<muduo::net::Channel> ChannelPtr;
+
+  void onEvent();
+
+  // move as much as possible, return false on error
+  bool pump(Direction& direction);
+
+  void update_channels();
+
+  void finish(bool error);
+
+  void release();
+
+  muduo::net::EventLoop* loop_;
+  int fds_[2]; // dup of the sockets, so the channels here do not clash with muduo's
+  ChannelPtr channels_[2];
+  Direction directions_[2]; // 0 from fds_[0] to fds_[1], 1 the other way
+  bool finished_;
+  CloseCallback closeCallback_;
+};
+typedef boost::shared_ptr<SpliceRelay> SpliceRelayPtr;
+}
\ No newline at end of file
@@ -1,4 +1,8 @@
 #include "tunnel.h"
+#include "log_rate.h"
+#include "frame.h"
+#include "messages.h"
+#include "stats.h"
 
 #include <muduo/net/EventLoop.h>
 #include <boost/bind.hpp>
@@ -9,21 +13,45 @@
 using namespace zy;
 
 Tunnel::Tunnel(muduo::net::EventLoop *loop,
-               const muduo::net::InetAddress &addr,
+               const HappyEyeballs::AddressList &addresses,
                const muduo::net::TcpConnectionPtr &serverCon)
   : loop_(loop),
-    client_(loop_, addr, "proxy_client"),
+    client_(new HappyEyeballs(loop_, addresses, "proxy_client")),
     serverCon_(serverCon),
-    timerId_(),
-    host_addr_(addr.toIpPort()),
-    timeout_(5) // default timeout is 5 second
+    wheel_(nullptr),
+    timeout_entry_(),
+    idle_(),
+    host_addr_(addresses.empty() ? "" : addresses.front().toIpPort()),
+    timeout_(5), // default timeout is 5 second
+    idle_timeout_(0),
+    idle_bytes_(0),
+    compressor_(codec::kNone),
+    raw_(false),
+    early_data_(),
+    fast_open_(false),
+    start_(),
+    first_byte_(false),
+    serverFd_(-1),
+    relay_(),
+    marks_(),
+    paused_(),
+    budget_(nullptr)
 {
 
 }
 
 Tunnel::~Tunnel()
 {
-  LOG_INFO << "~Tunnel";
+  LOG_INFO_LIMITED(10) << "~Tunnel";
+  TimingWheel::cancel(timeout_entry_);
+  TimingWheel::cancel(idle_);
+  if(budget_)
+    budget_->remove(this);
+  if(compressor_.raw_bytes() > 0)
+    LOG_INFO_LIMITED(10) << "tunnel to " << host_addr_ << " compression " << compressor_.stats();
+  if(relay_)
+    LOG_INFO_LIMITED(10) << "tunnel to " << host_addr_ << " spliced " << relay_->bytes(0) << " bytes up, "
+             << relay_->bytes(1) << " bytes down";
 }
 
 void Tunnel::onClientConnection(const muduo::net::TcpConnectionPtr &con)
@@ -31,32 +59,45 @@ void Tunnel::onClientConnection(const muduo::net::TcpConnectionPtr &con)
   LOG_DEBUG << (con->connected() ? "up" : "down");
   if(con->connected())
   {
-    LOG_INFO << "proxy built! " << serverCon_->peerAddress().toIpPort() << " <-> " << con->peerAddress().toIpPort();
-    if(timerId_)
-    {
-      loop_->cancel(*timerId_);
-      timerId_.reset();
-    }
+    host_addr_ = con->peerAddress().toIpPort();
+    stats::observe(stats::kConnectSeconds, muduo::timeDifference(muduo::Timestamp::now(), start_));
+    LOG_INFO_LIMITED(10) << "proxy built! " << serverCon_->peerAddress().toIpPort() << " <-> " << con->peerAddress().toIpPort();
+    TimingWheel::cancel(timeout_entry_);
+    timeout_entry_.reset();
+    if(idle_timeout_ > 0)
+      idle_ = wheel_->add(idle_timeout_, boost::bind(&Tunnel::onIdleWeak, boost::weak_ptr<Tunnel>(shared_from_this())));
     con->setTcpNoDelay(true);
     con->setHighWaterMarkCallback(boost::bind(
-        &Tunnel::onHighWaterMarkWeak, boost::weak_ptr<Tunnel>(shared_from_this()), kClient, _1, _2), 1024 * 1024);
-    muduo::net::Buffer msg_buf;
+        &Tunnel::onHighWaterMarkWeak, boost::weak_ptr<Tunnel>(shared_from_this()), kClient, _1, _2),
+        marks_[kClient].mark());
+    muduo::net::Buffer& msg_buf = messages::output();
     {
-      msg::ServerMsg serverMsg;
+      msg::ServerMsg& serverMsg = messages::server_msg();
       serverMsg.set_type(msg::ServerMsg_Type_RESPONSE);
       auto response_ptr = serverMsg.mutable_response();
       response_ptr->set_rep(0x00);
-      response_ptr->set_addr(con->localAddress().ipNetEndian());
+      const muduo::net::InetAddress& local = con->localAddress();
+      if(local.family() == AF_INET)
+      {
+        response_ptr->set_addr(local.ipNetEndian());
+      }
+      else
+      {
+        const struct sockaddr_in6* sin6 = reinterpret_cast<const struct sockaddr_in6*>(local.getSockAddr());
+        response_ptr->set_addr6(&sin6->sin6_addr, sizeof(sin6->sin6_addr));
+      }
       response_ptr->set_port(con->localAddress().portNetEndian());
-      auto message_str = serverMsg.SerializeAsString();
-      int32_t length = static_cast<int32_t>(message_str.size());
-      msg_buf.appendInt32(length);
-      msg_buf.append(message_str.data(), length);
+      frame::append_message(&msg_buf, serverMsg);
     }
     serverCon_->send(&msg_buf);
-    serverCon_->setContext(con);
-    serverCon_->startRead();
     clientCon_ = con;
+    // the part that did not go in the syn
+    size_t sent = client_->fast_open_sent();
+    if(early_data_.size() > sent)
+      con->send(early_data_.data() + sent, static_cast<int>(early_data_.size() - sent));
+    std::string().swap(early_data_);
+    if((!raw_ || !start_splice()) && !paused_[kServer])
+      serverCon_->startRead();
     if(onConnectionCallback_)
       onConnectionCallback_();
   }
@@ -69,38 +110,58 @@ void Tunnel::onClientConnection(const muduo::net::TcpConnectionPtr &con)
 void Tunnel::onClientMessage(const muduo::net::TcpConnectionPtr &con, muduo::net::Buffer *buf, muduo::Timestamp)
 {
   LOG_DEBUG << "message from remote server " << con->peerAddress().toIpPort() << " " << buf->readableBytes();
-  muduo::net::Buffer msg_buf;
+  stats::add(stats::kBytesOut, buf->readableBytes());
+  touch();
+  if(!first_byte_)
+  {
+    first_byte_ = true;
+    stats::observe(stats::kFirstByteSeconds, muduo::timeDifference(muduo::Timestamp::now(), start_));
+  }
+  if(raw_)
+  {
+    serverCon_->send(buf);
+  }
+  else if(compressor_.codec() == codec::kNone)
   {
-    msg::ServerMsg serverMsg;
-    serverMsg.set_type(msg::ServerMsg_Type_DATA);
-    auto data_ptr = serverMsg.mutable_data();
-    data_ptr->assign(buf->peek(), buf->peek() + buf->readableBytes());
+    // frame the input buffer in place, send() writes it straight to the socket
+    frame::prepend_header(buf, frame::kData);
+    serverCon_->send(buf);
+  }
+  else
+  {
+    muduo::net::Buffer& msg_buf = messages::output();
+    compressor_.append(&msg_buf, frame::kData, buf->peek(), buf->readableBytes());
     buf->retrieveAll();
-    auto message_str = serverMsg.SerializeAsString();
-    int32_t length = static_cast<int32_t>(message_str.size());
-    msg_buf.appendInt32(length);
-    msg_buf.append(message_str.data(), length);
+    serverCon_->send(&msg_buf);
   }
-  serverCon_->send(&msg_buf);
 }
 
 void Tunnel::setup()
 {
-  client_.setConnectionCallback(boost::bind(&Tunnel::onClientConnection, this, _1));
-  client_.setMessageCallback(boost::bind(&Tunnel::onClientMessage, this, _1, _2, _3));
+  start_ = muduo::Timestamp::now();
+  client_->setConnectionCallback(boost::bind(&Tunnel::onClientConnection, this, _1));
+  client_->setMessageCallback(boost::bind(&Tunnel::onClientMessage, this, _1, _2, _3));
+  client_->setFailCallback(boost::bind(&Tunnel::onConnectFailedWeak, boost::weak_ptr<Tunnel>(shared_from_this())));
   serverCon_->setHighWaterMarkCallback(boost::bind(&Tunnel::onHighWaterMarkWeak, boost::weak_ptr<Tunnel>(shared_from_this()),
-                                                   kServer, _1, _2), 1024 * 1024);
-  auto timer = loop_->runAfter(timeout_, boost::bind(&Tunnel::onTimeoutWeak, boost::weak_ptr<Tunnel>(shared_from_this())));
-  timerId_.reset(new muduo::net::TimerId(timer));
+                                                   kServer, _1, _2), marks_[kServer].mark());
+  if(budget_)
+    budget_->add(this);
+  timeout_entry_ = wheel_->add(timeout_, boost::bind(&Tunnel::onTimeoutWeak, boost::weak_ptr<Tunnel>(shared_from_this())));
+}
+
+void Tunnel::connect()
+{
+  if(fast_open_ && !early_data_.empty())
+    client_->set_fast_open_data(early_data_);
+  client_->connect();
 }
 
 void Tunnel::teardown()
 {
-  client_.setConnectionCallback(muduo::net::defaultConnectionCallback);
-  client_.setMessageCallback(muduo::net::defaultMessageCallback);
+  client_->setConnectionCallback(muduo::net::defaultConnectionCallback);
+  client_->setMessageCallback(muduo::net::defaultMessageCallback);
   if(serverCon_)
   {
-    serverCon_->setContext(boost::any());
     serverCon_->shutdown();
   }
   clientCon_.reset();
@@ -110,70 +171,164 @@ void Tunnel::onTimeout()
 {
   if(serverCon_)
   {
-    LOG_WARN << "proxy_client of address " << serverCon_->peerAddress().toIp() << " to " << host_addr_ << " connect timeout";
-    client_.stop();
+    LOG_WARN_LIMITED(10) << "proxy_client of address " << serverCon_->peerAddress().toIp() << " to " << host_addr_ << " connect timeout";
+    stats::add(stats::kConnectTimeouts);
+    client_->stop();
+    send_response_and_shutdown(0x04);
+  }
+  else
+  {
+    LOG_ERROR << "serverCon_ is not valid now!";
+  }
+}
 
-    muduo::net::Buffer msg_buf;
+void Tunnel::onIdle()
+{
+  idle_.reset();
+  if(relay_)
+  {
+    // spliced bytes never pass through onMessage, look at the counters of the relay instead
+    int64_t bytes = relay_->bytes(0) + relay_->bytes(1);
+    if(bytes != idle_bytes_)
     {
-      msg::ServerMsg serverMsg;
-      serverMsg.set_type(msg::ServerMsg_Type_RESPONSE);
-      auto response_ptr = serverMsg.mutable_response();
-      response_ptr->set_rep(0x04);
-      auto message_str = serverMsg.SerializeAsString();
-      int32_t length = static_cast<int32_t>(message_str.size());
-      msg_buf.appendInt32(length);
-      msg_buf.append(message_str.data(), length);
+      idle_bytes_ = bytes;
+      idle_ = wheel_->add(idle_timeout_, boost::bind(&Tunnel::onIdleWeak, boost::weak_ptr<Tunnel>(shared_from_this())));
+      return;
     }
+  }
+  LOG_INFO_LIMITED(10) << "tunnel to " << host_addr_ << " idle for " << idle_timeout_ << " seconds, close it";
+  stats::add(stats::kIdleTimeouts);
+  if(clientCon_)
+    clientCon_->forceClose();
+  if(serverCon_)
+    serverCon_->forceClose();
+}
 
-    serverCon_->send(&msg_buf);
-    serverCon_->shutdown();
+void Tunnel::onConnectFailed()
+{
+  TimingWheel::cancel(timeout_entry_);
+  timeout_entry_.reset();
+  if(serverCon_)
+  {
+    LOG_WARN_LIMITED(10) << "proxy_client of address " << serverCon_->peerAddress().toIp() << " to " << host_addr_ << " connect failed";
+    send_response_and_shutdown(0x05);
   }
-  else
+}
+
+void Tunnel::send_response_and_shutdown(int rep)
+{
+  muduo::net::Buffer& msg_buf = messages::output();
   {
-    LOG_ERROR << "serverCon_ is not valid now!";
+    msg::ServerMsg& serverMsg = messages::server_msg();
+    serverMsg.set_type(msg::ServerMsg_Type_RESPONSE);
+    auto response_ptr = serverMsg.mutable_response();
+    response_ptr->set_rep(rep);
+    frame::append_message(&msg_buf, serverMsg);
   }
+
+  serverCon_->send(&msg_buf);
+  serverCon_->shutdown();
+}
+
+bool Tunnel::start_splice()
+{
+  // whatever is buffered in user space would have to be sent first, keep the buffer path then
+  if(serverFd_ < 0 || client_->fd() < 0
+     || serverCon_->outputBuffer()->readableBytes() > 0 || serverCon_->inputBuffer()->readableBytes() > 0
+     || clientCon_->inputBuffer()->readableBytes() > 0 || clientCon_->outputBuffer()->readableBytes() > 0)
+  {
+    LOG_DEBUG << "tunnel to " << host_addr_ << " can't splice, relay by buffers";
+    return false;
+  }
+  clientCon_->stopRead();
+  relay_.reset(new SpliceRelay(loop_));
+  relay_->setCloseCallback(boost::bind(&Tunnel::onSpliceCloseWeak, boost::weak_ptr<Tunnel>(shared_from_this())));
+  if(!relay_->start(serverFd_, client_->fd()))
+  {
+    relay_.reset();
+    clientCon_->startRead();
+    return false;
+  }
+  LOG_DEBUG << "tunnel to " << host_addr_ << " relay by splice";
+  return true;
+}
+
+void Tunnel::onSpliceClose()
+{
+  // both sockets are shut down for writing already, close them through muduo
+  if(clientCon_)
+    clientCon_->forceClose();
+  if(serverCon_)
+    serverCon_->forceClose();
 }
 
 void Tunnel::onHighWaterMark(Tunnel::ServerClient which,
                              const muduo::net::TcpConnectionPtr &con,
                              size_t bytes_to_sent)
 {
-  LOG_INFO << (which == kServer ? "server" : "client")
+  LOG_INFO_LIMITED(10) << (which == kServer ? "server" : "client")
            << " onHighWaterMark " << con->name() << " bytes " << bytes_to_sent;
-  if(which == kServer)
+  stats::add(stats::kHighWaterMarks);
+  // 只关心发送的那个方向
+  if(con->outputBuffer()->readableBytes() > 0)
   {
-    // 只关心发送的那个方向
-    if(serverCon_->outputBuffer()->readableBytes() > 0)
-    {
-      clientCon_->stopRead();
-      serverCon_->setWriteCompleteCallback(boost::bind(&Tunnel::onWriteCompleteWeak,
-          boost::weak_ptr<Tunnel>(shared_from_this()), kServer, _1));
-    }
-  }
-  else
-  {
-    if(clientCon_->outputBuffer()->readableBytes() > 0)
-    {
-      serverCon_->stopRead();
-      clientCon_->setWriteCompleteCallback(boost::bind(&Tunnel::onWriteCompleteWeak,
-          boost::weak_ptr<Tunnel>(shared_from_this()), kClient, _1));
-    }
+    marks_[which].onHighWaterMark(bytes_to_sent);
+    pause_reading(other(which), kHighWater);
+    con->setWriteCompleteCallback(boost::bind(&Tunnel::onWriteCompleteWeak,
+        boost::weak_ptr<Tunnel>(shared_from_this()), which, _1));
   }
 }
 
 void Tunnel::onWriteComplete(Tunnel::ServerClient which, const muduo::net::TcpConnectionPtr &con)
 {
-  LOG_INFO << (which == kServer ? "server" : "client")
+  LOG_INFO_LIMITED(10) << (which == kServer ? "server" : "client")
            << " onWriteComplete " << con->name();
-  if(which == kServer)
+  con->setWriteCompleteCallback(muduo::net::WriteCompleteCallback());
+  if(marks_[which].onWriteComplete())
   {
-    clientCon_->startRead();
-    serverCon_->setWriteCompleteCallback(muduo::net::WriteCompleteCallback());
+    LOG_DEBUG << con->name() << " high water mark " << marks_[which].mark();
+    con->setHighWaterMarkCallback(boost::bind(&Tunnel::onHighWaterMarkWeak,
+        boost::weak_ptr<Tunnel>(shared_from_this()), which, _1, _2), marks_[which].mark());
+  }
+  resume_reading(other(which), kHighWater);
+}
+
+void Tunnel::pause_reading(Tunnel::ServerClient which, int reason)
+{
+  const auto& con = connection(which);
+  if(!paused_[which] && con && !relay_)
+    con->stopRead();
+  paused_[which] |= reason;
+}
+
+void Tunnel::resume_reading(Tunnel::ServerClient which, int reason)
+{
+  int paused = paused_[which];
+  paused_[which] &= ~reason;
+  const auto& con = connection(which);
+  if(paused && !paused_[which] && con && !relay_)
+    con->startRead();
+}
+
+size_t Tunnel::buffered() const
+{
+  // nothing is read before the target is connected
+  if(!clientCon_)
+    return 0;
+  return serverCon_->outputBuffer()->readableBytes() + clientCon_->outputBuffer()->readableBytes();
+}
+
+void Tunnel::throttle(bool on)
+{
+  if(on)
+  {
+    pause_reading(kServer, kBudget);
+    pause_reading(kClient, kBudget);
   }
   else
   {
-    serverCon_->startRead();
-    clientCon_->setWriteCompleteCallback(muduo::net::WriteCompleteCallback());
+    resume_reading(kServer, kBudget);
+    resume_reading(kClient, kBudget);
   }
 }
 
@@ -203,4 +358,23 @@ void Tunnel::onTimeoutWeak(const boost::weak_ptr<Tunnel> &wkTunnel)
     tunnel->onTimeout();
 }
 
+void Tunnel::onIdleWeak(const boost::weak_ptr<Tunnel> &wkTunnel)
+{
+  auto tunnel = wkTunnel.lock();
+  if(tunnel)
+    tunnel->onIdle();
+}
+
+void Tunnel::onConnectFailedWeak(const boost::weak_ptr<Tunnel> &wkTunnel)
+{
+  auto tunnel = wkTunnel.lock();
+  if(tunnel)
+    tunnel->onConnectFailed();
+}
 
+void Tunnel::onSpliceCloseWeak(const boost::weak_ptr<Tunnel> &wkTunnel)
+{
+  auto tunnel = wkTunnel.lock();
+  if(tunnel)
+    tunnel->onSpliceClose();
+}
\ No newline at end of file
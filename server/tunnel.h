@@ -1,18 +1,26 @@
 #pragma once
 
+#include "compressor.h"
+#include "flow_control.h"
+#include "happy_eyeballs.h"
+#include "splice_relay.h"
+#include "timing_wheel.h"
+
 #include <muduo/net/TcpClient.h>
 #include <boost/noncopyable.hpp>
-#include <muduo/net/TimerId.h>
 
 namespace zy
 {
-class Tunnel : boost::noncopyable, public boost::enable_shared_from_this<Tunnel>
+class Tunnel : boost::noncopyable,
+               public boost::enable_shared_from_this<Tunnel>,
+               public BufferBudget::Member
 {
  public:
   typedef boost::function<void()> onConnectionCallback;
 
+  // race connects to addresses, see HappyEyeballs
   Tunnel(muduo::net::EventLoop* loop,
-         const muduo::net::InetAddress& addr,
+         const HappyEyeballs::AddressList& addresses,
          const muduo::net::TcpConnectionPtr& serverCon);
 
   ~Tunnel();
@@ -22,15 +30,57 @@ class Tunnel : boost::noncopyable, public boost::enable_shared_from_this<Tunnel>
     onConnectionCallback_ = cb;
   }
 
+  void setWinnerCallback(const HappyEyeballs::WinnerCallback& cb) { client_->setWinnerCallback(cb); }
+
   void onClientConnection(const muduo::net::TcpConnectionPtr& con);
 
   void onClientMessage(const muduo::net::TcpConnectionPtr& con, muduo::net::Buffer* buf, muduo::Timestamp);
 
   void set_timeout(double timeout) { timeout_ = timeout; }
 
+  // codec of data sent back to local_server
+  void set_codec(codec::Type type, int level) { compressor_.set_codec(type, level); }
+
+  // relay without frames once connected, with splice(2) if server_fd is known
+  void set_raw(bool raw, int server_fd)
+  {
+    raw_ = raw;
+    serverFd_ = server_fd;
+  }
+
+  // first payload sent with the request by an optimistic local_server, written to the
+  // target once connected, taken by swap
+  void set_early_data(std::string* data) { early_data_.swap(*data); }
+
+  // send the early data in the syn with tcp fast open, must be called before connect
+  void set_fast_open(bool fast_open) { fast_open_ = fast_open; }
+
+  // buffer budget of the loop, must be called before setup
+  void set_budget(BufferBudget* budget) { budget_ = budget; }
+
+  // connect and idle timeouts go to the wheel of the loop, must be called before setup
+  void set_wheel(TimingWheel* wheel) { wheel_ = wheel; }
+
+  // close the tunnel after this many seconds without traffic once connected, 0 means never
+  void set_idle_timeout(double timeout) { idle_timeout_ = timeout; }
+
+  // traffic seen, push the idle timeout back
+  void touch()
+  {
+    if(idle_)
+      wheel_->refresh(idle_, idle_timeout_);
+  }
+
   void setup();
 
-  void connect() { client_.connect(); }
+  size_t buffered() const override;
+
+  void throttle(bool on) override;
+
+  // connection to the target, null before it is built and after teardown
+  const muduo::net::TcpConnectionPtr& clientCon() const { return clientCon_; }
+
+  void connect();
 
  private:
   enum ServerClient
@@ -39,6 +89,24 @@ class Tunnel : boost::noncopyable, public boost::enable_shared_from_this<Tunnel>
     kClient
   };
 
+  // why a connection does not read, it reads again once all reasons are gone
+  enum PauseReason
+  {
+    kHighWater = 1, // output buffer of the other connection is over its mark
+    kBudget = 2 // the loop is over its buffer budget
+  };
+
+  const muduo::net::TcpConnectionPtr& connection(ServerClient which) const
+  {
+    return which == kServer ? serverCon_ : clientCon_;
+  }
+
+  static ServerClient other(ServerClient which) { return which == kServer ? kClient : kServer; }
+
+  void pause_reading(ServerClient which, int reason);
+
+  void resume_reading(ServerClient which, int reason);
+
   void teardown();
 
   void onHighWaterMark(ServerClient which, const muduo::net::TcpConnectionPtr& con, size_t bytes_to_sent);
@@ -47,6 +115,17 @@ class Tunnel : boost::noncopyable, public boost::enable_shared_from_this<Tunnel>
 
   void onTimeout();
 
+  void onIdle();
+
+  void onConnectFailed();
+
+  void send_response_and_shutdown(int rep);
+
+  // hand both sockets to a SpliceRelay, return false if they still have buffered data
+  bool start_splice();
+
+  void onSpliceClose();
+
   static void onHighWaterMarkWeak(const boost::weak_ptr<Tunnel>& wkTunnel, ServerClient which,
                              const muduo::net::TcpConnectionPtr& con, size_t bytes_to_sent);
 
@@ -55,14 +134,35 @@ class Tunnel : boost::noncopyable, public boost::enable_shared_from_this<Tunnel>
 
   static void onTimeoutWeak(const boost::weak_ptr<Tunnel>& wkTunnel);
 
+  static void onIdleWeak(const boost::weak_ptr<Tunnel>& wkTunnel);
+
+  static void onConnectFailedWeak(const boost::weak_ptr<Tunnel>& wkTunnel);
+
+  static void onSpliceCloseWeak(const boost::weak_ptr<Tunnel>& wkTunnel);
+
   muduo::net::EventLoop* loop_;
-  muduo::net::TcpClient client_;
+  HappyEyeballsPtr client_;
   muduo::net::TcpConnectionPtr serverCon_;
   muduo::net::TcpConnectionPtr clientCon_;
   onConnectionCallback onConnectionCallback_;
-  std::unique_ptr<muduo::net::TimerId> timerId_;
+  TimingWheel* wheel_;
+  WheelEntryPtr timeout_entry_; // connect timeout
+  WheelEntryPtr idle_; // armed once connected
   muduo::string host_addr_;
   double timeout_;
+  double idle_timeout_;
+  int64_t idle_bytes_; // spliced bytes at the last idle check
+  Compressor compressor_;
+  bool raw_;
+  std::string early_data_;
+  bool fast_open_;
+  muduo::Timestamp start_; // setup, for connect and first byte latency
+  bool first_byte_;
+  int serverFd_;
+  SpliceRelayPtr relay_;
+  AdaptiveMark marks_[2]; // of the output buffer of each connection
+  int paused_[2]; // PauseReason of each connection
+  BufferBudget* budget_;
 };
 typedef boost::shared_ptr<Tunnel> TunnelPtr;
 }
@@ -0,0 +1,123 @@
+#include "udp_relay.h"
+#include "log_rate.h"
+#include "frame.h"
+#include "messages.h"
+#include "socks_address.h"
+#include "stats.h"
+
+#include <muduo/base/Logging.h>
+#include <muduo/net/EventLoop.h>
+#include <boost/bind.hpp>
+
+using namespace zy;
+
+UdpRelay::UdpRelay(muduo::net::EventLoop *loop,
+                   const muduo::net::TcpConnectionPtr &serverCon,
+                   Resolver &resolver)
+  : loop_(loop),
+    serverCon_(serverCon),
+    resolver_(resolver),
+    sockets_(),
+    datagrams_()
+{
+
+}
+
+UdpRelay::~UdpRelay()
+{
+  LOG_INFO_LIMITED(10) << "udp association of " << serverCon_->peerAddress().toIpPort() << " relayed "
+           << datagrams_[0] << " datagrams up, " << datagrams_[1] << " down";
+}
+
+UdpSocket* UdpRelay::socket(int family)
+{
+  auto& socket = sockets_[family == AF_INET6 ? 1 : 0];
+  if(!socket)
+  {
+    std::unique_ptr<UdpSocket> udp(new UdpSocket(loop_, family));
+    if(!udp->bind(muduo::net::InetAddress(0, false, family == AF_INET6)))
+      return nullptr;
+    udp->setMessageCallback(boost::bind(&UdpRelay::onTargetMessage, this, _1, _2));
+    udp->start();
+    socket = std::move(udp);
+  }
+  return socket.get();
+}
+
+void UdpRelay::onDatagram(const muduo::StringPiece &payload)
+{
+  muduo::net::InetAddress to;
+  std::string host;
+  uint16_t port;
+  if(!socks::parse(payload.data(), payload.size(), &to, &host, &port))
+  {
+    LOG_DEBUG << "bad address of datagram from " << serverCon_->peerAddress().toIpPort();
+    return;
+  }
+  ++datagrams_[0];
+  int length = socks::address_length(payload.data(), payload.size());
+  if(!host.empty())
+  {
+    // the answer may come later, the datagram has to be kept until then
+    resolver_.resolve(host, port,
+                      boost::bind(&UdpRelay::onResolveWeak, wkRelay(shared_from_this()),
+                                  std::string(payload.data() + length, payload.size() - length), _1),
+                      boost::bind(&UdpRelay::onResolveError, host));
+    return;
+  }
+  UdpSocket* udp = socket(to.family());
+  if(udp)
+    udp->send(to, payload.data() + length, payload.size() - length);
+}
+
+void UdpRelay::flush()
+{
+  for(auto& socket : sockets_)
+  {
+    if(socket)
+      socket->flush();
+  }
+}
+
+void UdpRelay::onResolve(const std::string &data, const Resolver::AddressList &addresses)
+{
+  // happy eyeballs order, the first one is the best guess
+  UdpSocket* udp = addresses.empty() ? nullptr : socket(addresses.front().family());
+  if(udp)
+  {
+    udp->send(addresses.front(), data.data(), data.size());
+    udp->flush();
+  }
+}
+
+void UdpRelay::onTargetMessage(const UdpSocket::Datagram *datagrams, int count)
+{
+  if(!serverCon_->connected() || serverCon_->outputBuffer()->readableBytes() > kMaxBuffered)
+  {
+    // local_server does not keep up, datagrams may be lost anyway
+    stats::add(stats::kDatagramsDropped, count);
+    return;
+  }
+  muduo::net::Buffer& buf = messages::output();
+  char addr[socks::kMaxIpAddressLength];
+  for(int i = 0; i < count; ++i)
+  {
+    size_t addr_len = socks::encode(datagrams[i].peer, addr);
+    frame::append_datagram(&buf, addr, addr_len, datagrams[i].data.data(), datagrams[i].data.size());
+    stats::add(stats::kBytesOut, datagrams[i].data.size());
+  }
+  datagrams_[1] += count;
+  serverCon_->send(&buf);
+}
+
+void UdpRelay::onResolveWeak(const wkRelay &relay, const std::string &data, const Resolver::AddressList &addresses)
+{
+  auto relay_ptr = relay.lock();
+  if(relay_ptr)
+    relay_ptr->onResolve(data, addresses);
+}
+
+void UdpRelay::onResolveError(const muduo::string &host)
+{
+  LOG_DEBUG << "datagram to " << host << " dropped, resolve error";
+}
\ No newline at end of file
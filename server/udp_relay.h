@@ -0,0 +1,54 @@
+#pragma once
+
+#include "Resolver.h"
+#include "udp_socket.h"
+
+#include <boost/enable_shared_from_this.hpp>
+#include <boost/noncopyable.hpp>
+#include <muduo/net/TcpConnection.h>
+#include <memory>
+#include <string>
+
+namespace zy
+{
+// udp association of one connection from local_server, datagrams of its kDatagram frames
+// go to their targets from udp sockets of the association, and datagrams from anyone who
+// sends to those sockets go back the same way, it lives as long as the connection
+class UdpRelay : boost::noncopyable, public boost::enable_shared_from_this<UdpRelay>
+{
+ public:
+  // datagrams from targets are dropped while the connection has this much to send
+  static const size_t kMaxBuffered = 4 * 1024 * 1024;
+
+  UdpRelay(muduo::net::EventLoop* loop, const muduo::net::TcpConnectionPtr& serverCon, Resolver& resolver);
+
+  ~UdpRelay();
+
+  // payload of a frame::kDatagram frame, queued until flush
+  void onDatagram(const muduo::StringPiece& payload);
+
+  // send what onDatagram queued, with one sendmmsg per socket
+  void flush();
+
+ private:
+  typedef boost::weak_ptr<UdpRelay> wkRelay;
+
+  // socket of the family, made on first use, null if that fails
+  UdpSocket* socket(int family);
+
+  void onTargetMessage(const UdpSocket::Datagram* datagrams, int count);
+
+  void onResolve(const std::string& data, const Resolver::AddressList& addresses);
+
+  static void onResolveWeak(const wkRelay& relay, const std::string& data, const Resolver::AddressList& addresses);
+
+  static void onResolveError(const muduo::string& host);
+
+  muduo::net::EventLoop* loop_;
+  muduo::net::TcpConnectionPtr serverCon_;
+  Resolver& resolver_;
+  std::unique_ptr<UdpSocket> sockets_[2]; // ipv4 and ipv6
+  int64_t datagrams_[2]; // up and down
+};
+typedef boost::shared_ptr<UdpRelay> UdpRelayPtr;
+}
\ No newline at end of file
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <boost/noncopyable.hpp>
+#include <memory>
+#include <stddef.h>
+#include <vector>
+
+namespace zy
+{
+// per loop slab of per connection objects, handed out from a free list and reached
+// through the context of the connection, so a read event needs no name lookup,
+// T needs a default constructor and reset(), which drops what the last user left
+template<typename T>
+class SessionPool : boost::noncopyable
+{
+ public:
+  explicit SessionPool(size_t chunk_size = 64)
+      : chunk_size_(chunk_size),
+        chunks_(),
+        free_(),
+        in_use_(0)
+  { }
+
+  T* acquire()
+  {
+    if(free_.empty())
+      grow();
+    T* session = free_.back();
+    free_.pop_back();
+    ++in_use_;
+    return session;
+  }
+
+  void release(T* session)
+  {
+    session->reset();
+    free_.push_back(session);
+    --in_use_;
+  }
+
+  size_t in_use() const { return in_use_; }
+
+  size_t capacity() const { return chunks_.size() * chunk_size_; }
+
+ private:
+  void grow()
+  {
+    chunks_.emplace_back(new T[chunk_size_]);
+    T* chunk = chunks_.back().get();
+    // hand out the lowest address first
+    for(size_t i = chunk_size_; i > 0; --i)
+      free_.push_back(chunk + i - 1);
+  }
+
+  size_t chunk_size_;
+  std::vector<std::unique_ptr<T[]>> chunks_;
+  std::vector<T*> free_;
+  size_t in_use_;
+};
+}
\ No newline at end of file
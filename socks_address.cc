@@ -0,0 +1,90 @@
+#include "socks_address.h"
+
+#include <muduo/net/Endian.h>
+#include <string.h>
+
+using namespace zy;
+
+int socks::address_length(const char *data, size_t len)
+{
+  if(len < 2)
+    return 0;
+  size_t length;
+  switch(static_cast<uint8_t>(data[0]))
+  {
+    case kIpv4:
+      length = 1 + 4 + 2;
+      break;
+    case kDomain:
+      length = 1 + 1 + static_cast<uint8_t>(data[1]) + 2;
+      break;
+    case kIpv6:
+      length = 1 + 16 + 2;
+      break;
+    default:
+      return -1;
+  }
+  return len >= length ? static_cast<int>(length) : 0;
+}
+
+bool socks::parse(const char *data, size_t len, muduo::net::InetAddress *ip, std::string *host, uint16_t *port)
+{
+  int length = address_length(data, len);
+  if(length <= 0 || (data[0] == kDomain && data[1] == 0))
+    return false;
+  uint16_t be16;
+  ::memcpy(&be16, data + length - 2, sizeof(be16));
+  *port = muduo::net::sockets::networkToHost16(be16);
+  if(data[0] == kDomain)
+    host->assign(data + 2, static_cast<uint8_t>(data[1]));
+  else
+    ip_address(data + 1, length - 3, *port, ip);
+  return true;
+}
+
+bool socks::ip_address(const char *data, size_t len, uint16_t port, muduo::net::InetAddress *addr)
+{
+  if(len == 4)
+  {
+    struct sockaddr_in sin;
+    ::memset(&sin, 0, sizeof sin);
+    sin.sin_family = AF_INET;
+    ::memcpy(&sin.sin_addr, data, 4);
+    sin.sin_port = muduo::net::sockets::hostToNetwork16(port);
+    *addr = muduo::net::InetAddress(sin);
+    return true;
+  }
+  if(len == 16)
+  {
+    struct sockaddr_in6 sin6;
+    ::memset(&sin6, 0, sizeof sin6);
+    sin6.sin6_family = AF_INET6;
+    ::memcpy(&sin6.sin6_addr, data, 16);
+    sin6.sin6_port = muduo::net::sockets::hostToNetwork16(port);
+    *addr = muduo::net::InetAddress(sin6);
+    return true;
+  }
+  return false;
+}
+
+size_t socks::encode(const muduo::net::InetAddress &addr, char *out)
+{
+  size_t length;
+  if(addr.family() == AF_INET)
+  {
+    const struct sockaddr_in* sin = reinterpret_cast<const struct sockaddr_in*>(addr.getSockAddr());
+    out[0] = kIpv4;
+    ::memcpy(out + 1, &sin->sin_addr, 4);
+    length = 1 + 4;
+  }
+  else
+  {
+    const struct sockaddr_in6* sin6 = reinterpret_cast<const struct sockaddr_in6*>(addr.getSockAddr());
+    out[0] = kIpv6;
+    ::memcpy(out + 1, &sin6->sin6_addr, 16);
+    length = 1 + 16;
+  }
+  uint16_t be16 = addr.portNetEndian();
+  ::memcpy(out + length, &be16, sizeof(be16));
+  return length + sizeof(be16);
+}
\ No newline at end of file
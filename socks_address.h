@@ -0,0 +1,37 @@
+#pragma once
+
+#include <muduo/net/InetAddress.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+
+namespace zy
+{
+// address of socks5 requests, replies and udp datagrams,
+// atyp, then the address, then the port in network byte order
+namespace socks
+{
+enum AddressType
+{
+  kIpv4 = 0x01, // 4 bytes
+  kDomain = 0x03, // length byte, then the name
+  kIpv6 = 0x04 // 16 bytes
+};
+
+// longest address encode() writes, an ipv6 one
+const size_t kMaxIpAddressLength = 1 + 16 + 2;
+
+// bytes of the address at the front of data, 0 if data is shorter than that, -1 if atyp is unknown
+int address_length(const char* data, size_t len);
+
+// the address at the front of data, ip literals go to ip, a domain name goes to host and port,
+// false if it is not complete, atyp is unknown or the domain name is empty
+bool parse(const char* data, size_t len, muduo::net::InetAddress* ip, std::string* host, uint16_t* port);
+
+// an ipv4 address of 4 bytes or an ipv6 one of 16 bytes in network byte order, false for other lengths
+bool ip_address(const char* data, size_t len, uint16_t port, muduo::net::InetAddress* addr);
+
+// write addr to out, which holds kMaxIpAddressLength bytes, return bytes written
+size_t encode(const muduo::net::InetAddress& addr, char* out);
+}
+}
\ No newline at end of file
@@ -0,0 +1,185 @@
+#include "stats.h"
+
+#include <muduo/base/Mutex.h>
+#include <atomic>
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+using namespace zy;
+
+namespace
+{
+struct MetricInfo
+{
+  const char* name;
+  const char* label; // state of the gauge, nullptr if none
+  const char* type;
+  const char* help;
+};
+
+const MetricInfo kMetrics[stats::kMetricNum] =
+{
+  { "connections", "start", "gauge", "accepted connections by state" },
+  { "connections", "verified", "gauge", "accepted connections by state" },
+  { "connections", "gotcmd", "gauge", "accepted connections by state" },
+  { "connections", "resolved", "gauge", "accepted connections by state" },
+  { "connections", "transport", "gauge", "accepted connections by state" },
+  { "connections", "mux", "gauge", "accepted connections by state" },
+  { "bytes_in_total", nullptr, "counter", "bytes read from accepted connections" },
+  { "bytes_out_total", nullptr, "counter", "bytes read from the other end of tunnels" },
+  { "codec_raw_bytes_total", nullptr, "counter", "payload bytes before compression" },
+  { "codec_wire_bytes_total", nullptr, "counter", "payload bytes after compression" },
+  { "high_water_marks_total", nullptr, "counter", "output buffers of tunnels over the high water mark" },
+  { "budget_throttles_total", nullptr, "counter", "tunnels stopped because of the buffer budget" },
+  { "connect_timeouts_total", nullptr, "counter", "tunnels and streams timed out while connecting" },
+  { "dns_timeouts_total", nullptr, "counter", "dns queries timed out" },
+  { "idle_timeouts_total", nullptr, "counter", "tunnels closed after idle_timeout without traffic" },
+  { "udp_datagrams_in_total", nullptr, "counter", "datagrams read from udp sockets" },
+  { "udp_datagrams_out_total", nullptr, "counter", "datagrams sent by udp sockets" },
+  { "udp_datagrams_dropped_total", nullptr, "counter", "datagrams truncated or not sent because the socket buffer was full" },
+  { "tfo_accepted_total", nullptr, "counter", "accepted connections with data in the syn" },
+  { "tfo_connects_total", nullptr, "counter", "connects with data in the syn acked by the peer" },
+  { "tfo_fallbacks_total", nullptr, "counter", "fast open connects without a cookie or with the syn data not acked" },
+  { "log_dropped_total", nullptr, "counter", "log lines dropped because the log thread fell behind" },
+  { "log_suppressed_total", nullptr, "counter", "log lines over the rate limit of their call site" },
+  { "direct_connects_total", nullptr, "counter", "connects sent straight to the target by a route rule" },
+  { "route_reloads_total", nullptr, "counter", "route rule files reloaded after a change" },
+};
+
+struct HistogramInfo
+{
+  const char* name;
+  const char* help;
+};
+
+const HistogramInfo kHistograms[stats::kHistogramNum] =
+{
+  { "dns_seconds", "latency of dns queries" },
+  { "connect_seconds", "latency of connecting to the target" },
+  { "first_byte_seconds", "latency from the socks request to the first byte of the target" },
+};
+
+// upper bounds in seconds, the last bucket is +Inf
+const double kBuckets[] = { 0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10 };
+const int kBucketNum = sizeof(kBuckets) / sizeof(kBuckets[0]) + 1;
+
+// written by its thread only, so an add is a load and a store without lock prefix
+struct Shard
+{
+  std::atomic<int64_t> metrics[stats::kMetricNum];
+  std::atomic<int64_t> buckets[stats::kHistogramNum][kBucketNum];
+  std::atomic<int64_t> sum_us[stats::kHistogramNum];
+
+  Shard()
+  {
+    for(auto& metric : metrics)
+      metric.store(0, std::memory_order_relaxed);
+    for(auto& histogram : buckets)
+      for(auto& bucket : histogram)
+        bucket.store(0, std::memory_order_relaxed);
+    for(auto& sum : sum_us)
+      sum.store(0, std::memory_order_relaxed);
+  }
+};
+
+void add_relaxed(std::atomic<int64_t>* value, int64_t n)
+{
+  value->store(value->load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+}
+
+muduo::MutexLock g_mutex;
+// shards of exited threads stay, their counters are still part of the totals
+std::vector<Shard*> g_shards;
+
+__thread Shard* t_shard = nullptr;
+
+Shard* shard()
+{
+  if(!t_shard)
+  {
+    t_shard = new Shard;
+    muduo::MutexLockGuard lock(g_mutex);
+    g_shards.push_back(t_shard);
+  }
+  return t_shard;
+}
+}
+
+void stats::add(Metric metric, int64_t n)
+{
+  add_relaxed(&shard()->metrics[metric], n);
+}
+
+void stats::observe(Histogram histogram, double seconds)
+{
+  int bucket = 0;
+  while(bucket < kBucketNum - 1 && seconds > kBuckets[bucket])
+    ++bucket;
+  Shard* s = shard();
+  add_relaxed(&s->buckets[histogram][bucket], 1);
+  add_relaxed(&s->sum_us[histogram], static_cast<int64_t>(seconds * 1000 * 1000));
+}
+
+std::string stats::prometheus(const std::string &prefix)
+{
+  int64_t metrics[kMetricNum] = { 0 };
+  int64_t buckets[kHistogramNum][kBucketNum] = { { 0 } };
+  int64_t sum_us[kHistogramNum] = { 0 };
+  {
+    muduo::MutexLockGuard lock(g_mutex);
+    for(Shard* s : g_shards)
+    {
+      for(int i = 0; i < kMetricNum; ++i)
+        metrics[i] += s->metrics[i].load(std::memory_order_relaxed);
+      for(int i = 0; i < kHistogramNum; ++i)
+      {
+        for(int j = 0; j < kBucketNum; ++j)
+          buckets[i][j] += s->buckets[i][j].load(std::memory_order_relaxed);
+        sum_us[i] += s->sum_us[i].load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+  std::string out;
+  char line[256];
+  const char* last_name = nullptr;
+  for(int i = 0; i < kMetricNum; ++i)
+  {
+    const MetricInfo& info = kMetrics[i];
+    if(!last_name || ::strcmp(last_name, info.name) != 0)
+    {
+      snprintf(line, sizeof(line), "# HELP %s%s %s\n# TYPE %s%s %s\n",
+               prefix.c_str(), info.name, info.help, prefix.c_str(), info.name, info.type);
+      out += line;
+      last_name = info.name;
+    }
+    if(info.label)
+      snprintf(line, sizeof(line), "%s%s{state=\"%s\"} %ld\n", prefix.c_str(), info.name, info.label, metrics[i]);
+    else
+      snprintf(line, sizeof(line), "%s%s %ld\n", prefix.c_str(), info.name, metrics[i]);
+    out += line;
+  }
+  for(int i = 0; i < kHistogramNum; ++i)
+  {
+    const HistogramInfo& info = kHistograms[i];
+    snprintf(line, sizeof(line), "# HELP %s%s %s\n# TYPE %s%s histogram\n",
+             prefix.c_str(), info.name, info.help, prefix.c_str(), info.name);
+    out += line;
+    int64_t count = 0;
+    for(int j = 0; j < kBucketNum; ++j)
+    {
+      count += buckets[i][j];
+      if(j < kBucketNum - 1)
+        snprintf(line, sizeof(line), "%s%s_bucket{le=\"%g\"} %ld\n", prefix.c_str(), info.name, kBuckets[j], count);
+      else
+        snprintf(line, sizeof(line), "%s%s_bucket{le=\"+Inf\"} %ld\n", prefix.c_str(), info.name, count);
+      out += line;
+    }
+    snprintf(line, sizeof(line), "%s%s_sum %.6f\n%s%s_count %ld\n",
+             prefix.c_str(), info.name, static_cast<double>(sum_us[i]) / (1000 * 1000),
+             prefix.c_str(), info.name, count);
+    out += line;
+  }
+  return out;
+}
\ No newline at end of file
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <stdint.h>
+#include <string>
+
+namespace zy
+{
+// process wide metrics of local_server and socks_server, exported by StatsServer,
+// every thread counts into a shard of its own with plain relaxed stores,
+// so the hot path never shares a cache line, the scrape sums all shards
+namespace stats
+{
+enum Metric
+{
+  // gauges, accepted connections by state, see conState of both servers
+  kConnectionsStart,
+  kConnectionsVerified,
+  kConnectionsGotcmd,
+  kConnectionsResolved,
+  kConnectionsTransport,
+  kConnectionsMux,
+  // counters
+  kBytesIn, // read from socks clients, or from local_server by socks_server
+  kBytesOut, // read from the other end of tunnels and sent back
+  kRawBytes, // payload before encoding, see Compressor
+  kWireBytes, // payload after encoding
+  kHighWaterMarks,
+  kBudgetThrottles, // tunnels stopped because the loop is over its buffer budget
+  kConnectTimeouts,
+  kDnsTimeouts,
+  kIdleTimeouts, // transport tunnels closed without traffic
+  kDatagramsIn, // read from udp sockets, see UdpSocket
+  kDatagramsOut,
+  kDatagramsDropped, // truncated, or the socket buffer was full
+  kTfoAccepted, // accepted connections with data in the SYN, see Listener
+  kTfoConnects, // connects whose data in the SYN was acked, see HappyEyeballs
+  kTfoFallbacks, // connects that tried fast open but went through a full handshake
+  kLogDropped, // lines not logged because the disk can't keep up, see AsyncLog
+  kLogSuppressed, // lines over the rate of their call site, see log_rate.h
+  kDirectConnects, // connects of local_server routed around socks_server, see RouteTable
+  kRouteReloads, // rule files loaded again after a change
+  kMetricNum
+};
+
+enum Histogram
+{
+  kDnsSeconds, // answers from dns servers, cache hits are not observed
+  kConnectSeconds, // until the target, or socks_server for local_server, is connected
+  kFirstByteSeconds, // from the socks request until the first byte of the target is sent back
+  kHistogramNum
+};
+
+void add(Metric metric, int64_t n = 1);
+
+void observe(Histogram histogram, double seconds);
+
+// move a gauge from one state to another
+inline void move(Metric from, Metric to)
+{
+  add(from, -1);
+  add(to);
+}
+
+// prometheus text format of all metrics, prefix is prepended to every name
+std::string prometheus(const std::string& prefix);
+}
+}
\ No newline at end of file
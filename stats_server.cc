@@ -0,0 +1,32 @@
+#include "stats_server.h"
+#include "stats.h"
+
+#include <muduo/net/http/HttpRequest.h>
+#include <muduo/net/http/HttpResponse.h>
+#include <boost/bind.hpp>
+
+using namespace zy;
+
+StatsServer::StatsServer(muduo::net::EventLoop *loop, const muduo::net::InetAddress &addr, const std::string &prefix)
+  : server_(loop, addr, "stats_server"),
+    prefix_(prefix)
+{
+  server_.setHttpCallback(boost::bind(&StatsServer::onRequest, this, _1, _2));
+}
+
+void StatsServer::onRequest(const muduo::net::HttpRequest &request, muduo::net::HttpResponse *response)
+{
+  if(request.method() == muduo::net::HttpRequest::kGet && request.path() == "/metrics")
+  {
+    response->setStatusCode(muduo::net::HttpResponse::k200Ok);
+    response->setStatusMessage("OK");
+    response->setContentType("text/plain; version=0.0.4");
+    response->setBody(stats::prometheus(prefix_));
+  }
+  else
+  {
+    response->setStatusCode(muduo::net::HttpResponse::k404NotFound);
+    response->setStatusMessage("Not Found");
+    response->setCloseConnection(true);
+  }
+}
\ No newline at end of file
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <muduo/net/http/HttpServer.h>
+#include <boost/noncopyable.hpp>
+#include <string>
+
+namespace zy
+{
+// serve stats in prometheus text format on GET /metrics, runs in the base loop,
+// so scrapes never touch the io threads
+class StatsServer : boost::noncopyable
+{
+ public:
+  // prefix of every metric name, like "zy_socks_"
+  StatsServer(muduo::net::EventLoop* loop, const muduo::net::InetAddress& addr, const std::string& prefix);
+
+  void start() { server_.start(); }
+
+ private:
+  void onRequest(const muduo::net::HttpRequest& request, muduo::net::HttpResponse* response);
+
+  muduo::net::HttpServer server_;
+  std::string prefix_;
+};
+}
\ No newline at end of file
@@ -0,0 +1,81 @@
+#include "timing_wheel.h"
+
+#include <muduo/net/EventLoop.h>
+#include <boost/bind.hpp>
+#include <math.h>
+
+using namespace zy;
+
+TimingWheel::TimingWheel(muduo::net::EventLoop *loop, double tick, int slots)
+  : loop_(loop),
+    tick_(tick),
+    slots_(slots),
+    now_(0),
+    size_(0),
+    timerId_(loop_->runEvery(tick_, boost::bind(&TimingWheel::onTick, this)))
+{
+
+}
+
+TimingWheel::~TimingWheel()
+{
+  loop_->cancel(timerId_);
+}
+
+int64_t TimingWheel::ticks(double timeout) const
+{
+  // at least a whole tick, so nothing fires before its timeout
+  return now_ + 1 + static_cast<int64_t>(::ceil(timeout / tick_));
+}
+
+TimingWheel::EntryPtr TimingWheel::add(double timeout, const Callback &cb)
+{
+  loop_->assertInLoopThread();
+  EntryPtr entry(new Entry);
+  entry->callback = cb;
+  entry->deadline = ticks(timeout);
+  insert(entry);
+  return entry;
+}
+
+void TimingWheel::refresh(const EntryPtr &entry, double timeout)
+{
+  int64_t deadline = ticks(timeout);
+  if(entry && deadline > entry->deadline)
+    entry->deadline = deadline;
+}
+
+void TimingWheel::insert(const EntryPtr &entry)
+{
+  slots_[entry->deadline % slots_.size()].push_back(entry);
+  ++size_;
+}
+
+void TimingWheel::onTick()
+{
+  ++now_;
+  std::vector<EntryPtr>& slot = slots_[now_ % slots_.size()];
+  std::vector<EntryPtr> due;
+  due.swap(slot);
+  size_ -= due.size();
+  for(const EntryPtr& entry : due)
+  {
+    if(!entry->callback)
+      continue;
+    if(entry->deadline > now_)
+    {
+      // refreshed, or more than a turn away
+      insert(entry);
+      continue;
+    }
+    Callback cb;
+    cb.swap(entry->callback);
+    cb();
+  }
+  // keep the capacity of the slot
+  if(slot.empty())
+  {
+    due.clear();
+    due.swap(slot);
+  }
+}
\ No newline at end of file
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <muduo/net/TimerId.h>
+#include <boost/function.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+#include <stdint.h>
+#include <vector>
+
+namespace muduo
+{
+namespace net
+{
+class EventLoop;
+}
+}
+
+namespace zy
+{
+// hashed timing wheel of one loop, connect, dns and idle timeouts of every tunnel
+// of the loop share one repeating timer instead of a heap timer each,
+// add, refresh and cancel are O(1), an entry whose deadline was pushed back is
+// moved to its new slot only when its old slot comes up, so a refresh on every
+// read costs a store, timeouts fire up to one tick late
+class TimingWheel : boost::noncopyable
+{
+ public:
+  typedef boost::function<void()> Callback;
+
+  struct Entry
+  {
+    Callback callback; // empty once fired or cancelled
+    int64_t deadline; // in ticks
+  };
+  typedef boost::shared_ptr<Entry> EntryPtr;
+
+  // seconds per tick, slots per turn of the wheel, longer timeouts take more turns
+  explicit TimingWheel(muduo::net::EventLoop* loop, double tick = 0.1, int slots = 512);
+
+  ~TimingWheel();
+
+  // in loop thread, call cb once after timeout seconds
+  EntryPtr add(double timeout, const Callback& cb);
+
+  // push the deadline to timeout seconds from now, never earlier than it was
+  void refresh(const EntryPtr& entry, double timeout);
+
+  static void cancel(const EntryPtr& entry)
+  {
+    if(entry)
+      entry->callback = Callback();
+  }
+
+  size_t size() const { return size_; }
+
+ private:
+  int64_t ticks(double timeout) const;
+
+  void insert(const EntryPtr& entry);
+
+  void onTick();
+
+  muduo::net::EventLoop* loop_;
+  double tick_;
+  std::vector<std::vector<EntryPtr>> slots_;
+  int64_t now_; // ticks since start
+  size_t size_; // entries in slots, cancelled ones included
+  muduo::net::TimerId timerId_;
+};
+typedef TimingWheel::EntryPtr WheelEntryPtr;
+}
\ No newline at end of file
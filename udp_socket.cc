@@ -0,0 +1,200 @@
+#include "udp_socket.h"
+#include "stats.h"
+
+#include <muduo/net/Channel.h>
+#include <muduo/net/EventLoop.h>
+#include <muduo/base/Logging.h>
+#include <boost/bind.hpp>
+#include <errno.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+using namespace zy;
+
+namespace
+{
+// buffers of recvmmsg, shared by every socket of the thread, reads never interleave,
+// never freed, like the messages of messages.cc, only pages touched by datagrams get memory
+struct RecvBatch
+{
+  char data[UdpSocket::kBatch][UdpSocket::kMaxDatagram];
+  struct sockaddr_in6 peers[UdpSocket::kBatch];
+  struct iovec iovecs[UdpSocket::kBatch];
+  struct mmsghdr msgs[UdpSocket::kBatch];
+};
+
+__thread RecvBatch* t_recv = nullptr;
+
+socklen_t addr_length(const muduo::net::InetAddress& addr)
+{
+  return addr.family() == AF_INET ? sizeof(struct sockaddr_in) : sizeof(struct sockaddr_in6);
+}
+}
+
+UdpSocket::UdpSocket(muduo::net::EventLoop *loop, int family)
+  : loop_(loop),
+    fd_(::socket(family, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, IPPROTO_UDP)),
+    channel_(),
+    messageCallback_(),
+    pending_(),
+    pending_datagrams_()
+{
+  if(fd_ < 0)
+  {
+    LOG_SYSERR << "udp socket";
+  }
+  pending_datagrams_.reserve(kBatch);
+}
+
+UdpSocket::~UdpSocket()
+{
+  if(channel_)
+  {
+    channel_->disableAll();
+    channel_->remove();
+  }
+  if(fd_ >= 0)
+    ::close(fd_);
+}
+
+bool UdpSocket::bind(const muduo::net::InetAddress &addr)
+{
+  if(fd_ < 0 || ::bind(fd_, addr.getSockAddr(), addr_length(addr)) < 0)
+  {
+    LOG_SYSERR << "bind udp socket to " << addr.toIpPort();
+    return false;
+  }
+  return true;
+}
+
+muduo::net::InetAddress UdpSocket::localAddress() const
+{
+  struct sockaddr_in6 addr;
+  ::memset(&addr, 0, sizeof addr);
+  socklen_t len = sizeof addr;
+  if(::getsockname(fd_, reinterpret_cast<struct sockaddr*>(&addr), &len) < 0)
+  {
+    LOG_SYSERR << "getsockname of udp socket";
+  }
+  if(addr.sin6_family == AF_INET)
+    return muduo::net::InetAddress(*reinterpret_cast<struct sockaddr_in*>(&addr));
+  return muduo::net::InetAddress(addr);
+}
+
+void UdpSocket::start()
+{
+  loop_->assertInLoopThread();
+  if(fd_ < 0 || channel_)
+    return;
+  channel_.reset(new muduo::net::Channel(loop_, fd_));
+  channel_->setReadCallback(boost::bind(&UdpSocket::onRead, this));
+  channel_->enableReading();
+}
+
+void UdpSocket::onRead()
+{
+  if(!t_recv)
+    t_recv = new RecvBatch;
+  RecvBatch& batch = *t_recv;
+  Datagram datagrams[kBatch];
+  // a busy socket must not starve the other channels of the loop
+  for(int round = 0; round < 4; ++round)
+  {
+    for(int i = 0; i < kBatch; ++i)
+    {
+      batch.iovecs[i].iov_base = batch.data[i];
+      batch.iovecs[i].iov_len = kMaxDatagram;
+      ::memset(&batch.msgs[i].msg_hdr, 0, sizeof(batch.msgs[i].msg_hdr));
+      batch.msgs[i].msg_hdr.msg_name = &batch.peers[i];
+      batch.msgs[i].msg_hdr.msg_namelen = sizeof(batch.peers[i]);
+      batch.msgs[i].msg_hdr.msg_iov = &batch.iovecs[i];
+      batch.msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+    int n = ::recvmmsg(fd_, batch.msgs, kBatch, 0, NULL);
+    if(n < 0)
+    {
+      if(errno != EAGAIN && errno != EWOULDBLOCK)
+        LOG_SYSERR << "recvmmsg";
+      return;
+    }
+    int count = 0;
+    for(int i = 0; i < n; ++i)
+    {
+      if(batch.msgs[i].msg_hdr.msg_flags & MSG_TRUNC)
+        continue;
+      const struct sockaddr_in6& peer = batch.peers[i];
+      if(peer.sin6_family == AF_INET)
+        datagrams[count].peer = muduo::net::InetAddress(*reinterpret_cast<const struct sockaddr_in*>(&peer));
+      else
+        datagrams[count].peer = muduo::net::InetAddress(peer);
+      datagrams[count].data = muduo::StringPiece(batch.data[i], static_cast<int>(batch.msgs[i].msg_len));
+      ++count;
+    }
+    stats::add(stats::kDatagramsIn, count);
+    if(count < n)
+      stats::add(stats::kDatagramsDropped, n - count);
+    if(count > 0 && messageCallback_)
+      messageCallback_(datagrams, count);
+    if(n < kBatch)
+      return;
+  }
+}
+
+void UdpSocket::send(const muduo::net::InetAddress &to, const char *head, size_t head_len, const char *data, size_t len)
+{
+  Pending pending = { to, head_len + len };
+  pending_.append(head, head_len);
+  pending_.append(data, len);
+  pending_datagrams_.push_back(pending);
+  if(pending_datagrams_.size() >= static_cast<size_t>(kBatch))
+    flush();
+}
+
+void UdpSocket::flush()
+{
+  int count = static_cast<int>(pending_datagrams_.size());
+  if(count == 0)
+    return;
+  struct iovec iovecs[kBatch];
+  struct mmsghdr msgs[kBatch];
+  ::memset(msgs, 0, sizeof(msgs[0]) * count);
+  const char* data = pending_.peek();
+  for(int i = 0; i < count; ++i)
+  {
+    const Pending& pending = pending_datagrams_[i];
+    iovecs[i].iov_base = const_cast<char*>(data);
+    iovecs[i].iov_len = pending.length;
+    data += pending.length;
+    msgs[i].msg_hdr.msg_name = const_cast<struct sockaddr*>(pending.to.getSockAddr());
+    msgs[i].msg_hdr.msg_namelen = addr_length(pending.to);
+    msgs[i].msg_hdr.msg_iov = &iovecs[i];
+    msgs[i].msg_hdr.msg_iovlen = 1;
+  }
+  int sent = 0;
+  int dropped = 0;
+  while(sent + dropped < count)
+  {
+    int n = ::sendmmsg(fd_, msgs + sent + dropped, count - sent - dropped, 0);
+    if(n > 0)
+    {
+      sent += n;
+    }
+    else if(errno == EAGAIN || errno == EWOULDBLOCK || errno == ENOBUFS)
+    {
+      // socket buffer is full, drop the rest
+      dropped = count - sent;
+    }
+    else
+    {
+      // the first one is bad, e.g. its target port answered with icmp unreachable, skip it
+      LOG_DEBUG << "sendmmsg to " << pending_datagrams_[sent + dropped].to.toIpPort() << ": " << strerror(errno);
+      ++dropped;
+    }
+  }
+  stats::add(stats::kDatagramsOut, sent);
+  if(dropped > 0)
+    stats::add(stats::kDatagramsDropped, dropped);
+  pending_.retrieveAll();
+  pending_datagrams_.clear();
+}
\ No newline at end of file
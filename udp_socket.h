@@ -0,0 +1,82 @@
+#pragma once
+
+#include <muduo/base/StringPiece.h>
+#include <muduo/net/Buffer.h>
+#include <muduo/net/InetAddress.h>
+#include <boost/function.hpp>
+#include <boost/noncopyable.hpp>
+#include <memory>
+#include <stdint.h>
+#include <vector>
+
+namespace muduo
+{
+namespace net
+{
+class Channel;
+class EventLoop;
+}
+}
+
+namespace zy
+{
+// nonblocking udp socket of one loop, reads with recvmmsg and writes with sendmmsg,
+// so a burst of small datagrams costs a syscall per batch instead of one per datagram,
+// datagrams which don't fit in the socket buffer are dropped, as the network would
+class UdpSocket : boost::noncopyable
+{
+ public:
+  // datagrams per recvmmsg and sendmmsg
+  static const int kBatch = 32;
+  // larger datagrams are truncated by the kernel and dropped
+  static const size_t kMaxDatagram = 64 * 1024;
+
+  struct Datagram
+  {
+    muduo::net::InetAddress peer;
+    muduo::StringPiece data;
+  };
+
+  // one call per recvmmsg, data points into buffers which the next read reuses
+  typedef boost::function<void(const Datagram* datagrams, int count)> MessageCallback;
+
+  // family is AF_INET or AF_INET6
+  UdpSocket(muduo::net::EventLoop* loop, int family);
+
+  ~UdpSocket();
+
+  // port 0 picks any free port, false on error
+  bool bind(const muduo::net::InetAddress& addr);
+
+  muduo::net::InetAddress localAddress() const;
+
+  void setMessageCallback(const MessageCallback& cb) { messageCallback_ = cb; }
+
+  // in loop, start to read
+  void start();
+
+  // in loop, queue a datagram of head then data, all queued datagrams go out
+  // with one sendmmsg on flush(), or as soon as kBatch are queued
+  void send(const muduo::net::InetAddress& to, const char* head, size_t head_len, const char* data, size_t len);
+
+  void send(const muduo::net::InetAddress& to, const char* data, size_t len) { send(to, nullptr, 0, data, len); }
+
+  void flush();
+
+ private:
+  struct Pending
+  {
+    muduo::net::InetAddress to;
+    size_t length; // bytes in pending_
+  };
+
+  void onRead();
+
+  muduo::net::EventLoop* loop_;
+  int fd_;
+  std::unique_ptr<muduo::net::Channel> channel_;
+  MessageCallback messageCallback_;
+  muduo::net::Buffer pending_; // payload of queued datagrams back to back
+  std::vector<Pending> pending_datagrams_;
+};
+}
\ No newline at end of file